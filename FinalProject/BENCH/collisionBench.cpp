@@ -0,0 +1,106 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Benchmark of the collision detection (UAV_Collision.h), without MPI.
+UAVs are spread over the virtual sphere the show flies on, where they crowd the
+most, and every 100th one is put 5 mm from the one before so there are collisions
+to find. For each swarm size the sorted spatial hash is timed, and up to 20000
+UAVs it is checked against the all-pairs loop it replaced (squared distances).
+
+Compiled with:
+    g++ -O2 -std=c++11 collisionBench.cpp -o collisionBench
+(-fopenmp to search with OMP_NUM_THREADS threads)
+Run with:
+    ./collisionBench [largest swarm]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include "../UAV_Collision.h"
+
+/*
+Places count UAVs on a sphere of radius 10 m around (0, 0, 50)
+@param state filled with count UAVs
+@param count number of UAVs
+*/
+void makeSwarm(uavState &state, int count)
+{
+    state.resize(count);
+    srand(4122);
+    for (int i = 0; i < count; i++)
+    {
+        if (i % 100 == 99)
+        {
+            state.x[i] = state.x[i - 1] + 0.005;
+            state.y[i] = state.y[i - 1];
+            state.z[i] = state.z[i - 1];
+        } else
+        {
+            double z = 2.0 * rand() / RAND_MAX - 1.0, angle = 2.0 * M_PI * rand() / RAND_MAX;
+            double r = sqrt(1.0 - z * z);
+            state.x[i] = 10.0 * r * cos(angle);
+            state.y[i] = 10.0 * r * sin(angle);
+            state.z[i] = 50.0 + 10.0 * z;
+        }
+        state.vx[i] = i; // a velocity that tells the UAVs apart
+    }
+}
+
+// the pairs the all-pairs loop finds, lower index first
+std::vector<std::pair<int, int> > allPairs(const uavState &state, int count)
+{
+    std::vector<std::pair<int, int> > pairs;
+    const double limit = collisionDistance * collisionDistance;
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = i + 1; j < count; j++)
+        {
+            double dx = state.x[i] - state.x[j], dy = state.y[i] - state.y[j], dz = state.z[i] - state.z[j];
+            if (dx * dx + dy * dy + dz * dz <= limit)
+                pairs.push_back(std::make_pair(i, j));
+        }
+    }
+    return pairs;
+}
+
+int main(int argc, char *argv[])
+{
+    int largest = (argc > 1) ? atoi(argv[1]) : 1000000;
+    if (largest <= 0)
+    {
+        fprintf(stderr, "usage %s [largest swarm]\n", argv[0]);
+        exit(1);
+    }
+    collisionGrid grid;
+    for (int count = 1000; count <= largest; count *= 10)
+    {
+        uavState state;
+        makeSwarm(state, count);
+        size_t pairs = grid.findPairs(state).size();
+        int rounds = count <= 10000 ? 100 : 5;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++)
+            grid.findPairs(state);
+        double gridSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() / rounds;
+        printf("%8d UAVs, %5zu pairs: grid %9.3f ms/step", count, pairs, gridSeconds * 1e3);
+        if (count <= 20000)
+        {
+            begin = std::chrono::steady_clock::now();
+            std::vector<std::pair<int, int> > expected = allPairs(state, count);
+            double naiveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (expected != grid.findPairs(state))
+            {
+                fprintf(stderr, "\nERROR, the grid found other pairs than the all-pairs loop\n");
+                exit(1);
+            }
+            printf(", all pairs %9.3f ms/step (%.0fx)", naiveSeconds * 1e3, naiveSeconds / gridSeconds);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Micro-benchmark of the UAV time step (UAV_Kernel.h) on one core,
+without MPI. A swarm with half of the UAVs already orbiting the virtual sphere and
+half still flying towards it is moved by:
+    per UAV     the loop the kernel replaced: one UAV at a time from interleaved
+                x, y, z, vx, vy, vz records, with pow, sqrt and branches
+    scalar      the kernel on plain doubles (the fallback)
+    AVX2        the kernel 4 UAVs at a time, if compiled with -mavx2
+    AVX-512     the kernel 8 UAVs at a time, if compiled with -mavx512f
+and prints UAVs moved per second. The random numbers are drawn once up front so
+only the step itself is timed. Every vector path is first checked to produce
+bit-identical states to the scalar one over 100 steps.
+
+Compiled with:
+    g++ -O2 -mavx512f -ffp-contract=off -std=c++11 kernelBench.cpp -o kernelBench
+Run with:
+    ./kernelBench [UAVs] [steps]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#include "../UAV_Kernel.h"
+
+/*
+The step as it was before the kernel, for one UAV
+@param myUAV x, y, z, vx, vy, vz of the UAV
+@param next where its next x, y, z, vx, vy, vz are stored
+@param sphereFlag the UAV's onSphere flag
+@param random its three random numbers
+*/
+void moveUAV(const double *myUAV, double *next, int &sphereFlag, const double *random)
+{
+    double acc_x, acc_y, acc_z, fx, fy, fz;
+    double distToCenter = sqrt(pow(myUAV[0], 2) + pow(myUAV[1], 2) + pow((myUAV[2] - 50.0), 2));
+    double velocity = sqrt(pow(myUAV[3], 2) + pow(myUAV[4], 2) + pow(myUAV[5], 2));
+    double dirX = -myUAV[0] / distToCenter;
+    double dirY = -myUAV[1] / distToCenter;
+    double dirZ = (50.0 - myUAV[2]) / distToCenter;
+    double effectiveR = (-20 * dirZ + sqrt(400 * pow(dirZ, 2.0) + 1200)) / 2.0;
+    if (distToCenter > 10.1)
+    {
+        if (velocity <= 1.8)
+        {
+            acc_x = effectiveR * dirX;
+            acc_y = effectiveR * dirY;
+            acc_z = effectiveR * dirZ;
+            next[0] = myUAV[0] + (myUAV[3] * 0.1) + (acc_x * 0.1 * 0.1 * 0.5);
+            next[1] = myUAV[1] + (myUAV[4] * 0.1) + (acc_y * 0.1 * 0.1 * 0.5);
+            next[2] = myUAV[2] + (myUAV[5] * 0.1) + (acc_z * 0.1 * 0.1 * 0.5);
+            next[3] = myUAV[3] + acc_x * 0.1;
+            next[4] = myUAV[4] + acc_y * 0.1;
+            next[5] = myUAV[5] + acc_z * 0.1;
+        } else
+        {
+            next[0] = myUAV[0] + (myUAV[3] * 0.1);
+            next[1] = myUAV[1] + (myUAV[4] * 0.1);
+            next[2] = myUAV[2] + (myUAV[5] * 0.1);
+            next[3] = myUAV[3];
+            next[4] = myUAV[4];
+            next[5] = myUAV[5];
+        }
+    }
+    else if (sphereFlag == 0)
+    {
+        sphereFlag = 1;
+    }
+    if (sphereFlag == 1)
+    {
+        double fS = 2 * (distToCenter - 10);
+        fx = fS * dirX * UAVMASS;
+        fy = fS * dirY * UAVMASS;
+        fz = fS * dirZ * UAVMASS;
+        double cx = -dirY * random[2] - random[1] * -dirZ;
+        double cy = -dirX * random[2] - random[0] * -dirZ;
+        double cz = -dirX * random[1] - (-dirY) * random[0];
+        double magnitude = sqrt(pow(cx, 2) + pow(cy, 2) + pow(cz, 2));
+        if (magnitude > 0)
+        {
+            fx += 0.1 * cx / magnitude;
+            fy += 0.1 * cy / magnitude;
+            fz += 0.1 * cz / magnitude;
+        }
+        magnitude = sqrt(pow(fx, 2) + pow(fy, 2) + pow(fz, 2)) / 20.0;
+        fx /= magnitude;
+        fy /= magnitude;
+        fz /= magnitude;
+        acc_z = fz / UAVMASS - 10.0;
+        acc_x = fx / UAVMASS;
+        acc_y = fy / UAVMASS;
+        next[0] = myUAV[0] + (myUAV[3] * 0.1) + (acc_x * 0.1 * 0.1 * 0.5);
+        next[1] = myUAV[1] + (myUAV[4] * 0.1) + (acc_y * 0.1 * 0.1 * 0.5);
+        next[2] = myUAV[2] + (myUAV[5] * 0.1) + (acc_z * 0.1 * 0.1 * 0.5);
+        next[3] = myUAV[3] + acc_x * 0.1;
+        next[4] = myUAV[4] + acc_y * 0.1;
+        next[5] = myUAV[5] + acc_z * 0.1;
+    }
+}
+
+/*
+Fills a swarm: even UAVs orbit near the sphere, odd ones are on their way up
+@param state filled with count UAVs
+@param random filled with the UAVs' random numbers
+*/
+void makeSwarm(uavState &state, uavRandoms &random, size_t count)
+{
+    state.resize(count);
+    random.resize(count);
+    srand(4122);
+    for (size_t i = 0; i < count; i++)
+    {
+        double angle = 2.0 * M_PI * rand() / RAND_MAX;
+        double r = (i % 2 == 0) ? 10.0 : 30.0 + 20.0 * rand() / RAND_MAX;
+        state.x[i] = r * cos(angle);
+        state.y[i] = r * sin(angle);
+        state.z[i] = (i % 2 == 0) ? 50.0 : 0.0;
+        state.vx[i] = state.vy[i] = 0;
+        state.vz[i] = (i % 2 == 0) ? 0.0 : 1.0 * rand() / RAND_MAX;
+        state.onSphere[i] = (i % 2 == 0) ? 1.0 : 0.0;
+        random.x[i] = rand() % 11;
+        random.y[i] = rand() % 11;
+        random.z[i] = rand() % 3 - 1;
+    }
+}
+
+/*
+Runs steps of the kernel, each step starting from the last one's result
+@param state the swarm, moved in place
+@param random the UAVs' random numbers
+@param steps number of steps
+*/
+template <typename L>
+void evolve(uavState &state, const uavRandoms &random, int steps)
+{
+    uavState next(state.size());
+    memcpy(next.onSphere.get(), state.onSphere.get(), sizeof(double) * state.size());
+    for (int s = 0; s < steps; s++)
+    {
+        moveUAVs<L>(state, 0, state.size(), next, random);
+        for (int c = 0; c < uavState::numComponents; c++)
+            memcpy(state.component(c).get(), next.component(c).get(), sizeof(double) * state.size());
+    }
+    memcpy(state.onSphere.get(), next.onSphere.get(), sizeof(double) * state.size());
+}
+
+// true if two swarms hold the same bits
+bool sameState(uavState &a, uavState &b)
+{
+    for (int c = 0; c < uavState::numComponents; c++)
+        if (memcmp(a.component(c).get(), b.component(c).get(), sizeof(double) * a.size()) != 0)
+            return false;
+    return memcmp(a.onSphere.get(), b.onSphere.get(), sizeof(double) * a.size()) == 0;
+}
+
+/*
+Times one step of the kernel, repeated
+@return UAVs moved per second
+*/
+template <typename L>
+double timeKernel(const uavState &state, const uavRandoms &random, int steps)
+{
+    uavState next(state.size());
+    memcpy(next.onSphere.get(), state.onSphere.get(), sizeof(double) * state.size());
+    auto begin = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++)
+        moveUAVs<L>(state, 0, state.size(), next, random);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return state.size() * (double)steps / seconds;
+}
+
+/*
+Checks a vector path against the scalar kernel, then times it
+@param count UAVs in the swarm
+@param steps number of timed steps
+*/
+template <typename L>
+void runLanes(size_t count, int steps)
+{
+    uavState state, reference;
+    uavRandoms random;
+    makeSwarm(state, random, count);
+    makeSwarm(reference, random, count);
+    evolve<L>(state, random, 100);
+    evolve<scalarLanes>(reference, random, 100);
+    if (!sameState(state, reference))
+    {
+        fprintf(stderr, "ERROR, %s does not match the scalar kernel\n", L::name());
+        exit(1);
+    }
+    makeSwarm(state, random, count);
+    printf("  %-10s %8.1f M UAVs/s per core\n", L::name(), timeKernel<L>(state, random, steps) / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = (argc > 1) ? atol(argv[1]) : 100000;
+    int steps = (argc > 2) ? atoi(argv[2]) : 200;
+    if (count == 0 || steps <= 0)
+    {
+        fprintf(stderr, "usage %s [UAVs] [steps]\n", argv[0]);
+        exit(1);
+    }
+    printf("%zu UAVs, %d steps\n", count, steps);
+
+    // the old loop, on interleaved records
+    uavState state;
+    uavRandoms random;
+    makeSwarm(state, random, count);
+    std::vector<double> records(count * 6), next(count * 6);
+    std::vector<int> flags(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int c = 0; c < uavState::numComponents; c++)
+            records[i * 6 + c] = state.component(c)[i];
+        flags[i] = (int)state.onSphere[i];
+    }
+    auto begin = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            double uavRandom[3] = {random.x[i], random.y[i], random.z[i]};
+            moveUAV(&records[i * 6], &next[i * 6], flags[i], uavRandom);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("  %-10s %8.1f M UAVs/s per core\n", "per UAV", count * (double)steps / seconds / 1e6);
+
+    runLanes<scalarLanes>(count, steps);
+#ifdef __AVX2__
+    runLanes<avx2Lanes>(count, steps);
+#endif
+#ifdef __AVX512F__
+    runLanes<avx512Lanes>(count, steps);
+#endif
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Benchmark of the UAVs' random numbers (UAV_Random.h) on one core,
+without MPI. Philox4x32-10 is first checked against the known answers published
+with Random123, then the fill is timed against the rand() loop it replaced, and
+a block drawn in pieces, as ranks and threads draw it, is checked to give the
+same numbers as the whole block at once.
+
+Compiled with:
+    g++ -O2 -mavx2 -fopenmp-simd -std=c++11 randomBench.cpp -o randomBench
+Run with:
+    ./randomBench [UAVs] [steps]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "../UAV_Random.h"
+
+// Philox4x32-10 known answers: counter, key, result
+const uint32_t knownAnswers[3][10] = {
+    {0, 0, 0, 0, 0, 0, 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+    {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+        0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+    {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0,
+        0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+
+int main(int argc, char *argv[])
+{
+    size_t count = (argc > 1) ? atol(argv[1]) : 100000;
+    int steps = (argc > 2) ? atoi(argv[2]) : 200;
+    if (count == 0 || steps <= 0)
+    {
+        fprintf(stderr, "usage %s [UAVs] [steps]\n", argv[0]);
+        exit(1);
+    }
+    for (const uint32_t *known : knownAnswers)
+    {
+        uint32_t c[4] = {known[0], known[1], known[2], known[3]};
+        philox4x32(c[0], c[1], c[2], c[3], known[4], known[5]);
+        if (memcmp(c, known + 6, sizeof(c)) != 0)
+        {
+            fprintf(stderr, "ERROR, Philox4x32-10 does not give the known answer\n");
+            exit(1);
+        }
+    }
+
+    // in pieces of every size up to 37 UAVs against the whole block
+    uavRandoms whole, pieces;
+    whole.resize(count);
+    pieces.resize(count);
+    drawRandoms(whole, 0, count, 4122, 1000, 7);
+    for (size_t first = 0, piece = 1; first < count; first += piece, piece = piece % 37 + 1)
+        drawRandoms(pieces, first, std::min(piece, count - first), 4122, 1000, 7);
+    if (memcmp(whole.x.get(), pieces.x.get(), count * sizeof(double)) != 0 ||
+        memcmp(whole.y.get(), pieces.y.get(), count * sizeof(double)) != 0 ||
+        memcmp(whole.z.get(), pieces.z.get(), count * sizeof(double)) != 0)
+    {
+        fprintf(stderr, "ERROR, drawing in pieces gives other numbers\n");
+        exit(1);
+    }
+    printf("%zu UAVs, %d steps\n", count, steps);
+
+    uavRandoms random;
+    random.resize(count);
+    srand(4122);
+    auto begin = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            random.x[i] = (double)(rand() % 11);
+            random.y[i] = (double)(rand() % 11);
+            random.z[i] = (double)(rand() % 3) - 1;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("  %-10s %8.1f M UAVs/s per core\n", "rand()", count * (double)steps / seconds / 1e6);
+
+    begin = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++)
+        drawRandoms(random, 0, count, 4122, 0, s);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("  %-10s %8.1f M UAVs/s per core\n", "Philox", count * (double)steps / seconds / 1e6);
+
+    // rough spread check: every value of x and z should come up about equally often
+    long histogram[11] = {0}, thirds[3] = {0};
+    for (size_t i = 0; i < count; i++)
+    {
+        histogram[(int)random.x[i]]++;
+        thirds[(int)random.z[i] + 1]++;
+    }
+    printf("  x 0..10:");
+    for (long h : histogram)
+        printf(" %.3f", h * 11.0 / count);
+    printf("\n  z -1..1: %.3f %.3f %.3f (1 is even)\n", thirds[0] * 3.0 / count, thirds[1] * 3.0 / count, thirds[2] * 3.0 / count);
+    return 0;
+}
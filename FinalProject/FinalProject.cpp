@@ -4,14 +4,62 @@ Class: ECE4122
 Last Date Modified: December 4th, 2019
 Description: Final Project
 
-Using OpenMPI with 16 nodes and OpenGL to simulate Unmanned Aerial Vehicles putting a
-half-time show around a football field.
+Using OpenMPI on any number of ranks from 2 up and OpenGL to simulate Unmanned
+Aerial Vehicles putting a half-time show around a football field; the number of
+UAVs is given on the command line.
+
+Rank 0 draws the show. The UAVs are split into contiguous blocks over the other
+ranks, as evenly as possible, so any number of UAVs runs on any number of ranks
+(at least 2). After every step the blocks are gathered on every one of these
+worker ranks. The state is kept as a structure of arrays (UAV_State.h) and each
+rank moves its block with the vectorized kernel in UAV_Kernel.h.
+
+The workers run free of the display: rank 0 takes no part in their gather. It
+asks rank 1 for a frame, every UAV's position at the latest step rank 1 has, and
+asks for the next one as soon as it arrives; rank 1 answers between its steps
+when asked, so the show is simulated at full speed whatever the frame rate.
+Rank 0 draws one frame while the next is being received, all UAVs with one
+instanced draw call (UAV_Render.h). With --headless rank 0
+never opens a window and takes the frames as fast as they come, for batch runs
+and benchmarks.
+
+The gather is non-blocking and there is no barrier, the gather itself keeps the
+ranks in step. While it is in flight each rank already moves its own block from
+its own last state; once the other blocks arrive the collisions are resolved and
+only the vectors holding a UAV whose velocity a collision changed are moved
+again. Rank 1 prints the step throughput at the end.
+
+Built with -fopenmp a rank moves its block and searches the collisions with
+OMP_NUM_THREADS threads, all sharing the rank's one copy of the swarm; only the
+master thread calls MPI. One rank per node (or NUMA node) then replaces one rank
+per core, so a node keeps one rcvbuffer instead of one per core and the swarm's
+collisions are searched once per node instead of once per core.
+
+With --checkpoint FILE the workers save the whole state, every UAV's position,
+velocity and onSphere flag, every --checkpoint-every steps (100 by default).
+Each worker writes its own block of each array with one collective MPI-IO call
+into the same file, FILE.tmp, renamed over FILE once complete, so a crash
+while writing leaves the last checkpoint whole. --restart FILE flies on from a
+checkpoint, with its UAVs and seed; the random numbers depend only on the seed,
+the UAV and the step, so the show ends exactly as if it had never stopped, on
+any number of ranks. With --record FILE rank 1 also logs every step's positions
+in the compact format of UAV_Trajectory.h, which TrajectoryViewer replays
+without MPI.
 
 Compiled with:
     module load mesa gcc mvapich2
-    mpic++ FinalProject.cpp -lGLU -lglut -std=c++11
+    mpic++ -O2 -mavx2 -fopenmp FinalProject.cpp -lGLU -lglut -std=c++11
+(-mavx512f -ffp-contract=off for AVX-512, neither for the scalar kernel)
 Run with:
-    mpirun -np 16 ./a.out
+    mpirun -np 16 ./a.out [UAVs] [--headless] [--seed N]
+        [--checkpoint FILE] [--checkpoint-every K] [--restart FILE] [--record FILE]
+or, on 4 NUMA nodes of 16 cores, one rank per NUMA node and a thread per core:
+    OMP_NUM_THREADS=16 mpirun -np 5 --map-by numa --bind-to numa ./a.out [UAVs] [--headless] [--seed N]
+UAVs defaults to 15, the original 3 x 5 formation; larger shows start from a wider
+grid over the same part of the field. The random pushes of the orbit come from
+a counter-based generator (UAV_Random.h) keyed by the seed, which defaults to the
+time; the same seed gives the same show, to the bit, on any number of ranks and
+threads.
 
 EC: Used football field bitmap.
 */
@@ -19,6 +67,7 @@ EC: Used football field bitmap.
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mpi.h"
 #include "iomanip"
 #include <cmath>
@@ -31,44 +80,102 @@ EC: Used football field bitmap.
 
        #include <OpenGl/glu.h>
 #else
+       #define GL_GLEXT_PROTOTYPES
        #include <GL/glut.h>
 #endif
 #include <chrono>
 #include <thread>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
 #include "ECE_Bitmap.h"
+#include "UAV_Collision.h"
+#include "UAV_Kernel.h"
+#include "UAV_Random.h"
+#include "UAV_Render.h"
+#include "UAV_State.h"
+#include "UAV_Trajectory.h"
+
+// number of UAVs in the show
+int numUAVs = 15;
+
+// steps the show lasts; step 0 is the formation on the ground
+const int showSteps = 599;
+
+// no window, rank 0 only collects the frames
+bool headless = false;
+
+// key of the random numbers: the same seed flies the same show, on any number of ranks and threads
+uint64_t showSeed = 0;
+
+// checkpoint file and steps between checkpoints, none when empty
+std::string checkpointPath;
+int checkpointEvery = 100;
+
+// checkpoint to fly on from and the step it holds, 0 for a show from the start
+std::string restartPath;
+int firstStep = 0;
+
+// rank 1: the log of every step's positions, when asked for
+trajectoryWriter trajectory;
+std::string recordPath;
+
+// steps per chunk of the trajectory log, the most a viewer decodes to show one step
+const int trajectoryChunk = 32;
+
+// a checkpoint starts with "UAVCKPT1", then UAVs, step and seed as 64-bit numbers,
+// padded to 64 bytes; then the x of every UAV, every y, z, vx, vy, vz and onSphere
+const char checkpointMagic[8] = {'U', 'A', 'V', 'C', 'K', 'P', 'T', '1'};
+const MPI_Offset checkpointHeaderSize = 64;
+
+// the worker ranks 1 to n - 1, as ranks 0 to n - 2; MPI_COMM_NULL on rank 0
+MPI_Comm simComm = MPI_COMM_NULL;
+
+// every UAV, gathered from all ranks after each step
+uavState rcvbuffer;
+
+// this rank's UAVs and their onSphere flags, double buffered: sendBuffer[current]
+// was sent in the last gather, the next step is computed into the other one
+uavState sendBuffer[2];
+int current = 0;
+
+// the gather sends each block as its x, y, z, vx, vy, vz arrays one after the
+// other, so one collective moves all of them; packedAll holds every rank's block
+std::vector<double> packedBlock, packedAll;
+std::vector<int> packedCounts, packedDispls;
 
-#define UAVMASS 1.0
-#define MAXF 20.0
+// the gather in flight, MPI_REQUEST_NULL when there is none
+MPI_Request gatherRequest = MPI_REQUEST_NULL;
 
-// Send location and velocity vector in each direction
-const int numElements = 6; // x, y, z, vx, vy, vz
+// random numbers for this rank's UAVs, drawn every step
+uavRandoms randoms;
 
-const int rcvSize = 16 * 6; // (Main task + 15 UAVs) * numElements
+// UAVs a thread moves at a time, a multiple of every vector width
+const int uavChunk = 1024;
 
-double* rcvbuffer = new double[rcvSize];
+// this rank's block of UAVs
+int myFirst = 0, myCount = 0;
 
-double sendBuffer[numElements];
+// UAVs every worker contributes to the gather and where they go in rcvbuffer
+std::vector<int> gatherCounts, gatherDispls;
 
-// x,y,z, vx, vy, vz
-double currInfo[rcvSize] = {0,0,0,0,0,0,
-           -45.72, 24.384, 0, 0, 0, 0, // Top left
-           -22.86, 24.384, 0, 0, 0, 0, // Top left mid
-                0, 24.384, 0, 0, 0, 0, // Top mid
-            22.86, 24.384, 0, 0, 0, 0, // Top right mid
-            45.72, 24.384, 0, 0, 0, 0, // Top right
+// tags of the frame channel between rank 0 and rank 1
+const int frameRequestTag = 1, frameTag = 2, lastFrameTag = 3;
 
-           -45.72, 0, 0, 0, 0, 0, // Mid left
-           -22.86, 0, 0, 0, 0, 0, // Mid left mid
-                0, 0, 0, 0, 0, 0, // Mid mid
-            22.86, 0, 0, 0, 0, 0, // Mid right mid
-            45.72, 0, 0, 0, 0, 0, // Mid right
+// rank 0: two frames, one is drawn while the other is received; a frame is the
+// step it shows, then the x of every UAV, then every y, then every z
+std::vector<double> frames[2];
+int drawnFrame = 0;
+MPI_Request frameAsk = MPI_REQUEST_NULL, frameReceive = MPI_REQUEST_NULL;
+bool showOver = false;
 
-           -45.72, -24.384, 0, 0, 0, 0, // Bot left
-           -22.86, -24.384, 0, 0, 0, 0, // Bot left mid
-                0, -24.384, 0, 0, 0, 0, // Bot mid
-            22.86, -24.384, 0, 0, 0, 0, // Bot right mid
-            45.72, -24.384, 0, 0, 0, 0, // Bot right
-};
+// rank 1: the frame being sent and the renderer's request it waits for
+std::vector<double> frameOut;
+MPI_Request frameSend = MPI_REQUEST_NULL, frameAsked = MPI_REQUEST_NULL;
+int frameToken = 0;
 
 typedef struct Image {
     unsigned long sizeX;
@@ -76,12 +183,317 @@ typedef struct Image {
     char *data;
 }Image;
 
-int onSphere[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}; // flag to indicate UAV on virtual sphere
+// finds the colliding pairs without testing every pair
+collisionGrid collisions;
 
 GLuint texture[1];
 // bmp figure
 BMP field;
 
+// static buffers and instanced UAVs, when the context can do it
+showRenderer renderer;
+
+/*
+ * Lines the UAVs up in rows over the field, at rest. 15 UAVs give the original
+ * 3 x 5 formation: rows 24.384 m apart, columns 22.86 m apart.
+ * @param state every UAV, filled
+ * @param count number of UAVs
+ */
+void initialFormation(uavState &state, int count)
+{
+    int rows = std::max(1, (int)lround(sqrt(count * 3.0 / 5.0)));
+    int cols = (count + rows - 1) / rows;
+    rows = (count + cols - 1) / cols;
+    for (int i = 0; i < count; i++)
+    {
+        int row = i / cols, col = i % cols;
+        state.x[i] = (cols > 1) ? -45.72 + 91.44 * col / (cols - 1) : 0;
+        state.y[i] = (rows > 1) ? 24.384 - 48.768 * row / (rows - 1) : 0;
+        state.z[i] = state.vx[i] = state.vy[i] = state.vz[i] = 0;
+    }
+}
+
+/*
+ * Splits the UAVs into one contiguous block per worker. Rank 0 draws and gets none,
+ * the others get numUAVs / (numTasks - 1) each, the first ones one more. The
+ * gather's counts are indexed by rank in simComm.
+ * @param numTasks number of ranks
+ * @param rank current process rank
+ */
+void assignBlocks(int numTasks, int rank)
+{
+    int workers = numTasks - 1;
+    gatherCounts.assign(workers, 0);
+    gatherDispls.assign(workers, 0);
+    packedCounts.assign(workers, 0);
+    packedDispls.assign(workers, 0);
+    for (int w = 0; w < workers; w++)
+    {
+        int first = w * (numUAVs / workers) + std::min(w, numUAVs % workers);
+        int count = numUAVs / workers + (w < numUAVs % workers ? 1 : 0);
+        gatherCounts[w] = count;
+        gatherDispls[w] = first;
+        packedCounts[w] = count * uavState::numComponents;
+        packedDispls[w] = first * uavState::numComponents;
+        if (w == rank - 1)
+        {
+            myFirst = first;
+            myCount = count;
+        }
+    }
+}
+
+/*
+ * Starts collecting sendBuffer[current] of every worker on every worker. Both
+ * buffers stay free to use, the block is copied out before it is sent.
+ */
+void startGather()
+{
+    for (int c = 0; c < uavState::numComponents; c++)
+    {
+        memcpy(packedBlock.data() + c * myCount, sendBuffer[current].component(c).get(), sizeof(double) * myCount);
+    }
+    MPI_Iallgatherv(packedBlock.data(), myCount * uavState::numComponents, MPI_DOUBLE, packedAll.data(),
+        packedCounts.data(), packedDispls.data(), MPI_DOUBLE, simComm, &gatherRequest);
+}
+
+/*
+ * Waits until the gather started last has arrived and copies it into rcvbuffer;
+ * returns at once if none is in flight
+ */
+void finishGather()
+{
+    if (gatherRequest == MPI_REQUEST_NULL)
+    {
+        return;
+    }
+    MPI_Wait(&gatherRequest, MPI_STATUS_IGNORE);
+    for (size_t r = 0; r < gatherCounts.size(); r++)
+    {
+        for (int c = 0; c < uavState::numComponents; c++)
+        {
+            memcpy(rcvbuffer.component(c).get() + gatherDispls[r], packedAll.data() + packedDispls[r] + c * gatherCounts[r],
+                sizeof(double) * gatherCounts[r]);
+        }
+    }
+}
+
+/*
+ * Copies every UAV's position in rcvbuffer into a frame
+ * @param frame resized and filled
+ * @param step the step rcvbuffer holds
+ */
+void packFrame(std::vector<double> &frame, int step)
+{
+    frame.resize(1 + 3 * (size_t)numUAVs);
+    frame[0] = step;
+    memcpy(&frame[1], rcvbuffer.x.get(), sizeof(double) * numUAVs);
+    memcpy(&frame[1 + numUAVs], rcvbuffer.y.get(), sizeof(double) * numUAVs);
+    memcpy(&frame[1 + 2 * (size_t)numUAVs], rcvbuffer.z.get(), sizeof(double) * numUAVs);
+}
+
+/*
+ * Rank 0: asks rank 1 for its latest frame, received into the frame not drawn
+ */
+void requestFrame()
+{
+    std::vector<double> &next = frames[1 - drawnFrame];
+    next.resize(1 + 3 * (size_t)numUAVs);
+    MPI_Wait(&frameAsk, MPI_STATUS_IGNORE);
+    MPI_Irecv(next.data(), (int)next.size(), MPI_DOUBLE, 1, MPI_ANY_TAG, MPI_COMM_WORLD, &frameReceive);
+    MPI_Isend(&frameToken, 1, MPI_INT, 1, frameRequestTag, MPI_COMM_WORLD, &frameAsk);
+}
+
+/*
+ * Rank 0: draws the requested frame from now on if it has arrived, and asks for
+ * the next one unless it was the last
+ * @param wait true to wait for it
+ * @return true if a frame arrived
+ */
+bool receiveFrame(bool wait)
+{
+    if (frameReceive == MPI_REQUEST_NULL)
+    {
+        return false;
+    }
+    int arrived = 1;
+    MPI_Status status;
+    if (wait)
+    {
+        MPI_Wait(&frameReceive, &status);
+    }
+    else
+    {
+        MPI_Test(&frameReceive, &arrived, &status);
+    }
+    if (!arrived)
+    {
+        return false;
+    }
+    drawnFrame = 1 - drawnFrame;
+    if (status.MPI_TAG == lastFrameTag)
+    {
+        MPI_Wait(&frameAsk, MPI_STATUS_IGNORE);
+        showOver = true;
+    }
+    else
+    {
+        requestFrame();
+    }
+    return true;
+}
+
+/*
+ * Rank 1: sends rcvbuffer to rank 0 if it asked for a frame and the last one is
+ * out, else returns at once. The last frame is always sent, waiting as needed.
+ * @param step the step rcvbuffer holds
+ * @param last true once the show is over
+ */
+void serveFrame(int step, bool last)
+{
+    int done = 1;
+    if (last)
+    {
+        MPI_Wait(&frameSend, MPI_STATUS_IGNORE);
+        MPI_Wait(&frameAsked, MPI_STATUS_IGNORE);
+        packFrame(frameOut, step);
+        MPI_Send(frameOut.data(), (int)frameOut.size(), MPI_DOUBLE, 0, lastFrameTag, MPI_COMM_WORLD);
+        return;
+    }
+    MPI_Test(&frameSend, &done, MPI_STATUS_IGNORE);
+    if (!done)
+    {
+        return;
+    }
+    MPI_Test(&frameAsked, &done, MPI_STATUS_IGNORE);
+    if (!done)
+    {
+        return;
+    }
+    packFrame(frameOut, step);
+    MPI_Isend(frameOut.data(), (int)frameOut.size(), MPI_DOUBLE, 0, frameTag, MPI_COMM_WORLD, &frameSend);
+    MPI_Irecv(&frameToken, 1, MPI_INT, 0, frameRequestTag, MPI_COMM_WORLD, &frameAsked);
+}
+
+/*
+ * Workers: writes this rank's block of the state after a step, sendBuffer[1 - current],
+ * into the checkpoint. Every array is written with one collective call, each rank
+ * at its block's place, then the file replaces the last checkpoint.
+ * @param step the step just computed
+ */
+void writeCheckpoint(int step)
+{
+    int simRank;
+    MPI_Comm_rank(simComm, &simRank);
+    std::string partial = checkpointPath + ".tmp";
+    MPI_File file;
+    if (MPI_File_open(simComm, partial.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+    {
+        if (simRank == 0)
+        {
+            printf("Cannot write the checkpoint %s\n", partial.c_str());
+        }
+        return;
+    }
+    uavState &next = sendBuffer[1 - current];
+    MPI_Offset arrayBytes = (MPI_Offset)numUAVs * sizeof(double);
+    MPI_File_set_size(file, checkpointHeaderSize + (uavState::numComponents + 1) * arrayBytes);
+    if (simRank == 0)
+    {
+        char header[checkpointHeaderSize] = {0};
+        uint64_t values[3] = {(uint64_t)numUAVs, (uint64_t)step, showSeed};
+        memcpy(header, checkpointMagic, sizeof(checkpointMagic));
+        memcpy(header + 8, values, sizeof(values));
+        MPI_File_write_at(file, 0, header, (int)checkpointHeaderSize, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    for (int c = 0; c <= uavState::numComponents; c++)
+    {
+        alignedArray &array = (c < uavState::numComponents) ? next.component(c) : next.onSphere;
+        MPI_File_write_at_all(file, checkpointHeaderSize + c * arrayBytes + (MPI_Offset)myFirst * sizeof(double),
+            array.get(), myCount, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_sync(file);
+    MPI_File_close(&file);
+    if (simRank == 0 && rename(partial.c_str(), checkpointPath.c_str()) != 0)
+    {
+        printf("Cannot replace the checkpoint %s\n", checkpointPath.c_str());
+    }
+}
+
+/*
+ * All ranks: stops the run with a message from rank 0
+ * @param message printed with the checkpoint's name
+ */
+void refuseCheckpoint(const char *message)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0)
+    {
+        printf("%s %s. Terminating.\n", restartPath.c_str(), message);
+        fflush(stdout);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    // rank 0 aborts the run once it has said why
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/*
+ * All ranks: reads the UAVs, step and seed of the checkpoint to restart from, and
+ * stops the run if it is not a checkpoint or the show already ended there
+ */
+void readCheckpointHeader()
+{
+    MPI_File file;
+    char header[checkpointHeaderSize];
+    MPI_Offset size = 0;
+    bool valid = MPI_File_open(MPI_COMM_WORLD, restartPath.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file) == MPI_SUCCESS;
+    if (valid)
+    {
+        MPI_File_get_size(file, &size);
+        valid = size >= checkpointHeaderSize &&
+            MPI_File_read_at_all(file, 0, header, (int)checkpointHeaderSize, MPI_BYTE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+        MPI_File_close(&file);
+    }
+    uint64_t values[3] = {0, 0, 0};
+    if (valid)
+    {
+        memcpy(values, header + 8, sizeof(values));
+        valid = memcmp(header, checkpointMagic, sizeof(checkpointMagic)) == 0 && values[0] > 0 &&
+            values[1] <= (uint64_t)showSteps &&
+            size >= checkpointHeaderSize + (MPI_Offset)((uavState::numComponents + 1) * values[0] * sizeof(double));
+    }
+    if (!valid)
+    {
+        refuseCheckpoint("is not a checkpoint of this show");
+    }
+    if (values[1] == (uint64_t)showSteps)
+    {
+        refuseCheckpoint("holds the last step of the show, there is nothing left to fly");
+    }
+    numUAVs = (int)values[0];
+    firstStep = (int)values[1];
+    showSeed = values[2];
+}
+
+/*
+ * Workers: reads this rank's block of the checkpoint into sendBuffer[current], as
+ * if it were the step just computed, each array with one collective call
+ */
+void readCheckpointBlock()
+{
+    MPI_File file;
+    MPI_File_open(simComm, restartPath.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+    MPI_Offset arrayBytes = (MPI_Offset)numUAVs * sizeof(double);
+    for (int c = 0; c <= uavState::numComponents; c++)
+    {
+        alignedArray &array = (c < uavState::numComponents) ? sendBuffer[current].component(c) : sendBuffer[current].onSphere;
+        MPI_File_read_at_all(file, checkpointHeaderSize + c * arrayBytes + (MPI_Offset)myFirst * sizeof(double),
+            array.get(), myCount, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&file);
+}
+
 /*
  * Used by the glutReshapeFunc when  window is resized.
  * @param w: the new width of the screen
@@ -103,6 +515,11 @@ void changeSize(int w, int h)
  */
 void drawFootballField()
 {
+    if (renderer.isReady())
+    {
+        renderer.drawField();
+        return;
+    }
     glPushMatrix();
         glBindTexture(GL_TEXTURE_2D, texture[0]);
         glBegin(GL_QUADS);
@@ -122,14 +539,22 @@ void drawFootballField()
 
 /*
  * Draws UAVs accoding to specifications (yellow Dodecahedron)
+ * With the renderer one instanced draw call does all of them.
  */
 void drawUAVs()
 {
-    for (int i = 1; i < 16; i++)
+    const double *x = &frames[drawnFrame][1], *y = x + numUAVs, *z = y + numUAVs;
+    if (renderer.isReady())
+    {
+        glColor3ub(255, 255, 0);
+        renderer.drawUAVs(x, y, z, numUAVs);
+        return;
+    }
+    for (int i = 0; i < numUAVs; i++)
     {
         glPushMatrix();
         glColor3ub(255, 255, 0);
-        glTranslatef(float(rcvbuffer[i * 6]), float(rcvbuffer[i * 6 + 1]), float(rcvbuffer[i * 6 + 2]));
+        glTranslatef(float(x[i]), float(y[i]), float(z[i]));
         glScalef(0.5f / sqrt(3), 0.5f / sqrt(3), 0.5f / sqrt(3));
         glutSolidDodecahedron();
         glPopMatrix();
@@ -142,6 +567,11 @@ void drawUAVs()
 void drawVirtualSphere()
 {
     glColor3ub(0,0,255);
+    if (renderer.isReady())
+    {
+        renderer.drawSphere();
+        return;
+    }
     glPushMatrix();
     glTranslatef(0, 0, 50);
     glutWireSphere(10.0, 10, 8);
@@ -170,8 +600,6 @@ void renderScene()
     drawUAVs();
 
     glutSwapBuffers(); // Make it all visible
-    MPI_Barrier(MPI_COMM_WORLD);
-    MPI_Allgather(sendBuffer, numElements, MPI_DOUBLE, rcvbuffer, numElements, MPI_DOUBLE, MPI_COMM_WORLD);
 }
 
 /*
@@ -203,6 +631,11 @@ void init()
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
     glEnable(GL_TEXTURE_2D);
 
+    if (!renderer.init(texture[0]))
+    {
+        printf("OpenGL 3.3 not available, drawing in immediate mode\n");
+    }
+
 }
 
 //----------------------------------------------------------------------
@@ -211,6 +644,10 @@ void init()
 //----------------------------------------------------------------------
 void timerFunction(int id)
 {
+    if (receiveFrame(false) && showOver)
+    {
+        MPI_Finalize(); // the window stays open on the last frame
+    }
     glutPostRedisplay();
     glutTimerFunc(100, timerFunction, 0);
 }
@@ -247,115 +684,63 @@ void mainOpenGL(int argc, char**argv)
 }
 
 /*
- * Function to check if there is an elastic collision
- * Swaps velocities if detects one.
- *
- * @params rank: current process rank
+ * Function to check if there are elastic collisions
+ * Swaps the velocities of every colliding pair of UAVs, each pair once.
+ * Every rank resolves the same gathered state in the same order, so all of
+ * them agree on the velocities afterwards.
+ * This rank's UAVs in a pair take the swapped velocities and their vectors of the
+ * next step, computed before the gather arrived, are moved again.
  */
-void checkCollision(int rank)
+void checkCollisions()
 {
-    double dx, dy, dz, tmpX, tmpY, tmpZ;
-    for (int i = 1; i < 16; i++)
+    if (collisions.resolve(rcvbuffer) == 0)
+    {
+        return;
+    }
+    uavState &mine = sendBuffer[current], &next = sendBuffer[1 - current];
+    std::vector<int> changed;
+    for (const std::pair<int, int> &pair : collisions.lastPairs())
     {
-        if (i != rank)
+        for (int u : {pair.first, pair.second})
         {
-            dx = rcvbuffer[rank * 6] - rcvbuffer[i * 6];
-            dy = rcvbuffer[rank * 6 + 1] - rcvbuffer[i * 6 + 1];
-            dz = rcvbuffer[rank * 6 + 2] - rcvbuffer[i * 6 + 2];
-
-            if (sqrt(pow(dx, 2.0) + pow(dy, 2.0) + pow(dz, 2.0)) <= 0.01)
+            if (u < myFirst || u >= myFirst + myCount)
             {
-                tmpX = rcvbuffer[rank * 6 + 3];
-                tmpY = rcvbuffer[rank * 6 + 4];
-                tmpZ = rcvbuffer[rank * 6 + 5];
-                rcvbuffer[rank * 6 + 3] = rcvbuffer[i * 6 + 3];
-                rcvbuffer[rank * 6 + 4] = rcvbuffer[i * 6 + 4];
-                rcvbuffer[rank * 6 + 5] = rcvbuffer[i * 6 + 5];
-                rcvbuffer[i * 6 + 3] = tmpX;
-                rcvbuffer[i * 6 + 4] = tmpY;
-                rcvbuffer[i * 6 + 5] = tmpZ;
+                continue;
             }
+            int i = u - myFirst;
+            mine.vx[i] = rcvbuffer.vx[u];
+            mine.vy[i] = rcvbuffer.vy[u];
+            mine.vz[i] = rcvbuffer.vz[u];
+            changed.push_back(i - i % uavLanes::width);
         }
     }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (int first : changed)
+    {
+        moveUAVs<uavLanes>(mine, first, std::min((int)uavLanes::width, myCount - first), next, randoms);
+    }
 }
 
 /*
-* calculates the location and velocities of UAVs and stores to gather buffers for all processes
-* @param rank current process rank
+* calculates the location and velocities of this rank's UAVs into sendBuffer[1 - current].
+* The step is computed while the last gather is still in flight and corrected for
+* collisions once it has arrived.
+* @param step number of the step, 1 to showSteps; with the seed it picks the random numbers
 */
-void calculateUAVsLocation(int rank)
+void calculateUAVsLocation(int step)
 {
-    double myUAV[numElements], acc_x, acc_y, acc_z, fx, fy, fz;
-    checkCollision(rank);
-    memcpy(myUAV, rcvbuffer + rank * 6, sizeof(double) * numElements);
-    double distToCenter = sqrt(pow(myUAV[0], 2) + pow(myUAV[1], 2) + pow((myUAV[2] - 50.0), 2));
-    double velocity = sqrt(pow(myUAV[3], 2) + pow(myUAV[4], 2) + pow(myUAV[5], 2));
-    double dirX = -myUAV[0] / distToCenter;
-    double dirY = -myUAV[1] / distToCenter;
-    double dirZ = (50.0 - myUAV[2]) / distToCenter;
-    double effectiveR = (-20 * dirZ + sqrt(400 * pow(dirZ, 2.0) + 1200)) / 2.0; // from solving the physics
-    if (distToCenter > 10.1) 
-    {
-        if (velocity <= 1.8)
-        {
-            acc_x = effectiveR * dirX;
-            acc_y = effectiveR * dirY;
-            acc_z = effectiveR * dirZ;
-            sendBuffer[0] = myUAV[0] + (myUAV[3] * 0.1) + (acc_x * 0.1 * 0.1 * 0.5);
-            sendBuffer[1] = myUAV[1] + (myUAV[4] * 0.1) + (acc_y * 0.1 * 0.1 * 0.5);
-            sendBuffer[2] = myUAV[2] + (myUAV[5] * 0.1) + (acc_z * 0.1 * 0.1 * 0.5);
-            sendBuffer[3] = myUAV[3] + acc_x * 0.1;
-            sendBuffer[4] = myUAV[4] + acc_y * 0.1;
-            sendBuffer[5] = myUAV[5] + acc_z * 0.1;
-        } else 
-        {
-            sendBuffer[0] = myUAV[0] + (myUAV[3] * 0.1);
-            sendBuffer[1] = myUAV[1] + (myUAV[4] * 0.1);
-            sendBuffer[2] = myUAV[2] + (myUAV[5] * 0.1);
-            sendBuffer[3] = myUAV[3];
-            sendBuffer[4] = myUAV[4];
-            sendBuffer[5] = myUAV[5];
-        }
-    }
-    else if (onSphere[rank] == 0)
-    {
-        onSphere[rank] = 1;
-    }
-
-    if (onSphere[rank] == 1)
-    {
-        double fS = 2 * (distToCenter - 10);
-        fx = fS * dirX * UAVMASS;
-        fy = fS * dirY * UAVMASS;
-        fz = fS * dirZ * UAVMASS;
-
-        double randomX = (double)(rand() % 11);
-        double randomY = (double)(rand() % 11);
-        double randomZ = (double)(rand() % 3) - 1;
-        double cx = -dirY * randomZ - randomY * -dirZ;
-        double cy = -dirX * randomZ - randomX * -dirZ;
-        double cz = -dirX * randomY - (-dirY) * randomX;
-        double magnitude = sqrt(pow(cx, 2) + pow(cy, 2) + pow(cz, 2));
-        cx = cx / magnitude;
-        cy = cy / magnitude;
-        cz = cz / magnitude;
-        fx += 0.1 * cx;
-        fy += 0.1 * cy;
-        fz += 0.1 * cz;
-        magnitude = sqrt(pow(fx, 2) + pow(fy, 2) + pow(fz, 2)) / 20.0;
-        fx /= magnitude;
-        fy /= magnitude;
-        fz /= magnitude;
-        acc_z = fz / UAVMASS - 10.0;
-        acc_x = fx / UAVMASS;
-        acc_y = fy / UAVMASS;
-        sendBuffer[0] = myUAV[0] + (myUAV[3] * 0.1) + (acc_x * 0.1 * 0.1 * 0.5);
-        sendBuffer[1] = myUAV[1] + (myUAV[4] * 0.1) + (acc_y * 0.1 * 0.1 * 0.5);
-        sendBuffer[2] = myUAV[2] + (myUAV[5] * 0.1) + (acc_z * 0.1 * 0.1 * 0.5);
-        sendBuffer[3] = myUAV[3] + acc_x * 0.1;
-        sendBuffer[4] = myUAV[4] + acc_y * 0.1;
-        sendBuffer[5] = myUAV[5] + acc_z * 0.1;
+    uavState &mine = sendBuffer[current], &next = sendBuffer[1 - current];
+    memcpy(next.onSphere.get(), mine.onSphere.get(), sizeof(double) * myCount);
+    #pragma omp parallel for schedule(static)
+    for (int first = 0; first < myCount; first += uavChunk)
+    {
+        int count = std::min(uavChunk, myCount - first);
+        drawRandoms(randoms, first, count, showSeed, myFirst, step);
+        moveUAVs<uavLanes>(mine, first, count, next, randoms);
     }
+    finishGather();
+    checkCollisions();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -366,11 +751,10 @@ void calculateUAVsLocation(int rank)
 //////////////////////////////////////////////////////////////////////
 int main(int argc, char**argv)
 {
-    srand(time(NULL));
-
-    int numTasks, rank;
+    int numTasks, rank, provided;
 
-    int rc = MPI_Init(&argc, &argv);
+    // threads only compute, MPI is called from the master thread
+    int rc = MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
     if (rc != MPI_SUCCESS) 
     {
@@ -378,38 +762,165 @@ int main(int argc, char**argv)
         MPI_Abort(MPI_COMM_WORLD, rc);
     }
 
+#ifdef _OPENMP
+    if (provided < MPI_THREAD_FUNNELED)
+    {
+        omp_set_num_threads(1);
+    }
+#endif
+
     MPI_Comm_size(MPI_COMM_WORLD, &numTasks);
 
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-    int gsize = 0;
-
-    MPI_Comm_size(MPI_COMM_WORLD, &gsize);
+    bool seeded = false;
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "--headless") == 0)
+        {
+            headless = true;
+        }
+        else if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc)
+        {
+            showSeed = strtoull(argv[++a], NULL, 10);
+            seeded = true;
+        }
+        else if (strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc)
+        {
+            checkpointPath = argv[++a];
+        }
+        else if (strcmp(argv[a], "--checkpoint-every") == 0 && a + 1 < argc)
+        {
+            checkpointEvery = std::max(1, atoi(argv[++a]));
+        }
+        else if (strcmp(argv[a], "--restart") == 0 && a + 1 < argc)
+        {
+            restartPath = argv[++a];
+        }
+        else if (strcmp(argv[a], "--record") == 0 && a + 1 < argc)
+        {
+            recordPath = argv[++a];
+        }
+        else if (atoi(argv[a]) > 0)
+        {
+            numUAVs = atoi(argv[a]);
+        }
+    }
+    if (numTasks < 2)
+    {
+        printf("Needs at least 2 processes, one draws and the others fly the UAVs. Terminating.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
-    memcpy(rcvbuffer, currInfo, rcvSize * sizeof(double));
+    if (!restartPath.empty())
+    {
+        // the checkpoint's UAVs and seed, whatever the command line says
+        readCheckpointHeader();
+        if (rank == 0)
+        {
+            printf("Restarting %d UAVs from step %d of %s, seed %llu\n", numUAVs, firstStep, restartPath.c_str(),
+                (unsigned long long)showSeed);
+        }
+    }
+    else
+    {
+        if (!seeded)
+        {
+            showSeed = (uint64_t)time(NULL);
+        }
+        // rank 0's seed, the clocks may have ticked between the ranks
+        MPI_Bcast(&showSeed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+        {
+            printf("Seed %llu, replay with --seed %llu\n", (unsigned long long)showSeed, (unsigned long long)showSeed);
+        }
+    }
 
+    assignBlocks(numTasks, rank);
+    MPI_Comm_split(MPI_COMM_WORLD, rank == 0 ? MPI_UNDEFINED : 1, rank, &simComm);
+    rcvbuffer.resize(numUAVs);
+    initialFormation(rcvbuffer, numUAVs);
     
     if (rank == 0) 
     {
-        mainOpenGL(argc, argv);
+        packFrame(frames[drawnFrame], 0);
+        requestFrame();
+        if (!headless)
+        {
+            mainOpenGL(argc, argv);
+        }
+        int received = 0;
+        while (!showOver)
+        {
+            received += receiveFrame(true) ? 1 : 0;
+        }
+        printf("Rank 0: %d frames, the last one of step %.0f\n", received, frames[drawnFrame][0]);
     }
     else
     {
-        // Sleep for 5 seconds
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        for (int ii = 0; ii < 600 ; ii++)
+        packedBlock.resize(myCount * uavState::numComponents);
+        packedAll.resize(numUAVs * uavState::numComponents);
+        sendBuffer[0].resize(myCount);
+        sendBuffer[1].resize(myCount);
+        randoms.resize(myCount);
+        if (rank == 1)
+        {
+            MPI_Irecv(&frameToken, 1, MPI_INT, 0, frameRequestTag, MPI_COMM_WORLD, &frameAsked);
+            if (!recordPath.empty() && !trajectory.open(recordPath.c_str(), numUAVs, trajectoryChunk))
+            {
+                printf("Cannot write the trajectory log %s\n", recordPath.c_str());
+            }
+        }
+        if (!headless)
+        {
+            // Sleep for 5 seconds, the window opens
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+        }
+        if (restartPath.empty())
         {
-            if (ii == 0)
+            for (int c = 0; c < uavState::numComponents; c++)
             {
-                memcpy(sendBuffer, currInfo + rank * numElements, sizeof(double) * numElements);
+                memcpy(sendBuffer[current].component(c).get(), rcvbuffer.component(c).get() + myFirst, sizeof(double) * myCount);
             }
-            else
+        }
+        else
+        {
+            // as after the checkpoint's step: every block gathered while the next step starts
+            readCheckpointBlock();
+            startGather();
+        }
+        double start = MPI_Wtime();
+        for (int ii = firstStep + 1; ii <= showSteps; ii++)
+        {
+            calculateUAVsLocation(ii);
+            if (rank == 1)
+            {
+                trajectory.add(ii - 1, rcvbuffer.x.get(), rcvbuffer.y.get(), rcvbuffer.z.get());
+                serveFrame(ii - 1, false);
+            }
+            if (!checkpointPath.empty() && ii % checkpointEvery == 0)
             {
-                calculateUAVsLocation(rank);
-                MPI_Barrier(MPI_COMM_WORLD);
-                MPI_Allgather(sendBuffer, numElements, MPI_DOUBLE, rcvbuffer, numElements, MPI_DOUBLE, MPI_COMM_WORLD);  
+                writeCheckpoint(ii);
             }
+            current = 1 - current;
+            startGather();
+        }
+        finishGather();
+        double seconds = MPI_Wtime() - start;
+        if (rank == 1)
+        {
+            int threads = 1;
+#ifdef _OPENMP
+            threads = omp_get_max_threads();
+#endif
+            int steps = showSteps - firstStep;
+            printf("%d steps of %d UAVs on %d ranks x %d threads in %.3f s, %.1f steps/s\n", steps, numUAVs, numTasks,
+                threads, seconds, steps / seconds);
+            trajectory.add(showSteps, rcvbuffer.x.get(), rcvbuffer.y.get(), rcvbuffer.z.get());
+            trajectory.close();
+            serveFrame(showSteps, true);
         }
+        MPI_Comm_free(&simComm);
     }
     MPI_Finalize();
     return 0;
@@ -0,0 +1,246 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Replays a drone show from the trajectory log FinalProject writes
+with --record (UAV_Trajectory.h), without MPI and without flying it again. The
+log is mapped into memory, so a long show opens at once and only the chunk of
+the step shown is decoded.
+
+Keys: space plays and pauses, the left and right arrows step back and forth,
+page up and page down jump 50 steps, home and end go to the first and last step.
+With --print STEP it prints every UAV's position at that step instead, one UAV
+per line, and opens no window.
+
+Compiled with:
+    g++ -O2 TrajectoryViewer.cpp -lGLU -lglut -lGL -std=c++11 -o TrajectoryViewer
+Run with:
+    ./TrajectoryViewer FILE [--print STEP]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __APPLE__
+       #define GL_SILENCE_DEPRECATION
+       #include <GLUT/glut.h>
+       #include <OpenGL/gl.h>
+
+       #include <OpenGl/glu.h>
+#else
+       #define GL_GLEXT_PROTOTYPES
+       #include <GL/glut.h>
+#endif
+#include <algorithm>
+#include <vector>
+#include "ECE_Bitmap.h"
+#include "UAV_Render.h"
+#include "UAV_Trajectory.h"
+
+// the log and the positions of the step shown: every x, then every y, then every z
+trajectoryReader trajectory;
+std::vector<double> positions;
+int step = 0;
+bool playing = true;
+
+GLuint texture[1];
+BMP field;
+showRenderer renderer;
+
+/*
+ * Decodes a step and shows it from now on
+ * @param s the step, clamped to the log
+ */
+void showStep(int s)
+{
+    s = std::max(trajectory.firstStep(), std::min(trajectory.lastStep(), s));
+    if (!trajectory.positions(s, positions))
+    {
+        printf("Step %d of the log is corrupt\n", s);
+        playing = false;
+        return;
+    }
+    step = s;
+    char title[64];
+    snprintf(title, sizeof(title), "Drone Show, step %d of %d", step, trajectory.lastStep());
+    glutSetWindowTitle(title);
+    glutPostRedisplay();
+}
+
+/*
+ * Used by the glutReshapeFunc when  window is resized.
+ * @param w: the new width of the screen
+ * @param h: the new height of the screen
+ */
+void changeSize(int w, int h)
+{
+    float ratio = ((float)w) / ((float)h);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0, ratio, 0.1, 1000.0);
+    glMatrixMode(GL_MODELVIEW);
+    glViewport(0, 0, w, h);
+}
+
+/*
+ * Draws the field, the sphere and the UAVs of the step shown, as the show does
+ */
+void renderScene()
+{
+    glClearColor(0.5, 0.8, 0.9, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glLoadIdentity();
+    gluLookAt(0.0, 80.0, 120.0, 0.0, 0.0, 25.0, 0.0, 0.0, 1.0);
+    int count = trajectory.uavs();
+    const double *x = positions.data(), *y = x + count, *z = y + count;
+    if (renderer.isReady())
+    {
+        renderer.drawField();
+        glColor3ub(0, 0, 255);
+        renderer.drawSphere();
+        glColor3ub(255, 255, 0);
+        renderer.drawUAVs(x, y, z, count);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, texture[0]);
+        glBegin(GL_QUADS);
+            glTexCoord2f(0, 0);
+            glVertex3f(-57.25, -27.5, 0.0);
+            glTexCoord2f(1, 0);
+            glVertex3f(57.25, -27.5, 0.0);
+            glTexCoord2f(1, 1);
+            glVertex3f(57.25, 27.5, 0.0);
+            glTexCoord2f(0, 1);
+            glVertex3f(-57.25, 27.5, 0.0);
+        glEnd();
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glColor3ub(0, 0, 255);
+        glPushMatrix();
+        glTranslatef(0, 0, 50);
+        glutWireSphere(10.0, 10, 8);
+        glPopMatrix();
+        glColor3ub(255, 255, 0);
+        for (int i = 0; i < count; i++)
+        {
+            glPushMatrix();
+            glTranslatef(float(x[i]), float(y[i]), float(z[i]));
+            glScalef(0.5f / sqrt(3), 0.5f / sqrt(3), 0.5f / sqrt(3));
+            glutSolidDodecahedron();
+            glPopMatrix();
+        }
+    }
+    glutSwapBuffers();
+}
+
+/*
+ * Space plays and pauses
+ * @param key the key pressed
+ */
+void pressKey(unsigned char key, int, int)
+{
+    if (key == ' ')
+    {
+        playing = !playing;
+    }
+}
+
+/*
+ * The arrows, page up and down, home and end scrub through the show and pause it
+ * @param key the key pressed
+ */
+void pressSpecialKey(int key, int, int)
+{
+    int jumps[][2] = {{GLUT_KEY_LEFT, -1}, {GLUT_KEY_RIGHT, 1}, {GLUT_KEY_PAGE_UP, -50}, {GLUT_KEY_PAGE_DOWN, 50}};
+    for (const int *jump : jumps)
+    {
+        if (key == jump[0])
+        {
+            playing = false;
+            showStep(step + jump[1]);
+        }
+    }
+    if (key == GLUT_KEY_HOME || key == GLUT_KEY_END)
+    {
+        playing = false;
+        showStep(key == GLUT_KEY_HOME ? trajectory.firstStep() : trajectory.lastStep());
+    }
+}
+
+//----------------------------------------------------------------------
+// timerFunction  - one step every 100 ms while playing, as the show runs
+//----------------------------------------------------------------------
+void timerFunction(int)
+{
+    if (playing && step < trajectory.lastStep())
+    {
+        showStep(step + 1);
+    }
+    glutTimerFunc(100, timerFunction, 0);
+}
+
+/*
+ * Loads the field's texture and the renderer
+ */
+void init()
+{
+    glEnable(GL_DEPTH_TEST);
+    glShadeModel(GL_SMOOTH);
+    glEnable(GL_COLOR_MATERIAL);
+    glEnable(GL_NORMALIZE);
+    field.read("ff.bmp");
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D, texture[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, 3, field.bmp_info_header.width, field.bmp_info_header.height, 0,
+        GL_BGR_EXT, GL_UNSIGNED_BYTE, &field.data[0]);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
+    glEnable(GL_TEXTURE_2D);
+    if (!renderer.init(texture[0]))
+    {
+        printf("OpenGL 3.3 not available, drawing in immediate mode\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || !trajectory.open(argv[1]))
+    {
+        fprintf(stderr, "usage %s FILE [--print STEP], FILE a trajectory log of FinalProject --record\n", argv[0]);
+        exit(1);
+    }
+    if (argc > 3 && strcmp(argv[2], "--print") == 0)
+    {
+        int s = atoi(argv[3]);
+        if (!trajectory.positions(s, positions))
+        {
+            fprintf(stderr, "Step %d is not in the log, which has steps %d to %d\n", s, trajectory.firstStep(),
+                trajectory.lastStep());
+            exit(1);
+        }
+        int count = trajectory.uavs();
+        for (int i = 0; i < count; i++)
+        {
+            printf("%d %.3f %.3f %.3f\n", i, positions[i], positions[count + i], positions[2 * (size_t)count + i]);
+        }
+        return 0;
+    }
+
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
+    glutInitWindowPosition(100, 100);
+    glutInitWindowSize(400, 400);
+    glutCreateWindow("Drone Show");
+    init();
+    step = trajectory.firstStep();
+    showStep(step);
+    glutReshapeFunc(changeSize);
+    glutDisplayFunc(renderScene);
+    glutKeyboardFunc(pressKey);
+    glutSpecialFunc(pressSpecialKey);
+    glutTimerFunc(100, timerFunction, 0);
+    glutMainLoop();
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Collision detection for the drone show. Testing every pair of UAVs
+is O(N^2); here a uniform grid finds the candidates instead. Space is cut into
+cubes as wide as the collision distance, so two UAVs can only collide if their
+cubes touch. The occupied cubes are hashed into about 2N buckets and the UAVs are
+counting sorted by bucket, then every UAV tests, with squared distances, the UAVs
+in its own cube and in the 13 neighbouring cubes "ahead" of it; the other 13 test
+it from their side, so each pair is seen exactly once. O(N) per step.
+
+Pairs are reported lower index first and the velocities are swapped in
+(lower, higher) index order, so every rank resolving the same state gets the same
+result.
+
+Built with -fopenmp, the cubes are computed and the pairs searched by all of the
+rank's threads over the one shared state; each thread collects its own pairs and
+the sort puts them in the same order whatever the number of threads.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+#include "UAV_State.h"
+
+// UAVs closer than this collide (meters)
+const double collisionDistance = 0.01;
+
+class collisionGrid
+{
+public:
+    /*
+    Swaps the velocities of every pair of colliding UAVs
+    @param state every UAV
+    @return number of pairs swapped
+    */
+    int resolve(uavState &state)
+    {
+        findPairs(state);
+        for (const std::pair<int, int> &pair : pairs)
+        {
+            std::swap(state.vx[pair.first], state.vx[pair.second]);
+            std::swap(state.vy[pair.first], state.vy[pair.second]);
+            std::swap(state.vz[pair.first], state.vz[pair.second]);
+        }
+        return (int)pairs.size();
+    }
+
+    /*
+    Finds every pair of UAVs within collisionDistance
+    @param state every UAV
+    @return the pairs, lower index first, sorted; valid until the next call
+    */
+    const std::vector<std::pair<int, int> > &findPairs(const uavState &state)
+    {
+        int count = (int)state.size();
+        const double *x = state.x.get(), *y = state.y.get(), *z = state.z.get();
+        size_t buckets = 1;
+        while (buckets < 2 * (size_t)count)
+            buckets <<= 1;
+        size_t mask = buckets - 1;
+        cells.resize(count);
+        order.resize(count);
+        bucketStart.assign(buckets + 1, 0);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < count; i++)
+            cells[i] = cellOf(x[i], y[i], z[i]);
+        for (int i = 0; i < count; i++)
+            bucketStart[(hash(cells[i]) & mask) + 1]++;
+        for (size_t b = 0; b < buckets; b++)
+            bucketStart[b + 1] += bucketStart[b];
+        fill.assign(bucketStart.begin(), bucketStart.end() - 1);
+        for (int i = 0; i < count; i++)
+            order[fill[hash(cells[i]) & mask]++] = i;
+
+        // the own cube first, then the 13 neighbours after it in (x, y, z) order
+        static const int forward[14][3] = {
+            {0, 0, 0}, {0, 0, 1}, {0, 1, -1}, {0, 1, 0}, {0, 1, 1}, {1, -1, -1}, {1, -1, 0},
+            {1, -1, 1}, {1, 0, -1}, {1, 0, 0}, {1, 0, 1}, {1, 1, -1}, {1, 1, 0}, {1, 1, 1}};
+        const double limit = collisionDistance * collisionDistance;
+        found.resize(threadCount());
+        #pragma omp parallel num_threads((int)found.size())
+        {
+            std::vector<std::pair<int, int> > &mine = found[threadIndex()];
+            mine.clear();
+            #pragma omp for schedule(static)
+            for (int i = 0; i < count; i++)
+            {
+                for (int n = 0; n < 14; n++)
+                {
+                    cube target = {cells[i].x + forward[n][0], cells[i].y + forward[n][1], cells[i].z + forward[n][2]};
+                    size_t b = hash(target) & mask;
+                    for (int k = bucketStart[b]; k < bucketStart[b + 1]; k++)
+                    {
+                        int j = order[k];
+                        // other cubes may share the bucket; in its own cube a pair is seen from both UAVs
+                        if (!(cells[j] == target) || (n == 0 && j <= i))
+                            continue;
+                        double dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+                        if (dx * dx + dy * dy + dz * dz <= limit)
+                            mine.push_back(std::make_pair(std::min(i, j), std::max(i, j)));
+                    }
+                }
+            }
+        }
+        pairs.clear();
+        for (const std::vector<std::pair<int, int> > &some : found)
+            pairs.insert(pairs.end(), some.begin(), some.end());
+        std::sort(pairs.begin(), pairs.end());
+        return pairs;
+    }
+
+    // the pairs found by the last resolve() or findPairs()
+    const std::vector<std::pair<int, int> > &lastPairs() const { return pairs; }
+
+private:
+    static const int32_t cellLimit = 1 << 30;
+
+    struct cube
+    {
+        int32_t x, y, z;
+        bool operator==(const cube &other) const { return x == other.x && y == other.y && z == other.z; }
+    };
+
+    std::vector<cube> cells;        // cube of every UAV
+    std::vector<int> bucketStart;   // UAVs of bucket b are order[bucketStart[b] .. bucketStart[b + 1])
+    std::vector<int> fill;
+    std::vector<int> order;         // UAV indices sorted by bucket
+    std::vector<std::pair<int, int> > pairs;
+    std::vector<std::vector<std::pair<int, int> > > found; // pairs found by each thread
+
+    // threads a parallel region gets, 1 without OpenMP
+    static int threadCount()
+    {
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    static int threadIndex()
+    {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+    // cube of one coordinate; far away UAVs are clamped, which only adds candidates
+    static int32_t cell(double value)
+    {
+        double c = floor(value / collisionDistance);
+        if (!(c >= 2 - cellLimit)) // also catches NaN
+            c = 2 - cellLimit;
+        if (c > cellLimit - 2)
+            c = cellLimit - 2;
+        return (int32_t)c;
+    }
+
+    static cube cellOf(double x, double y, double z)
+    {
+        cube c = {cell(x), cell(y), cell(z)};
+        return c;
+    }
+
+    static size_t hash(const cube &c)
+    {
+        return ((uint32_t)c.x * 73856093u) ^ ((uint32_t)c.y * 19349663u) ^ ((uint32_t)c.z * 83492791u);
+    }
+};
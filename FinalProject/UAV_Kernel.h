@@ -0,0 +1,212 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Time step of the drone show's UAVs over a structure-of-arrays block
+(UAV_State.h). The flight towards the virtual sphere, the orbit on it and the thrust
+limit are written without branches: every case is computed for all lanes and the
+right one is selected per UAV, so one instruction moves 8 (AVX-512), 4 (AVX2) or
+1 (scalar fallback) UAVs. The widest set the compiler was told about (-mavx512f,
+-mavx2) is used; the scalar fallback runs the same code on plain doubles.
+
+The lanes use only +, -, *, / and sqrt, which IEEE 754 rounds the same way on every
+path, so a UAV gets the same result whichever lane or path moves it, as long as the
+compiler does not fuse a multiply and an add: -mavx512f brings FMA instructions, so
+build with -ffp-contract=off there (and with -mfma or -march=native).
+Divisions and square roots are the slow part, so each UAV does 3 divisions and
+multiplies by the reciprocals.
+
+For one UAV, as before:
+    d        distance to the sphere's center, dir the unit vector towards it
+    flying   not on the sphere yet: accelerate along dir while slower than 1.8 m/s
+    on it    once d <= 10.1 m, for good: a spring pulls it to the 10 m radius, a
+             random sideways push keeps it moving, the total thrust is set to MAXF
+             and gravity is added
+    position += v dt + a dt^2 / 2, velocity += a dt
+*/
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+#include "UAV_State.h"
+
+#define UAVMASS 1.0
+#define MAXF 20.0
+
+// plain doubles, for builds without AVX2 and the UAVs' reference results
+struct scalarLanes
+{
+    typedef double V;
+    typedef bool M;
+    static const int width = 1;
+    static const char *name() { return "scalar"; }
+
+    static V load(const double *p) { return *p; }
+    static void store(double *p, V v) { *p = v; }
+    static V set(double d) { return d; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V root(V a) { return sqrt(a); }
+    static M lessEqual(V a, V b) { return a <= b; }
+    static M greater(V a, V b) { return a > b; }
+    static M either(M a, M b) { return a || b; }
+    static V select(M m, V a, V b) { return m ? a : b; }
+};
+
+#ifdef __AVX2__
+struct avx2Lanes
+{
+    typedef __m256d V;
+    typedef __m256d M;
+    static const int width = 4;
+    static const char *name() { return "AVX2"; }
+
+    static V load(const double *p) { return _mm256_loadu_pd(p); }
+    static void store(double *p, V v) { _mm256_storeu_pd(p, v); }
+    static V set(double d) { return _mm256_set1_pd(d); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm256_div_pd(a, b); }
+    static V root(V a) { return _mm256_sqrt_pd(a); }
+    static M lessEqual(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    static M greater(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static M either(M a, M b) { return _mm256_or_pd(a, b); }
+    static V select(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+};
+#endif
+
+#ifdef __AVX512F__
+struct avx512Lanes
+{
+    typedef __m512d V;
+    typedef __mmask8 M;
+    static const int width = 8;
+    static const char *name() { return "AVX-512"; }
+
+    static V load(const double *p) { return _mm512_loadu_pd(p); }
+    static void store(double *p, V v) { _mm512_storeu_pd(p, v); }
+    static V set(double d) { return _mm512_set1_pd(d); }
+    static V add(V a, V b) { return _mm512_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm512_div_pd(a, b); }
+    static V root(V a) { return _mm512_sqrt_pd(a); }
+    static M lessEqual(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+    static M greater(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    static M either(M a, M b) { return (M)(a | b); }
+    static V select(M m, V a, V b) { return _mm512_mask_blend_pd(m, b, a); }
+};
+#endif
+
+// the widest lanes this build has
+#if defined(__AVX512F__)
+typedef avx512Lanes uavLanes;
+#elif defined(__AVX2__)
+typedef avx2Lanes uavLanes;
+#else
+typedef scalarLanes uavLanes;
+#endif
+
+// random numbers the orbit push uses, one of each per UAV of a block
+struct uavRandoms
+{
+    alignedArray x;   // 0 to 10
+    alignedArray y;   // 0 to 10
+    alignedArray z;   // -1 to 1
+
+    void resize(size_t n)
+    {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+};
+
+/*
+Moves UAVs first to first + count - 1 of a block one time step. A UAV's result
+depends on its own inputs only and its flag is only ever set, so UAVs may be moved
+again from corrected inputs and the rest of their vector comes out the same.
+@param block the UAVs, after collisions; read up to the padding past the UAVs
+@param first index of the first UAV to move
+@param count number of UAVs to move
+@param next the block's next state; its onSphere flags are read and updated
+@param random the block's random numbers for this step
+*/
+template <typename L>
+void moveUAVs(const uavState &block, size_t first, size_t count, uavState &next, const uavRandoms &random)
+{
+    typedef typename L::V V;
+    typedef typename L::M M;
+    const V zero = L::set(0.0), one = L::set(1.0), half = L::set(0.5), dt = L::set(0.1);
+    const V centerZ = L::set(50.0), radius = L::set(10.0), reach = L::set(10.1), cruise = L::set(1.8);
+    const V two = L::set(2.0), minusTwenty = L::set(-20.0), fourHundred = L::set(400.0), c1200 = L::set(1200.0);
+    const V push = L::set(0.1), thrust = L::set(MAXF), mass = L::set(UAVMASS), gravity = L::set(10.0);
+    const V dtSquaredHalf = L::set(0.1 * 0.1 * 0.5);
+
+    for (size_t i = first; i < first + count; i += L::width)
+    {
+        V x = L::load(block.x.get() + i), y = L::load(block.y.get() + i), z = L::load(block.z.get() + i);
+        V vx = L::load(block.vx.get() + i), vy = L::load(block.vy.get() + i), vz = L::load(block.vz.get() + i);
+
+        V ez = L::sub(z, centerZ);
+        V distToCenter = L::root(L::add(L::add(L::mul(x, x), L::mul(y, y)), L::mul(ez, ez)));
+        V velocity = L::root(L::add(L::add(L::mul(vx, vx), L::mul(vy, vy)), L::mul(vz, vz)));
+        V toCenter = L::div(one, distToCenter);
+        V dirX = L::mul(L::sub(zero, x), toCenter);
+        V dirY = L::mul(L::sub(zero, y), toCenter);
+        V dirZ = L::mul(L::sub(centerZ, z), toCenter);
+
+        // on the sphere once it came within reach, for good
+        M onSphere = L::either(L::greater(L::load(next.onSphere.get() + i), zero), L::lessEqual(distToCenter, reach));
+
+        // flying: accelerate towards the center while slow, else coast
+        V effectiveR = L::mul(L::add(L::mul(minusTwenty, dirZ),
+                                     L::root(L::add(L::mul(fourHundred, L::mul(dirZ, dirZ)), c1200))), half);
+        M slow = L::lessEqual(velocity, cruise);
+        V flyX = L::select(slow, L::mul(effectiveR, dirX), zero);
+        V flyY = L::select(slow, L::mul(effectiveR, dirY), zero);
+        V flyZ = L::select(slow, L::mul(effectiveR, dirZ), zero);
+
+        // on the sphere: spring to the radius plus a random push across the radius
+        V fS = L::mul(two, L::sub(distToCenter, radius));
+        V fx = L::mul(L::mul(fS, dirX), mass);
+        V fy = L::mul(L::mul(fS, dirY), mass);
+        V fz = L::mul(L::mul(fS, dirZ), mass);
+        V randomX = L::load(random.x.get() + i), randomY = L::load(random.y.get() + i);
+        V randomZ = L::load(random.z.get() + i);
+        V cx = L::sub(L::mul(L::sub(zero, dirY), randomZ), L::mul(randomY, L::sub(zero, dirZ)));
+        V cy = L::sub(L::mul(L::sub(zero, dirX), randomZ), L::mul(randomX, L::sub(zero, dirZ)));
+        V cz = L::sub(L::mul(L::sub(zero, dirX), randomY), L::mul(L::sub(zero, dirY), randomX));
+        V magnitude = L::root(L::add(L::add(L::mul(cx, cx), L::mul(cy, cy)), L::mul(cz, cz)));
+        // a random vector along the radius gives no push
+        V pushScale = L::select(L::greater(magnitude, zero), L::div(push, magnitude), zero);
+        fx = L::add(fx, L::mul(pushScale, cx));
+        fy = L::add(fy, L::mul(pushScale, cy));
+        fz = L::add(fz, L::mul(pushScale, cz));
+        // the motors always give exactly MAXF
+        magnitude = L::mul(L::root(L::add(L::add(L::mul(fx, fx), L::mul(fy, fy)), L::mul(fz, fz))), mass);
+        V thrustScale = L::select(L::greater(magnitude, zero), L::div(thrust, magnitude), zero);
+        V orbitX = L::mul(fx, thrustScale);
+        V orbitY = L::mul(fy, thrustScale);
+        V orbitZ = L::sub(L::mul(fz, thrustScale), gravity);
+
+        V accX = L::select(onSphere, orbitX, flyX);
+        V accY = L::select(onSphere, orbitY, flyY);
+        V accZ = L::select(onSphere, orbitZ, flyZ);
+        L::store(next.x.get() + i, L::add(L::add(x, L::mul(vx, dt)), L::mul(accX, dtSquaredHalf)));
+        L::store(next.y.get() + i, L::add(L::add(y, L::mul(vy, dt)), L::mul(accY, dtSquaredHalf)));
+        L::store(next.z.get() + i, L::add(L::add(z, L::mul(vz, dt)), L::mul(accZ, dtSquaredHalf)));
+        L::store(next.vx.get() + i, L::add(vx, L::mul(accX, dt)));
+        L::store(next.vy.get() + i, L::add(vy, L::mul(accY, dt)));
+        L::store(next.vz.get() + i, L::add(vz, L::mul(accZ, dt)));
+        L::store(next.onSphere.get() + i, L::select(onSphere, one, zero));
+    }
+}
@@ -0,0 +1,68 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Random numbers for the UAVs' orbit push from a counter-based
+generator, Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+1, 2, 3", SC 2011). The numbers a UAV gets in a step are a pure function of
+(seed, UAV index, step): the counter is the UAV index and the step, the key is
+the seed, and 10 rounds of multiplies and xors scramble them. There is no state
+to share or lock, so any rank or thread can draw any UAV's numbers and a show
+replays bit for bit from its seed however it is split over ranks and threads.
+The UAVs are independent, so the fill loop is vectorized: by -O3, or at -O2 by
+its omp simd pragma with -fopenmp (or -fopenmp-simd).
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "UAV_Kernel.h"
+
+/*
+Philox4x32-10, in place; the rounds are unrolled so a loop calling it vectorizes
+@param c0, c1, c2, c3 the counter in, the random words out
+@param key0, key1 the key
+*/
+inline void philox4x32(uint32_t &c0, uint32_t &c1, uint32_t &c2, uint32_t &c3, uint32_t key0, uint32_t key1)
+{
+#ifndef __clang__
+    #pragma GCC unroll 10
+#endif
+    for (int round = 0; round < 10; round++)
+    {
+        uint64_t p0 = (uint64_t)0xD2511F53u * c0, p1 = (uint64_t)0xCD9E8D57u * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ key0, n2 = (uint32_t)(p0 >> 32) ^ c3 ^ key1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+}
+
+/*
+Draws the random numbers of UAVs first to first + count - 1 of a block
+@param random the block's numbers, filled like rand() % 11, rand() % 11, rand() % 3 - 1
+@param first index in the block of the first UAV to draw for
+@param count number of UAVs
+@param seed the show's seed
+@param blockFirst index in the whole show of the block's first UAV
+@param step the step the numbers are for
+*/
+inline void drawRandoms(uavRandoms &random, size_t first, size_t count, uint64_t seed, size_t blockFirst, uint32_t step)
+{
+    double *rx = random.x.get(), *ry = random.y.get(), *rz = random.z.get();
+    #pragma omp simd
+    for (size_t i = first; i < first + count; i++)
+    {
+        uint64_t uav = blockFirst + i;
+        uint32_t c0 = (uint32_t)uav, c1 = (uint32_t)(uav >> 32), c2 = step, c3 = 0;
+        philox4x32(c0, c1, c2, c3, (uint32_t)seed, (uint32_t)(seed >> 32));
+        // a 32-bit number times n, over 2^32, is evenly spread over 0 to n - 1
+        rx[i] = (double)(int32_t)(((uint64_t)c0 * 11) >> 32);
+        ry[i] = (double)(int32_t)(((uint64_t)c1 * 11) >> 32);
+        rz[i] = (double)((int32_t)(((uint64_t)c2 * 3) >> 32) - 1);
+    }
+}
@@ -0,0 +1,318 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Retained-mode drawing of the drone show. Everything that does not
+move is put into buffers on the GPU once: the textured field, the wire sphere
+and one UAV's dodecahedron. Each frame only the UAVs' positions are streamed
+into an instance buffer, and one instanced draw call puts a dodecahedron at
+every position, instead of a push, translate, scale, draw and pop per UAV.
+
+The UAVs are drawn with a GLSL 1.20 shader that adds the instance's position
+to the mesh and keeps the fixed-function matrices and colour, so the camera
+code is unchanged. It needs OpenGL 3.3 (instanced arrays), which Mesa's
+software rasterizer llvmpipe has; without it init() returns false and the
+caller keeps drawing in immediate mode.
+*/
+
+#pragma once
+
+#ifndef __APPLE__
+    #ifndef GL_GLEXT_PROTOTYPES
+        #define GL_GLEXT_PROTOTYPES
+    #endif
+    #include <GL/gl.h>
+    #include <GL/glext.h>
+#endif
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+class showRenderer
+{
+public:
+    /*
+    Uploads the static geometry and builds the shader; needs a current context
+    @param fieldTexture texture of the football field
+    @return false if this context cannot draw instanced, nothing is drawn then
+    */
+    bool init(GLuint fieldTexture)
+    {
+#ifdef __APPLE__
+        (void)fieldTexture;
+        return false;
+#else
+        int major = 0, minor = 0;
+        const char *version = (const char *)glGetString(GL_VERSION);
+        if (version == NULL || sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 33)
+        {
+            return false;
+        }
+        program = buildProgram();
+        if (program == 0)
+        {
+            return false;
+        }
+        offsetAttribute = glGetAttribLocation(program, "offset");
+        texture = fieldTexture;
+
+        std::vector<float> mesh = dodecahedron(0.5f);
+        meshVertices = (GLsizei)(mesh.size() / 3);
+        glGenBuffers(1, &meshBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mesh.size() * sizeof(float), mesh.data(), GL_STATIC_DRAW);
+
+        // x, y, z, s, t of the field's corners
+        const float field[] = {
+            -57.25f, -27.5f, 0.0f, 0.0f, 0.0f,   57.25f, -27.5f, 0.0f, 1.0f, 0.0f,
+             57.25f,  27.5f, 0.0f, 1.0f, 1.0f,  -57.25f,  27.5f, 0.0f, 0.0f, 1.0f};
+        glGenBuffers(1, &fieldBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, fieldBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(field), field, GL_STATIC_DRAW);
+
+        std::vector<float> sphere = wireSphere(10.0f, 10, 8);
+        sphereVertices = (GLsizei)(sphere.size() / 3);
+        glGenBuffers(1, &sphereBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, sphereBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sphere.size() * sizeof(float), sphere.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &instanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        ready = glGetError() == GL_NO_ERROR;
+        return ready;
+#endif
+    }
+
+    bool isReady() const { return ready; }
+
+#ifndef __APPLE__
+    // the football field in the XY plane, centered on the origin
+    void drawField()
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glBindBuffer(GL_ARRAY_BUFFER, fieldBuffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 5 * sizeof(float), (const void *)0);
+        glTexCoordPointer(2, GL_FLOAT, 5 * sizeof(float), (const void *)(3 * sizeof(float)));
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // the virtual sphere, in the current colour
+    void drawSphere()
+    {
+        glPushMatrix();
+        glTranslatef(0, 0, 50);
+        glBindBuffer(GL_ARRAY_BUFFER, sphereBuffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, (const void *)0);
+        glDrawArrays(GL_LINES, 0, sphereVertices);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glPopMatrix();
+    }
+
+    /*
+    Draws a dodecahedron at every UAV, in the current colour
+    @param x, y, z the UAVs' positions
+    @param count number of UAVs
+    */
+    void drawUAVs(const double *x, const double *y, const double *z, int count)
+    {
+        instances.resize(3 * (size_t)count);
+        for (int i = 0; i < count; i++)
+        {
+            instances[3 * i] = (float)x[i];
+            instances[3 * i + 1] = (float)y[i];
+            instances[3 * i + 2] = (float)z[i];
+        }
+        glUseProgram(program);
+        // a new store every frame, the driver need not wait for the last frame's draw
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(float), instances.data(), GL_STREAM_DRAW);
+        glEnableVertexAttribArray(offsetAttribute);
+        glVertexAttribPointer(offsetAttribute, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+        glVertexAttribDivisor(offsetAttribute, 1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, (const void *)0);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, meshVertices, count);
+
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glVertexAttribDivisor(offsetAttribute, 0);
+        glDisableVertexAttribArray(offsetAttribute);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glUseProgram(0);
+    }
+#else
+    // never ready here, the immediate mode draws instead
+    void drawField() {}
+    void drawSphere() {}
+    void drawUAVs(const double *, const double *, const double *, int) {}
+#endif
+
+    /*
+    Triangles of the dodecahedron glutSolidDodecahedron draws, scaled
+    @param radius distance of the corners from the center (glut's is sqrt(3))
+    @return x, y, z of 3 corners per triangle, 3 triangles per face
+    */
+    static std::vector<float> dodecahedron(float radius)
+    {
+        const double phi = (1.0 + sqrt(5.0)) / 2.0, inv = 1.0 / phi;
+        // glut's corners: (+-1, +-1, +-1) and the cyclic shifts of (0, +-phi, +-1 / phi)
+        std::vector<double> corners;
+        for (int sx = -1; sx <= 1; sx += 2)
+            for (int sy = -1; sy <= 1; sy += 2)
+                for (int sz = -1; sz <= 1; sz += 2)
+                    corners.insert(corners.end(), {(double)sx, (double)sy, (double)sz});
+        for (int sa = -1; sa <= 1; sa += 2)
+            for (int sb = -1; sb <= 1; sb += 2)
+            {
+                corners.insert(corners.end(), {0.0, sa * phi, sb * inv});
+                corners.insert(corners.end(), {sb * inv, 0.0, sa * phi});
+                corners.insert(corners.end(), {sa * phi, sb * inv, 0.0});
+            }
+        double scale = radius / sqrt(3.0);
+
+        // a face is the 5 corners furthest along its normal; the normals are among
+        // the cyclic shifts of (0, +-1, +-phi) and (0, +-phi, +-1)
+        std::vector<float> triangles;
+        for (int family = 0; family < 2; family++)
+            for (int shift = 0; shift < 3; shift++)
+                for (int sa = -1; sa <= 1; sa += 2)
+                    for (int sb = -1; sb <= 1; sb += 2)
+                    {
+                        double n[3] = {0.0, sa * (family ? phi : 1.0), sb * (family ? 1.0 : phi)};
+                        std::rotate(n, n + 3 - shift, n + 3);
+                        addFace(corners, n, scale, triangles);
+                    }
+        return triangles;
+    }
+
+    /*
+    Line segments of the sphere glutWireSphere draws
+    @param radius sphere radius
+    @param slices circles through the poles
+    @param stacks bands between the poles, stacks - 1 circles of latitude
+    @return x, y, z of 2 ends per segment
+    */
+    static std::vector<float> wireSphere(float radius, int slices, int stacks)
+    {
+        std::vector<float> lines;
+        auto point = [&](int slice, int stack) {
+            double theta = 2.0 * M_PI * slice / slices, rho = M_PI * stack / stacks;
+            lines.push_back((float)(radius * cos(theta) * sin(rho)));
+            lines.push_back((float)(radius * sin(theta) * sin(rho)));
+            lines.push_back((float)(radius * cos(rho)));
+        };
+        for (int stack = 1; stack < stacks; stack++)
+            for (int slice = 0; slice < slices; slice++)
+            {
+                point(slice, stack);
+                point(slice + 1, stack);
+            }
+        for (int slice = 0; slice < slices; slice++)
+            for (int stack = 0; stack < stacks; stack++)
+            {
+                point(slice, stack);
+                point(slice, stack + 1);
+            }
+        return lines;
+    }
+
+private:
+    bool ready = false;
+    GLuint texture = 0;
+#ifndef __APPLE__
+    GLuint program = 0, meshBuffer = 0, fieldBuffer = 0, sphereBuffer = 0, instanceBuffer = 0;
+    GLint offsetAttribute = -1;
+    GLsizei meshVertices = 0, sphereVertices = 0;
+    std::vector<float> instances;
+#endif
+
+    /*
+    Appends one pentagon as a fan of 3 triangles, if the normal is one of a face
+    @param corners x, y, z of the 20 corners
+    @param n the face's normal, not normalized
+    @param scale applied to the corners
+    @param triangles appended to
+    */
+    static void addFace(const std::vector<double> &corners, const double n[3], double scale, std::vector<float> &triangles)
+    {
+        size_t count = corners.size() / 3;
+        double best = -1e30;
+        for (size_t c = 0; c < count; c++)
+            best = std::max(best, corners[3 * c] * n[0] + corners[3 * c + 1] * n[1] + corners[3 * c + 2] * n[2]);
+        std::vector<size_t> face;
+        for (size_t c = 0; c < count; c++)
+            if (corners[3 * c] * n[0] + corners[3 * c + 1] * n[1] + corners[3 * c + 2] * n[2] > best - 1e-9)
+                face.push_back(c);
+        if (face.size() != 5)
+            return;
+        // counter-clockwise seen from outside: by angle around n, in the face's plane
+        double u[3] = {corners[3 * face[0]], corners[3 * face[0] + 1], corners[3 * face[0] + 2]};
+        double v[3] = {n[1] * u[2] - n[2] * u[1], n[2] * u[0] - n[0] * u[2], n[0] * u[1] - n[1] * u[0]};
+        auto angle = [&](size_t c) {
+            const double *p = &corners[3 * c];
+            return atan2(p[0] * v[0] + p[1] * v[1] + p[2] * v[2], p[0] * u[0] + p[1] * u[1] + p[2] * u[2]);
+        };
+        std::sort(face.begin(), face.end(), [&](size_t a, size_t b) { return angle(a) < angle(b); });
+        for (int t = 1; t < 4; t++)
+            for (size_t c : {face[0], face[t], face[t + 1]})
+                for (int k = 0; k < 3; k++)
+                    triangles.push_back((float)(corners[3 * c + k] * scale));
+    }
+
+#ifndef __APPLE__
+    // compiles and links the instancing shader, 0 if it fails
+    static GLuint buildProgram()
+    {
+        static const char *vertexSource =
+            "#version 120\n"
+            "attribute vec3 offset;\n"
+            "void main()\n"
+            "{\n"
+            "    gl_FrontColor = gl_Color;\n"
+            "    gl_Position = gl_ModelViewProjectionMatrix * (gl_Vertex + vec4(offset, 0.0));\n"
+            "}\n";
+        static const char *fragmentSource =
+            "#version 120\n"
+            "void main()\n"
+            "{\n"
+            "    gl_FragColor = gl_Color;\n"
+            "}\n";
+        GLuint shaders[2] = {glCreateShader(GL_VERTEX_SHADER), glCreateShader(GL_FRAGMENT_SHADER)};
+        const char *sources[2] = {vertexSource, fragmentSource};
+        GLuint linked = glCreateProgram();
+        for (int s = 0; s < 2; s++)
+        {
+            GLint ok = 0;
+            glShaderSource(shaders[s], 1, &sources[s], NULL);
+            glCompileShader(shaders[s]);
+            glGetShaderiv(shaders[s], GL_COMPILE_STATUS, &ok);
+            glAttachShader(linked, shaders[s]);
+            glDeleteShader(shaders[s]);
+            if (!ok)
+            {
+                glDeleteProgram(linked);
+                return 0;
+            }
+        }
+        GLint ok = 0;
+        glLinkProgram(linked);
+        glGetProgramiv(linked, GL_LINK_STATUS, &ok);
+        if (!ok)
+        {
+            glDeleteProgram(linked);
+            return 0;
+        }
+        return linked;
+    }
+#endif
+};
@@ -0,0 +1,94 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: State of the drone show's UAVs as a structure of arrays. Every
+quantity (x, y, z, vx, vy, vz, onSphere) is its own 64-byte aligned array, so a
+kernel loads the x of 4 (AVX2) or 8 (AVX-512) neighbouring UAVs with one
+instruction instead of picking them out of interleaved records.
+The arrays continue past size() with zeroed padding, a UAV at rest at the origin,
+so kernels may run whole vectors over the end of a block without a scalar tail.
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+// doubles every kernel may read or write past the last UAV
+const size_t uavPadding = 8;
+
+// zero-filled array of doubles on a 64-byte boundary, with uavPadding to spare
+class alignedArray
+{
+public:
+    alignedArray() {}
+    explicit alignedArray(size_t n) { resize(n); }
+    ~alignedArray() { free(data); }
+
+    /*
+    Reallocates the array; the old contents are lost
+    @param n number of usable doubles
+    */
+    void resize(size_t n)
+    {
+        free(data);
+        data = NULL;
+        size_t bytes = ((n + uavPadding + 7) / 8) * 8 * sizeof(double);
+        void *memory = NULL;
+        if (posix_memalign(&memory, 64, bytes) != 0)
+            throw std::bad_alloc();
+        memset(memory, 0, bytes);
+        data = (double *)memory;
+        count = n;
+    }
+
+    size_t size() const { return count; }
+    double *get() { return data; }
+    const double *get() const { return data; }
+    double &operator[](size_t i) { return data[i]; }
+    const double &operator[](size_t i) const { return data[i]; }
+
+private:
+    double *data = NULL;
+    size_t count = 0;
+
+    alignedArray(const alignedArray &);
+    alignedArray &operator=(const alignedArray &);
+};
+
+class uavState
+{
+public:
+    // x, y, z, vx, vy, vz in that order, for loops over the components
+    static const int numComponents = 6;
+
+    alignedArray x, y, z, vx, vy, vz;
+    // 1 once the UAV reached the virtual sphere, else 0; a double so it fits in the same lanes
+    alignedArray onSphere;
+
+    uavState() {}
+    explicit uavState(size_t n) { resize(n); }
+
+    /*
+    Reallocates every array for n UAVs, all at rest at the origin
+    @param n number of UAVs
+    */
+    void resize(size_t n)
+    {
+        for (int c = 0; c < numComponents; c++)
+            component(c).resize(n);
+        onSphere.resize(n);
+    }
+
+    size_t size() const { return x.size(); }
+
+    /*
+    @param c 0 to 5 for x, y, z, vx, vy, vz
+    */
+    alignedArray &component(int c)
+    {
+        alignedArray *components[numComponents] = {&x, &y, &z, &vx, &vy, &vz};
+        return *components[c];
+    }
+};
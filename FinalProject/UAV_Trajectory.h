@@ -0,0 +1,292 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Compact trajectory log of a drone show. Rank 1 records every step
+while the show flies; TrajectoryViewer maps the file into memory and replays
+or scrubs it without MPI.
+
+Positions are quantized to trajectoryQuantum (1 mm) as 32-bit integers and
+cut into chunks of a fixed number of steps. A chunk starts with the absolute
+positions of its first step; every further step stores, per UAV and axis, the
+change since the step before as a zigzag varint, 1 or 2 bytes for a UAV moving
+less than 8 m per step instead of 24 bytes for three doubles. Any step is
+decoded from the start of its chunk, so scrubbing costs at most one chunk.
+
+File, little endian:
+    header   "UAVTRAJ1", uint32 UAVs, uint32 steps per chunk, double quantum
+    chunks   uint32 first step, uint32 steps, uint64 payload bytes, payload
+    payload  int32 x of every UAV, then every y, then every z, of the first
+             step; then for each further step every dx, every dy, every dz
+A chunk cut short by a crash is ignored, the chunks before it stay readable.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char trajectoryMagic[8] = {'U', 'A', 'V', 'T', 'R', 'A', 'J', '1'};
+
+// meters per quantization step
+const double trajectoryQuantum = 0.001;
+
+const size_t trajectoryHeaderSize = 24, chunkHeaderSize = 16;
+
+// a position in quanta; far away UAVs (and NaN) are clamped
+inline int32_t quantize(double value)
+{
+    double q = round(value / trajectoryQuantum);
+    if (!(q > -2147483647.0))
+        return -2147483647;
+    if (q > 2147483647.0)
+        return 2147483647;
+    return (int32_t)q;
+}
+
+class trajectoryWriter
+{
+public:
+    ~trajectoryWriter() { close(); }
+
+    /*
+    Creates the log and writes its header
+    @param path file name
+    @param uavs number of UAVs
+    @param perChunk steps per chunk
+    @return false if the file cannot be created
+    */
+    bool open(const char *path, int uavs, int perChunk)
+    {
+        file = fopen(path, "wb");
+        if (file == NULL)
+            return false;
+        numUAVs = uavs;
+        stepsPerChunk = perChunk;
+        chunkSteps = 0;
+        char header[trajectoryHeaderSize];
+        memcpy(header, trajectoryMagic, 8);
+        uint32_t counts[2] = {(uint32_t)uavs, (uint32_t)perChunk};
+        memcpy(header + 8, counts, 8);
+        memcpy(header + 16, &trajectoryQuantum, 8);
+        return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    }
+
+    bool isOpen() const { return file != NULL; }
+
+    /*
+    Records one step; steps must follow each other
+    @param step number of the step
+    @param x, y, z every UAV's position
+    */
+    void add(int step, const double *x, const double *y, const double *z)
+    {
+        if (file == NULL)
+            return;
+        const double *axes[3] = {x, y, z};
+        if (chunkSteps == 0)
+        {
+            chunkFirst = step;
+            last.resize(3 * (size_t)numUAVs);
+            payload.clear();
+            for (int a = 0; a < 3; a++)
+                for (int i = 0; i < numUAVs; i++)
+                {
+                    int32_t q = quantize(axes[a][i]);
+                    last[(size_t)a * numUAVs + i] = q;
+                    payload.append((const char *)&q, sizeof(q));
+                }
+        }
+        else
+        {
+            for (int a = 0; a < 3; a++)
+                for (int i = 0; i < numUAVs; i++)
+                {
+                    int32_t q = quantize(axes[a][i]);
+                    int32_t &previous = last[(size_t)a * numUAVs + i];
+                    int64_t delta = (int64_t)q - previous;
+                    putVarint((uint64_t)((delta << 1) ^ (delta >> 63)));
+                    previous = q;
+                }
+        }
+        if (++chunkSteps == stepsPerChunk)
+            flushChunk();
+    }
+
+    // writes the last, partial chunk and closes the file
+    void close()
+    {
+        if (file == NULL)
+            return;
+        flushChunk();
+        fclose(file);
+        file = NULL;
+    }
+
+private:
+    FILE *file = NULL;
+    int numUAVs = 0, stepsPerChunk = 0, chunkFirst = 0, chunkSteps = 0;
+    std::vector<int32_t> last;   // the positions recorded last, in quanta
+    std::string payload;
+
+    void putVarint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            payload.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        payload.push_back((char)value);
+    }
+
+    void flushChunk()
+    {
+        if (chunkSteps == 0)
+            return;
+        uint32_t steps[2] = {(uint32_t)chunkFirst, (uint32_t)chunkSteps};
+        uint64_t bytes = payload.size();
+        fwrite(steps, 1, sizeof(steps), file);
+        fwrite(&bytes, 1, sizeof(bytes), file);
+        fwrite(payload.data(), 1, payload.size(), file);
+        fflush(file);
+        chunkSteps = 0;
+    }
+};
+
+class trajectoryReader
+{
+public:
+    ~trajectoryReader()
+    {
+        if (data != NULL)
+            munmap((void *)data, size);
+    }
+
+    /*
+    Maps a log and finds its chunks
+    @param path file name
+    @return false if it is not a trajectory log or holds no complete chunk
+    */
+    bool open(const char *path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < trajectoryHeaderSize)
+        {
+            ::close(fd);
+            return false;
+        }
+        size = info.st_size;
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+        data = (const unsigned char *)mapped;
+        uint32_t counts[2];
+        memcpy(counts, data + 8, 8);
+        if (memcmp(data, trajectoryMagic, 8) != 0 || counts[0] == 0)
+            return false;
+        numUAVs = counts[0];
+        memcpy(&quantum, data + 16, 8);
+        for (size_t offset = trajectoryHeaderSize; offset + chunkHeaderSize <= size;)
+        {
+            chunk c;
+            uint32_t steps[2];
+            uint64_t bytes;
+            memcpy(steps, data + offset, 8);
+            memcpy(&bytes, data + offset + 8, 8);
+            c.first = steps[0];
+            c.steps = steps[1];
+            c.payload = offset + chunkHeaderSize;
+            c.end = c.payload + bytes;
+            if (bytes > size - c.payload || c.steps == 0 || bytes < 12 * (uint64_t)numUAVs ||
+                (!chunks.empty() && c.first != chunks.back().first + chunks.back().steps))
+                break;
+            chunks.push_back(c);
+            offset = c.end;
+        }
+        return !chunks.empty();
+    }
+
+    int uavs() const { return numUAVs; }
+    int firstStep() const { return chunks.front().first; }
+    int lastStep() const { return chunks.back().first + chunks.back().steps - 1; }
+
+    /*
+    Decodes one step; the next step after it is decoded from where this one ended
+    @param step firstStep() to lastStep()
+    @param xyz filled with the x of every UAV, then every y, then every z, in meters
+    @return false if the step is not in the log or its chunk is corrupt
+    */
+    bool positions(int step, std::vector<double> &xyz)
+    {
+        if (step < firstStep() || step > lastStep())
+            return false;
+        size_t k = 0;
+        while (chunks[k].first + chunks[k].steps <= (uint32_t)step)
+            k++;
+        const chunk &c = chunks[k];
+        size_t count = 3 * (size_t)numUAVs;
+        if (k != decodedChunk || step < decodedStep)
+        {
+            current.resize(count);
+            memcpy(current.data(), data + c.payload, count * sizeof(int32_t));
+            cursor = c.payload + count * sizeof(int32_t);
+            decodedChunk = k;
+            decodedStep = c.first;
+        }
+        for (; decodedStep < step; decodedStep++)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                uint64_t zigzag = 0;
+                int shift = 0;
+                unsigned char byte;
+                do
+                {
+                    if (cursor >= c.end || shift > 63)
+                    {
+                        decodedChunk = (size_t)-1;
+                        return false;
+                    }
+                    byte = data[cursor++];
+                    zigzag |= (uint64_t)(byte & 0x7f) << shift;
+                    shift += 7;
+                } while (byte & 0x80);
+                current[i] = (int32_t)((int64_t)current[i] + (int64_t)((zigzag >> 1) ^ (0 - (zigzag & 1))));
+            }
+        }
+        xyz.resize(count);
+        for (size_t i = 0; i < count; i++)
+            xyz[i] = current[i] * quantum;
+        return true;
+    }
+
+private:
+    struct chunk
+    {
+        uint32_t first, steps;
+        size_t payload, end;   // offsets of the payload and of what follows it
+    };
+
+    const unsigned char *data = NULL;
+    size_t size = 0;
+    int numUAVs = 0;
+    double quantum = trajectoryQuantum;
+    std::vector<chunk> chunks;
+
+    // the step decoded last and where its chunk's next step starts
+    std::vector<int32_t> current;
+    size_t decodedChunk = (size_t)-1, cursor = 0;
+    int decodedStep = 0;
+};
@@ -0,0 +1,111 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Micro-benchmark of the broadcast compression (TCP_Compression.h),
+without sockets. Chat-like messages of several sizes are built from a fixed word
+list and every one is checked to decode back to itself. For each size it prints
+the wire bytes of a version '2' and a version '3' frame, how fast messages are
+compressed and expanded, and what one broadcast to the given number of recipients
+puts on the wire either way. The server compresses a broadcast once however many
+recipients share it, so the compression cost does not grow with the fan-out.
+
+Compiled with:
+    g++ -O2 -std=c++11 compressionBench.cpp -o compressionBench
+Run with:
+    ./compressionBench [recipients] [messages per run]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../TCP_Framing.h"
+
+/*
+Builds a message that reads like chat traffic
+@param len message length
+@param seed picks the words
+*/
+std::string chatMessage(size_t len, unsigned seed)
+{
+    static const char *words[] = {"hello", "everyone", "the", "server", "is", "back", "up", "again",
+                                  "did", "you", "see", "my", "last", "message", "about", "meeting",
+                                  "tomorrow", "at", "noon", "thanks", "ok", "sounds", "good", "to", "me",
+                                  "channel", "update", "deploy", "finished", "lol", "anyone", "here"};
+    const size_t wordCount = sizeof(words) / sizeof(words[0]);
+    std::string text;
+    while (text.size() < len)
+    {
+        seed = seed * 1103515245u + 12345u;
+        text += words[(seed >> 16) % wordCount];
+        text += (seed & 0x100) ? ". " : " ";
+    }
+    text.resize(len);
+    return text;
+}
+
+int main(int argc, char *argv[])
+{
+    int recipients = (argc > 1) ? atoi(argv[1]) : 1000;
+    int count = (argc > 2) ? atoi(argv[2]) : 20000;
+    if (recipients <= 0 || count <= 0)
+    {
+        fprintf(stderr, "usage %s [recipients] [messages per run]\n", argv[0]);
+        exit(1);
+    }
+    const size_t sizes[] = {24, 48, 100, 250, 1000, 4000};
+    printf("%d recipients per broadcast\n", recipients);
+    printf("%7s %9s %9s %7s %12s %12s %12s %12s\n", "payload", "v2 bytes", "v3 bytes", "ratio",
+           "compress/s", "expand/s", "v2 fan-out", "v3 fan-out");
+    for (size_t size : sizes)
+    {
+        // a set of different messages, so the timings are not of one lucky input
+        std::vector<std::string> payloads, frames(64);
+        size_t plainBytes = 0, wireBytes = 0;
+        for (unsigned i = 0; i < 64; i++)
+        {
+            payloads.push_back(chatMessage(size, i + 1));
+            encodeCompressedFrame('0', payloads[i].data(), size, frames[i]);
+            plainBytes += compactHeaderSize + size;
+            wireBytes += frames[i].size();
+            frameDecoder decoder;
+            frameView frame;
+            decoder.feed(frames[i].data(), frames[i].size());
+            if (!decoder.next(frame) || std::string(frame.payload, frame.len) != payloads[i])
+            {
+                fprintf(stderr, "ERROR, %zu byte message %u does not decode back\n", size, i);
+                exit(1);
+            }
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        size_t checksum = 0;
+        for (int i = 0; i < count; i++)
+        {
+            std::string out;
+            encodeCompressedFrame('0', payloads[i % 64].data(), size, out);
+            checksum += out.size();
+        }
+        double compressSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        begin = std::chrono::steady_clock::now();
+        frameDecoder decoder;
+        frameView frame;
+        for (int i = 0; i < count; i++)
+        {
+            decoder.feed(frames[i % 64].data(), frames[i % 64].size());
+            while (decoder.next(frame))
+                checksum += frame.len;
+        }
+        double expandSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (checksum == 0)
+            printf("unreachable\n");
+
+        double plain = plainBytes / 64.0, wire = wireBytes / 64.0;
+        printf("%7zu %9.1f %9.1f %6.2fx %12.0f %12.0f %11.1fK %11.1fK\n", size, plain, wire, plain / wire,
+               count / compressSeconds, count / expandSeconds, plain * recipients / 1e3, wire * recipients / 1e3);
+    }
+    return 0;
+}
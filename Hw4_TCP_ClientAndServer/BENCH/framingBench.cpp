@@ -0,0 +1,141 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Compares the fixed 1004-byte tcpMessage framing (version '1') against
+the length-prefixed framing (version '2') over a loopback TCP connection. For each
+payload size it streams the same number of messages in both versions through
+frameDecoder and prints bytes on the wire, messages per second and MB/s.
+
+Compiled with:
+    g++ -O2 -std=c++11 -pthread framingBench.cpp -o framingBench
+Run with:
+    ./framingBench [messages per run]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "../TCP_Framing.h"
+
+/*
+Opens a connected loopback TCP pair
+@param sender filled with the client end
+@param receiver filled with the accepted end
+*/
+void loopbackPair(int &sender, int &receiver)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0)
+    {
+        perror("ERROR on binding");
+        exit(1);
+    }
+    getsockname(listener, (sockaddr *)&addr, &len);
+    sender = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(sender, (sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("ERROR connecting");
+        exit(1);
+    }
+    receiver = accept(listener, nullptr, nullptr);
+    int on = 1;
+    setsockopt(sender, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    close(listener);
+}
+
+/*
+Streams count messages of payloadLen bytes in one wire version
+@param version '1' or '2'
+@param payloadLen payload size in bytes
+@param count number of messages
+@param wireBytes filled with the total bytes sent
+@return elapsed seconds until the receiver decoded the last message
+*/
+double runOnce(unsigned char version, size_t payloadLen, int count, size_t &wireBytes)
+{
+    int sender, receiver;
+    loopbackPair(sender, receiver);
+    std::string payload(payloadLen, 'm');
+    std::string frame;
+    encodeFrame(version, '0', payload.data(), payload.size(), frame);
+
+    // batch a few frames per send the way a busy server would
+    std::string batch;
+    const int perBatch = 32;
+    for (int i = 0; i < perBatch; i++)
+        batch += frame;
+
+    int decoded = 0;
+    std::thread reader([&]() {
+        frameDecoder decoder;
+        tcpFrame msg;
+        char buffer[65536];
+        while (decoded < count)
+        {
+            ssize_t n = recv(receiver, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+                break;
+            decoder.feed(buffer, n);
+            while (decoder.next(msg))
+                decoded++;
+        }
+    });
+
+    auto begin = std::chrono::steady_clock::now();
+    wireBytes = 0;
+    for (int sent = 0; sent < count; sent += perBatch)
+    {
+        size_t len = (count - sent < perBatch) ? frame.size() * (count - sent) : batch.size();
+        size_t off = 0;
+        while (off < len)
+        {
+            ssize_t n = send(sender, batch.data() + off, len - off, 0);
+            if (n <= 0)
+            {
+                perror("ERROR writing to socket");
+                exit(1);
+            }
+            off += n;
+        }
+        wireBytes += len;
+    }
+    reader.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    close(sender);
+    close(receiver);
+    return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 200000;
+    const size_t sizes[] = {3, 32, 128, 512, 999};
+
+    printf("%-8s %-8s %14s %12s %14s %10s\n", "payload", "version", "wire bytes", "bytes/msg", "msgs/s", "MB/s");
+    for (size_t payloadLen : sizes)
+    {
+        for (unsigned char version : {'1', '2'})
+        {
+            size_t wireBytes;
+            double seconds = runOnce(version, payloadLen, count, wireBytes);
+            printf("%-8zu %-8c %14zu %12.1f %14.0f %10.1f\n", payloadLen, version, wireBytes,
+                   (double)wireBytes / count, count / seconds, wireBytes / seconds / 1e6);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,461 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Headless load generator for the TCP chat server. Opens N connections,
+sends a configurable mix of type-0 broadcasts and type-1 reverse requests at a target
+total rate (open loop, so a slow server shows up as latency rather than a lower
+offered load), and reports throughput plus p50/p99/p999 latencies as CSV or JSON.
+
+Every payload starts with "LG <sender> <sendTimeNs> " so replies can be matched
+without any shared state. Type-1 latency is the round trip to the sender; type-0
+latency is the time until each other connection receives the broadcast.
+
+Compiled with:
+    g++ -O2 -std=c++11 -pthread loadGenerator.cpp -o loadGenerator
+Run with:
+    ./loadGenerator <host> <port> [options]
+    --conns <n>          connections (default 50)
+    --threads <n>        worker threads, each owns a slice of the connections (default 2)
+    --rate <msgs/s>      total messages sent per second (default 10000)
+    --broadcast <0..1>   fraction of messages that are type-0 broadcasts (default 0.1)
+    --size <bytes>       payload size, at least 40 (default 64)
+    --version 1|2        wire version (default 2)
+    --duration <s>       measured seconds (default 10)
+    --warmup <s>         seconds sent before measuring starts (default 1)
+    --format csv|json    report format (default csv)
+    --label <text>       free text copied into the report, e.g. the server mode
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../TCP_Framing.h"
+
+/*
+Log-linear latency histogram: 64 linear sub-buckets per power of two, so any
+percentile is within about 1.5% of the true value and merging is a plain add.
+*/
+struct latencyHistogram
+{
+    static const int subBits = 6;
+    static const int subCount = 1 << subBits;
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(64 * subCount, 0);
+    uint64_t total = 0;
+    uint64_t maxNs = 0;
+
+    static int indexOf(uint64_t ns)
+    {
+        if (ns < (uint64_t)subCount)
+            return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        int shift = msb - subBits;
+        return (shift + 1) * subCount + (int)((ns >> shift) & (subCount - 1));
+    }
+
+    static uint64_t valueOf(int index)
+    {
+        if (index < subCount)
+            return index;
+        int shift = index / subCount - 1;
+        uint64_t sub = index % subCount;
+        return ((uint64_t)subCount + sub) << shift;
+    }
+
+    void record(uint64_t ns)
+    {
+        buckets[indexOf(ns)]++;
+        total++;
+        if (ns > maxNs)
+            maxNs = ns;
+    }
+
+    void merge(const latencyHistogram &other)
+    {
+        for (size_t i = 0; i < buckets.size(); i++)
+            buckets[i] += other.buckets[i];
+        total += other.total;
+        if (other.maxNs > maxNs)
+            maxNs = other.maxNs;
+    }
+
+    // latency at quantile q (0..1) in microseconds
+    double percentileUs(double q) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)ceil(q * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank && buckets[i] > 0)
+                return valueOf((int)i) / 1000.0;
+        }
+        return maxNs / 1000.0;
+    }
+};
+
+struct options
+{
+    std::string host;
+    int port = 0;
+    int conns = 50;
+    int threads = 2;
+    double rate = 10000;
+    double broadcast = 0.1;
+    int size = 64;
+    unsigned char version = '2';
+    double duration = 10;
+    double warmup = 1;
+    std::string format = "csv";
+    std::string label;
+};
+
+struct connection
+{
+    int fd;
+    int globalId;
+    frameDecoder decoder;
+    std::string outBuf;
+    bool writeArmed = false;
+};
+
+// per-thread results, merged by main after the run
+struct workerStats
+{
+    uint64_t sent0 = 0, sent1 = 0, replies = 0, deliveries = 0, errors = 0;
+    uint64_t bytesOut = 0, bytesIn = 0;
+    latencyHistogram reverseRtt, broadcastLatency;
+};
+
+std::atomic<bool> stopFlag{false};
+std::atomic<bool> measuring{false};
+
+uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+Opens a non-blocking TCP connection with Nagle disabled
+@param addr resolved server address
+@return the socket, exits on failure
+*/
+int openConnection(const sockaddr_in &addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("ERROR connecting");
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/*
+Writes as much of outBuf as the socket accepts, toggling EPOLLOUT as needed
+@return false if the socket failed
+*/
+bool flushConnection(int epfd, connection &conn, workerStats &stats)
+{
+    size_t off = 0;
+    while (off < conn.outBuf.size())
+    {
+        ssize_t n = send(conn.fd, conn.outBuf.data() + off, conn.outBuf.size() - off, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            off += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return false;
+    }
+    stats.bytesOut += off;
+    conn.outBuf.erase(0, off);
+    bool wantWrite = !conn.outBuf.empty();
+    if (wantWrite != conn.writeArmed)
+    {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | (wantWrite ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.ptr = &conn;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.writeArmed = wantWrite;
+    }
+    return true;
+}
+
+/*
+Reads a "LG <sender> <sendTimeNs> " prefix
+@return false if the payload was not produced by a load generator
+*/
+bool parsePayload(const std::string &payload, int &sender, uint64_t &sentNs)
+{
+    unsigned long long t;
+    if (payload.size() < 3 || payload.compare(0, 3, "LG ") != 0)
+        return false;
+    if (sscanf(payload.c_str() + 3, "%d %llu", &sender, &t) != 2)
+        return false;
+    sentNs = t;
+    return true;
+}
+
+/*
+Drives a slice of the connections: paces sends and records every reply
+@param opt run options
+@param conns the connections owned by this thread
+@param rate messages per second this thread sends
+@param stats filled with the thread's results
+*/
+void workerThread(const options &opt, std::vector<connection> *conns, double rate, workerStats *stats)
+{
+    int epfd = epoll_create1(0);
+    for (connection &conn : *conns)
+    {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conn;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn.fd, &ev);
+    }
+    std::mt19937_64 gen(std::random_device{}());
+    std::uniform_real_distribution<double> pick(0.0, 1.0);
+    const double intervalNs = 1e9 / rate;
+    uint64_t start = nowNs();
+    uint64_t due = 0; // messages that should have been sent by now
+    uint64_t issued = 0;
+    size_t next = 0;
+    std::string payload, frame;
+    tcpFrame reply;
+    char buffer[65536];
+    epoll_event events[64];
+
+    while (!stopFlag)
+    {
+        // open loop: catch up on every message that is due, whatever the server does
+        due = (uint64_t)((nowNs() - start) / intervalNs);
+        while (issued < due)
+        {
+            connection &conn = (*conns)[next];
+            next = (next + 1) % conns->size();
+            unsigned char type = (pick(gen) < opt.broadcast) ? '0' : '1';
+            char prefix[64];
+            int len = snprintf(prefix, sizeof(prefix), "LG %d %llu ", conn.globalId, (unsigned long long)nowNs());
+            payload.assign(prefix, len);
+            payload.resize(std::max((int)payload.size(), opt.size), 'x');
+            frame.clear();
+            encodeFrame(opt.version, type, payload.data(), payload.size(), frame);
+            conn.outBuf += frame;
+            if (!conn.writeArmed && !flushConnection(epfd, conn, *stats))
+                stats->errors++;
+            if (measuring)
+                (type == '0') ? stats->sent0++ : stats->sent1++;
+            issued++;
+        }
+
+        // sleep at least a millisecond rather than spin; what falls due meanwhile goes
+        // out as one burst, and each message still carries its own send time
+        uint64_t nextDue = start + (uint64_t)((issued + 1) * intervalNs);
+        uint64_t now = nowNs();
+        int timeoutMs = (nextDue > now) ? (int)((nextDue - now + 999999) / 1000000) : 0;
+        int n = epoll_wait(epfd, events, 64, std::min(timeoutMs, 100));
+        for (int i = 0; i < n; i++)
+        {
+            connection &conn = *(connection *)events[i].data.ptr;
+            if ((events[i].events & EPOLLOUT) && !flushConnection(epfd, conn, *stats))
+                stats->errors++;
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                continue;
+            while (true)
+            {
+                ssize_t got = recv(conn.fd, buffer, sizeof(buffer), 0);
+                if (got > 0)
+                {
+                    stats->bytesIn += got;
+                    conn.decoder.feed(buffer, got);
+                    continue;
+                }
+                if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                    fprintf(stderr, "connection %d closed by server\n", conn.globalId);
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, conn.fd, nullptr);
+                    stats->errors++;
+                }
+                break;
+            }
+            uint64_t arrived = nowNs();
+            while (conn.decoder.next(reply))
+            {
+                if (reply.nType == '1')
+                    std::string(reply.payload.rbegin(), reply.payload.rend()).swap(reply.payload);
+                int sender;
+                uint64_t sentNs;
+                if (!measuring || !parsePayload(reply.payload, sender, sentNs))
+                    continue;
+                if (reply.nType == '1')
+                {
+                    stats->replies++;
+                    stats->reverseRtt.record(arrived - sentNs);
+                }
+                else if (reply.nType == '0')
+                {
+                    stats->deliveries++;
+                    stats->broadcastLatency.record(arrived - sentNs);
+                }
+            }
+        }
+    }
+    close(epfd);
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "usage %s host port [--conns n] [--threads n] [--rate msgs/s] [--broadcast 0..1]\n"
+                    "       [--size bytes] [--version 1|2] [--duration s] [--warmup s] [--format csv|json]\n"
+                    "       [--label text]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+        usage(argv[0]);
+    options opt;
+    opt.host = argv[1];
+    opt.port = atoi(argv[2]);
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        std::string name = argv[i];
+        const char *value = argv[i + 1];
+        if (name == "--conns") opt.conns = atoi(value);
+        else if (name == "--threads") opt.threads = atoi(value);
+        else if (name == "--rate") opt.rate = atof(value);
+        else if (name == "--broadcast") opt.broadcast = atof(value);
+        else if (name == "--size") opt.size = atoi(value);
+        else if (name == "--version") opt.version = value[0];
+        else if (name == "--duration") opt.duration = atof(value);
+        else if (name == "--warmup") opt.warmup = atof(value);
+        else if (name == "--format") opt.format = value;
+        else if (name == "--label") opt.label = value;
+        else usage(argv[0]);
+    }
+    if (opt.conns < 1 || opt.threads < 1 || opt.rate <= 0)
+        usage(argv[0]);
+    if (opt.threads > opt.conns)
+        opt.threads = opt.conns;
+    if (opt.version == '1' && opt.size > 999)
+        opt.size = 999;
+
+    hostent *server = gethostbyname(opt.host.c_str());
+    if (server == NULL)
+    {
+        fprintf(stderr, "ERROR, no such host\n");
+        exit(1);
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    memmove(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    addr.sin_port = htons(opt.port);
+
+    // deal the connections out to the threads
+    std::vector<std::vector<connection>> slices(opt.threads);
+    for (int t = 0; t < opt.threads; t++)
+        slices[t] = std::vector<connection>(opt.conns / opt.threads + (t < opt.conns % opt.threads ? 1 : 0));
+    int globalId = 0;
+    for (auto &slice : slices)
+        for (connection &conn : slice)
+        {
+            conn.fd = openConnection(addr);
+            conn.globalId = globalId++;
+        }
+
+    std::vector<workerStats> stats(opt.threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < opt.threads; t++)
+    {
+        double share = opt.rate * slices[t].size() / opt.conns;
+        workers.emplace_back(workerThread, std::cref(opt), &slices[t], share, &stats[t]);
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(opt.warmup));
+    measuring = true;
+    uint64_t began = nowNs();
+    std::this_thread::sleep_for(std::chrono::duration<double>(opt.duration));
+    measuring = false;
+    double seconds = (nowNs() - began) / 1e9;
+    stopFlag = true;
+    for (auto &worker : workers)
+        worker.join();
+    for (auto &slice : slices)
+        for (connection &conn : slice)
+            close(conn.fd);
+
+    workerStats total;
+    for (auto &s : stats)
+    {
+        total.sent0 += s.sent0;
+        total.sent1 += s.sent1;
+        total.replies += s.replies;
+        total.deliveries += s.deliveries;
+        total.errors += s.errors;
+        total.bytesOut += s.bytesOut;
+        total.bytesIn += s.bytesIn;
+        total.reverseRtt.merge(s.reverseRtt);
+        total.broadcastLatency.merge(s.broadcastLatency);
+    }
+
+    double sentRate = (total.sent0 + total.sent1) / seconds;
+    double replyRate = total.replies / seconds;
+    double deliveryRate = total.deliveries / seconds;
+    const latencyHistogram &r = total.reverseRtt, &b = total.broadcastLatency;
+    if (opt.format == "json")
+    {
+        printf("{\"label\":\"%s\",\"conns\":%d,\"version\":\"%c\",\"size\":%d,\"target_rate\":%.0f,"
+               "\"broadcast_fraction\":%.3f,\"seconds\":%.2f,\"sent_per_s\":%.1f,\"replies_per_s\":%.1f,"
+               "\"deliveries_per_s\":%.1f,\"mb_out_per_s\":%.2f,\"mb_in_per_s\":%.2f,\"errors\":%llu,"
+               "\"reverse_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},"
+               "\"broadcast_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+               opt.label.c_str(), opt.conns, opt.version, opt.size, opt.rate, opt.broadcast, seconds,
+               sentRate, replyRate, deliveryRate, total.bytesOut / seconds / 1e6, total.bytesIn / seconds / 1e6,
+               (unsigned long long)total.errors,
+               r.percentileUs(0.50), r.percentileUs(0.99), r.percentileUs(0.999), r.maxNs / 1000.0,
+               b.percentileUs(0.50), b.percentileUs(0.99), b.percentileUs(0.999), b.maxNs / 1000.0);
+    }
+    else
+    {
+        printf("label,conns,version,size,target_rate,broadcast_fraction,seconds,sent_per_s,replies_per_s,"
+               "deliveries_per_s,mb_out_per_s,mb_in_per_s,errors,reverse_p50_us,reverse_p99_us,reverse_p999_us,"
+               "broadcast_p50_us,broadcast_p99_us,broadcast_p999_us\n");
+        printf("%s,%d,%c,%d,%.0f,%.3f,%.2f,%.1f,%.1f,%.1f,%.2f,%.2f,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+               opt.label.c_str(), opt.conns, opt.version, opt.size, opt.rate, opt.broadcast, seconds,
+               sentRate, replyRate, deliveryRate, total.bytesOut / seconds / 1e6, total.bytesIn / seconds / 1e6,
+               (unsigned long long)total.errors,
+               r.percentileUs(0.50), r.percentileUs(0.99), r.percentileUs(0.999),
+               b.percentileUs(0.50), b.percentileUs(0.99), b.percentileUs(0.999));
+    }
+    return total.errors ? 2 : 0;
+}
@@ -0,0 +1,131 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Micro-benchmark of frameDecoder (TCP_Framing.h), without sockets. A
+stream of small frames is encoded once in memory and handed to the decoder the way
+the server's readers would receive it; a memcpy stands in for each recv. Three
+receive paths are compared for each payload size and wire version:
+    per message    one read per message, then one next() (the old recv loop)
+    copy + feed    reads into a stack buffer, then feed() copies them into the decoder
+    prepare        reads straight into the decoder's buffer with prepare()/commit()
+and the batched paths are run with 64 KiB reads and with 1448-byte reads (one TCP
+segment), which split most frames across two reads. Only the decoding is timed;
+on a real socket every read is also a system call, which is what batching saves.
+
+Compiled with:
+    g++ -O2 -std=c++11 parserBench.cpp -o parserBench
+Run with:
+    ./parserBench [messages per run]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "../TCP_Framing.h"
+
+enum receivePath { perMessage, copyFeed, prepareCommit };
+
+// payload bytes are summed into it so the decoding cannot be optimized away
+volatile size_t checksumSink;
+
+/*
+Decodes a whole stream once
+@param stream the encoded frames
+@param frameBytes size of one frame, for the per message path
+@param chunk bytes one read returns
+@param path how the bytes reach the decoder
+@return number of frames decoded
+*/
+size_t decodeStream(const std::string &stream, size_t frameBytes, size_t chunk, receivePath path)
+{
+    size_t checksum = 0;
+    frameDecoder decoder;
+    frameView frame;
+    static char buffer[1 << 16];
+    size_t frames = 0;
+    if (path == perMessage)
+        chunk = frameBytes;
+    for (size_t offset = 0; offset < stream.size(); offset += chunk)
+    {
+        size_t n = std::min(chunk, stream.size() - offset);
+        if (path == prepareCommit)
+        {
+            memcpy(decoder.prepare(n), stream.data() + offset, n);
+            decoder.commit(n);
+        } else
+        {
+            memcpy(buffer, stream.data() + offset, n);
+            decoder.feed(buffer, n);
+        }
+        while (decoder.next(frame))
+        {
+            checksum += frame.len + (unsigned char)frame.payload[0];
+            frames++;
+        }
+    }
+    checksumSink = checksum;
+    return frames;
+}
+
+/*
+Times one receive path and prints a result line
+@param label what is measured
+@param stream the encoded frames
+@param frameBytes size of one frame
+@param chunk bytes one read returns
+@param path how the bytes reach the decoder
+@param count frames in the stream
+*/
+void runCase(const char *label, const std::string &stream, size_t frameBytes, size_t chunk, receivePath path, int count)
+{
+    decodeStream(stream, frameBytes, chunk, path); // warm up
+    int rounds = 5;
+    auto begin = std::chrono::steady_clock::now();
+    size_t frames = 0;
+    for (int i = 0; i < rounds; i++)
+        frames += decodeStream(stream, frameBytes, chunk, path);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (frames != (size_t)count * rounds)
+    {
+        fprintf(stderr, "ERROR, decoded %zu of %zu frames\n", frames, (size_t)count * rounds);
+        exit(1);
+    }
+    printf("  %-24s %8.2f M msgs/s %7.1f ns/msg %8.0f MB/s\n", label, frames / seconds / 1e6,
+           seconds * 1e9 / frames, stream.size() * (double)rounds / seconds / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+    if (count <= 0)
+    {
+        fprintf(stderr, "usage %s [messages per run]\n", argv[0]);
+        exit(1);
+    }
+    const size_t payloads[] = {16, 64, 256};
+    const unsigned char versions[] = {'2', '1'};
+    for (unsigned char version : versions)
+    {
+        for (size_t payloadLen : payloads)
+        {
+            std::string payload(payloadLen, 'm'), frame, stream;
+            encodeFrame(version, '0', payload.data(), payload.size(), frame);
+            int n = (version == '1') ? count / 10 : count; // version 1 frames are 1004 bytes
+            stream.reserve(frame.size() * n);
+            for (int i = 0; i < n; i++)
+                stream += frame;
+            printf("version %c, %zu byte payload, %zu byte frames, %d messages\n", version, payloadLen,
+                   frame.size(), n);
+            runCase("per message", stream, frame.size(), 0, perMessage, n);
+            runCase("64 KiB reads, copy+feed", stream, frame.size(), 1 << 16, copyFeed, n);
+            runCase("64 KiB reads, prepare", stream, frame.size(), 1 << 16, prepareCommit, n);
+            runCase("1448 B reads, copy+feed", stream, frame.size(), 1448, copyFeed, n);
+            runCase("1448 B reads, prepare", stream, frame.size(), 1448, prepareCommit, n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Compares the cost of a type-0 broadcast with a type-5 channel publish.
+Opens N receiving connections plus one publisher. The publisher first sends type-0
+broadcasts, which reach every receiver, then publishes to a channel while more and
+more receivers subscribe to it (1, N/100, N/10, N). Every publish is sent in bursts
+and each burst waits until all of its deliveries have arrived, so the rate is limited
+by the fan-out. Broadcast cost follows the number of connections; channel cost
+follows the number of subscribers.
+
+Compiled with:
+    g++ -O2 -std=c++11 pubsubBench.cpp -o pubsubBench
+Run with:
+    ./pubsubBench <host> <port> [--conns n] [--messages n]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "../TCP_Framing.h"
+
+// publishes sent before waiting for their deliveries
+const int burstSize = 64;
+
+// payload of every published message, starting with the channel name
+const std::string payload = "bench 0123456789abcdefghijklmnopqrstuv";
+
+/*
+Opens a TCP connection with Nagle disabled
+@param addr resolved server address
+@return the socket, exits on failure
+*/
+int openConnection(const sockaddr_in &addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("ERROR connecting");
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+/*
+Sends a whole buffer on a blocking socket
+@param fd the socket
+@param bytes encoded frames
+*/
+void sendAll(int fd, const std::string &bytes)
+{
+    for (size_t sent = 0; sent < bytes.size(); )
+    {
+        ssize_t n = send(fd, bytes.data() + sent, bytes.size() - sent, 0);
+        if (n <= 0)
+        {
+            perror("ERROR writing to socket");
+            exit(1);
+        }
+        sent += n;
+    }
+}
+
+/*
+Sends one message followed by a type-1 request and waits for its reply. The server
+handles a connection's messages in order, so the message has taken effect afterwards.
+@param fd the socket, blocking
+@param nType type of the message
+@param text payload of the message
+*/
+void sendAndSync(int fd, unsigned char nType, const std::string &text)
+{
+    std::string out;
+    encodeFrame('2', nType, text.data(), text.size(), out);
+    encodeFrame('2', '1', "ping", 4, out);
+    sendAll(fd, out);
+    char reply[compactHeaderSize + 4];
+    for (size_t got = 0; got < sizeof(reply); )
+    {
+        ssize_t n = recv(fd, reply + got, sizeof(reply) - got, 0);
+        if (n <= 0)
+        {
+            fprintf(stderr, "ERROR, server closed the connection\n");
+            exit(1);
+        }
+        got += n;
+    }
+}
+
+/*
+Reads from every receiver until the expected number of bytes arrived
+@param polls one entry per receiver
+@param expected bytes to wait for
+@return false if they did not arrive within 5 seconds
+*/
+bool receive(std::vector<pollfd> &polls, uint64_t expected)
+{
+    char buffer[65536];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    uint64_t got = 0;
+    while (got < expected)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        if (poll(polls.data(), polls.size(), 100) <= 0)
+            continue;
+        for (pollfd &p : polls)
+        {
+            if (!(p.revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t n;
+            while ((n = recv(p.fd, buffer, sizeof(buffer), 0)) > 0)
+                got += n;
+        }
+    }
+    return true;
+}
+
+/*
+Publishes messages in bursts, waiting for every delivery of a burst before the next
+@param publisher the publishing socket
+@param polls the receivers
+@param nType '0' to broadcast, '5' to publish to the channel
+@param messages number of messages, a multiple of burstSize
+@param recipients deliveries per message
+@return messages per second, or -1 if deliveries went missing
+*/
+double run(int publisher, std::vector<pollfd> &polls, unsigned char nType, int messages, size_t recipients)
+{
+    std::string burst;
+    for (int i = 0; i < burstSize; i++)
+        encodeFrame('2', nType, payload.data(), payload.size(), burst);
+    uint64_t burstBytes = (uint64_t)burstSize * recipients * (compactHeaderSize + payload.size());
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int sent = 0; sent < messages; sent += burstSize)
+    {
+        sendAll(publisher, burst);
+        if (!receive(polls, burstBytes))
+            return -1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return messages / seconds;
+}
+
+/*
+Prints one result row
+@param mode broadcast or channel
+@param recipients deliveries per message
+@param rate messages per second, -1 if deliveries went missing
+*/
+void report(const char *mode, size_t recipients, double rate)
+{
+    if (rate < 0)
+    {
+        printf("%-10s %-12zu deliveries missing (queues overflowed?)\n", mode, recipients);
+        return;
+    }
+    printf("%-10s %-12zu %-13.0f %.0f\n", mode, recipients, rate, rate * recipients);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage %s host port [--conns n] [--messages n]\n", argv[0]);
+        exit(1);
+    }
+    int conns = 1000, messages = 2048;
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        std::string name = argv[i];
+        if (name == "--conns")
+            conns = atoi(argv[i + 1]);
+        else if (name == "--messages")
+            messages = atoi(argv[i + 1]);
+    }
+    if (conns < 1 || messages < burstSize)
+    {
+        fprintf(stderr, "ERROR, need at least 1 connection and %d messages\n", burstSize);
+        exit(1);
+    }
+    messages -= messages % burstSize;
+
+    hostent *server = gethostbyname(argv[1]);
+    if (server == NULL)
+    {
+        fprintf(stderr, "ERROR, no such host\n");
+        exit(1);
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    memmove(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    addr.sin_port = htons(atoi(argv[2]));
+
+    // every connection speaks version 2 before anything is sent to it
+    int publisher = openConnection(addr);
+    sendAndSync(publisher, '4', "bench");
+    std::vector<pollfd> polls(conns);
+    for (pollfd &p : polls)
+    {
+        p.fd = openConnection(addr);
+        p.events = POLLIN;
+        sendAndSync(p.fd, '4', "bench");
+        fcntl(p.fd, F_SETFL, fcntl(p.fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    printf("mode       recipients   messages/s    deliveries/s\n");
+    report("broadcast", conns, run(publisher, polls, '0', messages, conns));
+
+    int subscribed = 0;
+    const int targets[] = {1, conns / 100, conns / 10, conns};
+    for (int target : targets)
+    {
+        if (target <= subscribed)
+            continue;
+        for (; subscribed < target; subscribed++)
+        {
+            int fd = polls[subscribed].fd;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            sendAndSync(fd, '3', "bench");
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+        report("channel", subscribed, run(publisher, polls, '5', messages, subscribed));
+    }
+
+    for (pollfd &p : polls)
+        close(p.fd);
+    close(publisher);
+    return 0;
+}
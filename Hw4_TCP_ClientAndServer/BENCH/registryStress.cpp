@@ -0,0 +1,219 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Stress run for the server's connection registry (SERVER/TCP_Registry.h).
+Churn threads insert and remove clients as fast as they can while broadcast threads
+take snapshots and walk them. It checks that no snapshot holds a duplicate id and
+that every client a snapshot holds is still alive, then prints the operation rates.
+When given a host and port it also churns real connections against a running server
+while one client sends it a steady stream of type-0 broadcasts.
+
+Compiled with:
+    g++ -O2 -std=c++11 -pthread registryStress.cpp -o registryStress
+Run with:
+    ./registryStress [seconds]
+    ./registryStress [seconds] <host> <port>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include "../TCP_Framing.h"
+#include "../SERVER/TCP_Registry.h"
+
+// stand-in for socketInfo
+struct fakeClient
+{
+    uint64_t id = 0;
+    std::atomic<bool> alive{true};
+    std::atomic<uint64_t> delivered{0};
+};
+
+std::atomic<bool> stopFlag{false};
+std::atomic<bool> failed{false};
+
+/*
+Inserts clients and removes random ones, keeping about target clients registered
+@param registry the registry under test
+@param target steady-state client count for this thread
+@param ops incremented once per insert or remove
+*/
+void churnThread(connectionRegistry<fakeClient> *registry, size_t target, std::atomic<uint64_t> *ops)
+{
+    std::mt19937 gen(std::random_device{}());
+    std::vector<std::shared_ptr<fakeClient>> mine;
+    while (!stopFlag)
+    {
+        if (mine.size() < target || (gen() & 1))
+        {
+            std::shared_ptr<fakeClient> client = std::make_shared<fakeClient>();
+            registry->insert(client);
+            mine.push_back(client);
+        }
+        else
+        {
+            size_t pick = gen() % mine.size();
+            if (!registry->remove(mine[pick]->id))
+                failed = true; // removing something we own must succeed
+            mine[pick]->alive = false;
+            mine[pick] = mine.back();
+            mine.pop_back();
+        }
+        (*ops)++;
+    }
+    for (auto &client : mine)
+        registry->remove(client->id);
+}
+
+/*
+Takes snapshots and "broadcasts" to every client in them
+@param registry the registry under test
+@param snaps incremented once per snapshot walked
+@param visits incremented once per client visited
+*/
+void broadcastThread(connectionRegistry<fakeClient> *registry, std::atomic<uint64_t> *snaps, std::atomic<uint64_t> *visits)
+{
+    std::unordered_set<uint64_t> seen;
+    while (!stopFlag)
+    {
+        seen.clear();
+        registry->take().forEach([&](const std::shared_ptr<fakeClient> &client) {
+            if (!seen.insert(client->id).second)
+                failed = true; // duplicate id in one snapshot
+            client->delivered++; // the snapshot keeps the client alive even if removed
+            (*visits)++;
+        });
+        (*snaps)++;
+    }
+}
+
+/*
+Opens a TCP connection to the server
+@param serv_addr resolved server address
+@return the socket, or -1
+*/
+int connectTo(const sockaddr_in &serv_addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (const sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+Churns real connections against a server while one client broadcasts
+@param seconds how long to run
+@param host server host
+@param port server port
+*/
+void serverStress(int seconds, const char *host, int port)
+{
+    // resolve once, gethostbyname is not thread safe
+    hostent *server = gethostbyname(host);
+    if (server == NULL)
+    {
+        fprintf(stderr, "ERROR, no such host\n");
+        exit(1);
+    }
+    sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    memmove(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    serv_addr.sin_port = htons(port);
+
+    std::atomic<uint64_t> connects{0}, broadcasts{0}, refused{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&]() {
+            while (!stopFlag)
+            {
+                int fd = connectTo(serv_addr);
+                if (fd < 0)
+                {
+                    refused++;
+                    continue;
+                }
+                connects++;
+                close(fd);
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        int fd = connectTo(serv_addr);
+        if (fd < 0)
+        {
+            failed = true;
+            return;
+        }
+        // a burst of broadcasts every millisecond, each one fans out to every client
+        std::string frame, burst;
+        encodeFrame('2', '0', "stress", 6, frame);
+        for (int i = 0; i < 4; i++)
+            burst += frame;
+        while (!stopFlag)
+        {
+            if (send(fd, burst.data(), burst.size(), 0) <= 0)
+            {
+                failed = true;
+                break;
+            }
+            broadcasts += 4;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        close(fd);
+    });
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stopFlag = true;
+    for (auto &t : threads)
+        t.join();
+    printf("server: %.0f connect+close/s, %.0f broadcasts/s, %llu refused\n",
+           (double)connects / seconds, (double)broadcasts / seconds, (unsigned long long)refused.load());
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = (argc > 1) ? atoi(argv[1]) : 3;
+    connectionRegistry<fakeClient> registry;
+    std::atomic<uint64_t> ops{0}, snaps{0}, visits{0};
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back(churnThread, &registry, 256, &ops);
+    for (int t = 0; t < 2; t++)
+        threads.emplace_back(broadcastThread, &registry, &snaps, &visits);
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stopFlag = true;
+    for (auto &t : threads)
+        t.join();
+
+    if (registry.size() != 0)
+        failed = true; // every churn thread removed what it inserted
+    printf("registry: %.0f insert/remove/s, %.0f snapshots/s, %.0f deliveries/s\n",
+           (double)ops / seconds, (double)snaps / seconds, (double)visits / seconds);
+
+    if (argc > 3)
+    {
+        stopFlag = false;
+        serverStress(seconds, argv[2], atoi(argv[3]));
+    }
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
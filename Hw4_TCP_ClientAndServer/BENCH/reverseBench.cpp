@@ -0,0 +1,189 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Benchmarks the nType '1' reverse path. First it checks the in-place
+reverse kernel (SERVER/TCP_Reverse.h) against the byte-pair loop for every length up
+to 300 and prints GB/s of both for a few payload sizes. When given a host and port it
+then sends type-1 requests to a running server, keeping up to depth requests in
+flight on one connection, and prints requests per second for each depth.
+
+Compiled with:
+    g++ -O2 -std=c++11 reverseBench.cpp -o reverseBench
+    g++ -O2 -std=c++11 -march=native reverseBench.cpp -o reverseBench
+Run with:
+    ./reverseBench
+    ./reverseBench <host> <port> [requests]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include "../TCP_Framing.h"
+#include "../SERVER/TCP_Reverse.h"
+
+#if defined(__AVX2__)
+const char *kernelName = "avx2";
+#elif defined(__SSSE3__)
+const char *kernelName = "ssse3";
+#elif defined(__SSE2__)
+const char *kernelName = "sse2";
+#elif defined(__ARM_NEON)
+const char *kernelName = "neon";
+#else
+const char *kernelName = "scalar";
+#endif
+
+// keeps the compiler from dropping the reversals
+volatile char sink;
+
+/*
+Times one reverse function over a buffer
+@param fn the function under test
+@param len buffer size in bytes
+@return GB/s reversed
+*/
+double timeKernel(void (*fn)(char *, size_t), size_t len)
+{
+    std::vector<char> buffer(len + 1, 'x');
+    size_t rounds = (size_t)(256 << 20) / len + 1;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        fn(buffer.data() + (r & 1), len); // alternate alignment
+        sink = buffer[len / 2];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return (double)rounds * len / seconds / 1e9;
+}
+
+/*
+Checks the kernel against the byte-pair loop
+@return true if every length matched
+*/
+bool checkKernel()
+{
+    for (size_t len = 0; len <= 300; len++)
+    {
+        std::string a(len, '\0');
+        for (size_t i = 0; i < len; i++)
+            a[i] = (char)(i * 7 + 1);
+        std::string b = a;
+        reverseInPlace(&a[0], len);
+        reverseInPlaceScalar(&b[0], len);
+        if (a != b)
+        {
+            printf("mismatch at length %zu\n", len);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Sends requests with up to depth of them in flight and waits for every reply
+@param fd connected socket
+@param requests number of type-1 requests
+@param depth requests sent before waiting for replies
+@return requests per second, or -1 if the server stopped answering
+*/
+double pipelined(int fd, int requests, int depth)
+{
+    std::string frame, burst;
+    encodeFrame('2', '1', "abcdefghijklmnopqrstuvwxyz0123456789", 36, frame);
+    for (int i = 0; i < depth; i++)
+        burst += frame;
+
+    frameDecoder decoder;
+    frameView reply;
+    char buffer[65536];
+    auto begin = std::chrono::steady_clock::now();
+    for (int done = 0; done < requests; )
+    {
+        if (send(fd, burst.data(), burst.size(), 0) != (ssize_t)burst.size())
+            return -1;
+        for (int got = 0; got < depth; )
+        {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+                return -1;
+            decoder.feed(buffer, n);
+            while (decoder.next(reply))
+            {
+                if (reply.nType != '1' || reply.len != 36 || reply.payload[0] != '9')
+                    return -1;
+                got++;
+            }
+        }
+        done += depth;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return requests / seconds;
+}
+
+/*
+Measures request throughput against a server for several pipeline depths
+@param host server host
+@param port server port
+@param requests requests per depth
+*/
+void serverRun(const char *host, int port, int requests)
+{
+    hostent *server = gethostbyname(host);
+    if (server == NULL)
+    {
+        fprintf(stderr, "ERROR, no such host\n");
+        exit(1);
+    }
+    sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    memmove(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    serv_addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    {
+        perror("ERROR connecting");
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    printf("depth  requests/s\n");
+    const int depths[] = {1, 4, 16, 64, 256};
+    for (int depth : depths)
+    {
+        double rate = pipelined(fd, requests - requests % depth, depth);
+        if (rate < 0)
+        {
+            fprintf(stderr, "ERROR, bad or missing reply\n");
+            exit(1);
+        }
+        printf("%-6d %.0f\n", depth, rate);
+    }
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    if (!checkKernel())
+        return 1;
+    printf("kernel: %s\n", kernelName);
+    printf("bytes    scalar GB/s  kernel GB/s\n");
+    const size_t sizes[] = {16, 64, 256, 1000, 4096, 65536};
+    for (size_t len : sizes)
+        printf("%-8zu %-12.2f %.2f\n", len, timeKernel(reverseInPlaceScalar, len), timeKernel(reverseInPlace, len));
+
+    if (argc > 2)
+        serverRun(argv[1], atoi(argv[2]), (argc > 3) ? atoi(argv[3]) : 200000);
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Compares the loopback TCP path with the shared-memory rings
+(TCP_SharedRing.h) against a running server on the same host. For each transport
+it measures type-1 round trips one at a time (latency percentiles) and pipelined
+with a window of requests in flight (throughput), plus the CPU time spent per
+message by this process and, given the server's pid, by the server.
+
+Compiled with:
+    g++ -O2 -std=c++11 shmBench.cpp -o shmBench
+Run with:
+    ./shmBench <host> <port> [--round-trips n] [--messages n] [--window n] [--server-pid pid]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include "../TCP_Framing.h"
+#include "../TCP_SharedRing.h"
+
+// a connection to the server over TCP or, after the handshake, shared memory
+struct transport
+{
+    int fd = -1;
+    std::shared_ptr<shmChannel> channel;   // set for the shared-memory transport
+    frameDecoder decoder;
+
+    void sendBytes(const std::string &bytes)
+    {
+        if (channel)
+        {
+            if (!channel->toServer.write(bytes.data(), bytes.size()))
+                fail("ERROR, shared-memory channel closed");
+            return;
+        }
+        for (size_t sent = 0; sent < bytes.size(); )
+        {
+            ssize_t n = send(fd, bytes.data() + sent, bytes.size() - sent, 0);
+            if (n <= 0)
+                fail("ERROR writing to socket");
+            sent += n;
+        }
+    }
+
+    // waits for more bytes and feeds them to the decoder
+    void receive()
+    {
+        char buffer[65536];
+        long n = channel ? channel->toClient.read(buffer, sizeof(buffer), 5000)
+                         : (long)recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            fail("ERROR, no reply from the server");
+        decoder.feed(buffer, n);
+    }
+
+    static void fail(const char *msg)
+    {
+        fprintf(stderr, "%s\n", msg);
+        exit(1);
+    }
+};
+
+/*
+Opens a TCP connection with Nagle disabled
+@param host server host
+@param port server port
+@return the socket, exits on failure
+*/
+int openConnection(const char *host, int port)
+{
+    hostent *server = gethostbyname(host);
+    if (server == NULL)
+        transport::fail("ERROR, no such host");
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    memmove(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr *)&addr, sizeof(addr)) < 0)
+        transport::fail("ERROR connecting");
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+/*
+Moves a connection to a new shared-memory segment
+@param conn a TCP transport
+*/
+void handshake(transport &conn)
+{
+    std::shared_ptr<shmChannel> channel = shmChannel::create();
+    if (!channel)
+        transport::fail("ERROR creating shared memory");
+    std::string out;
+    const std::string &name = channel->segmentName();
+    encodeFrame('2', shmHandshakeType, name.data(), name.size(), out);
+    conn.sendBytes(out); // the handshake and its answer go over TCP
+    frameView reply;
+    while (!conn.decoder.next(reply) || reply.nType != shmHandshakeType)
+        conn.receive();
+    channel->unlinkName();
+    if (std::string(reply.payload, reply.len) != "ok")
+        transport::fail("ERROR, the server refused shared memory");
+    conn.channel = channel;
+}
+
+// CPU seconds used so far by this process
+double ownCpu()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// CPU seconds used so far by another process, 0 if unknown
+double processCpu(int pid)
+{
+    if (pid <= 0)
+        return 0;
+    FILE *stat = fopen(("/proc/" + std::to_string(pid) + "/stat").c_str(), "r");
+    if (stat == NULL)
+        return 0;
+    unsigned long utime = 0, stime = 0;
+    // skip pid, comm and the 11 fields before utime; comm has no spaces for this server
+    if (fscanf(stat, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        utime = stime = 0;
+    fclose(stat);
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// what one measurement produced
+struct result
+{
+    double seconds = 0;
+    double clientCpu = 0, serverCpu = 0;
+    std::vector<double> latencies;   // microseconds, round-trip runs only
+};
+
+/*
+Sends requests and waits for their replies, at most window in flight
+@param conn the transport
+@param messages number of type-1 requests
+@param window requests in flight, 1 for round trips
+@param serverPid pid to read the server's CPU time from, 0 if unknown
+*/
+result measure(transport &conn, int messages, int window, int serverPid)
+{
+    std::string request;
+    encodeFrame('2', '1', "abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz01", 64, request);
+    std::string burst;
+    for (int i = 0; i < window; i++)
+        burst += request;
+
+    result r;
+    if (window == 1)
+        r.latencies.reserve(messages);
+    double clientStart = ownCpu(), serverStart = processCpu(serverPid);
+    auto begin = std::chrono::steady_clock::now();
+    frameView reply;
+    for (int done = 0; done < messages; done += window)
+    {
+        auto sent = std::chrono::steady_clock::now();
+        conn.sendBytes(burst);
+        for (int got = 0; got < window; )
+        {
+            while (got < window && conn.decoder.next(reply))
+                got++;
+            if (got < window)
+                conn.receive();
+        }
+        if (window == 1)
+            r.latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+    }
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    r.clientCpu = ownCpu() - clientStart;
+    r.serverCpu = processCpu(serverPid) - serverStart;
+    return r;
+}
+
+double percentile(std::vector<double> &values, double q)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(q * (values.size() - 1))];
+}
+
+/*
+Runs the round-trip and pipelined measurements on one transport and prints them
+*/
+void run(const char *name, transport &conn, int roundTrips, int messages, int window, int serverPid)
+{
+    measure(conn, 1000, 1, 0); // warm up both sides
+    result single = measure(conn, roundTrips, 1, serverPid);
+    printf("%-6s round trip  p50 %7.1f us  p99 %7.1f us  cpu/msg client %5.2f us server %5.2f us\n", name,
+           percentile(single.latencies, 0.5), percentile(single.latencies, 0.99),
+           single.clientCpu * 1e6 / roundTrips, single.serverCpu * 1e6 / roundTrips);
+    result piped = measure(conn, messages, window, serverPid);
+    printf("%-6s window %-4d %9.0f msgs/s           cpu/msg client %5.2f us server %5.2f us\n", name, window,
+           messages / piped.seconds, piped.clientCpu * 1e6 / messages, piped.serverCpu * 1e6 / messages);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage %s host port [--round-trips n] [--messages n] [--window n] [--server-pid pid]\n", argv[0]);
+        exit(1);
+    }
+    int roundTrips = 20000, messages = 500000, window = 64, serverPid = 0;
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        std::string name = argv[i];
+        int value = atoi(argv[i + 1]);
+        if (name == "--round-trips") roundTrips = value;
+        else if (name == "--messages") messages = value;
+        else if (name == "--window") window = value;
+        else if (name == "--server-pid") serverPid = value;
+    }
+    if (roundTrips < 1 || window < 1 || messages < window)
+        transport::fail("ERROR, bad counts");
+    messages -= messages % window;
+
+    transport tcp;
+    tcp.fd = openConnection(argv[1], atoi(argv[2]));
+    run("tcp", tcp, roundTrips, messages, window, serverPid);
+
+    transport shm;
+    shm.fd = openConnection(argv[1], atoi(argv[2]));
+    handshake(shm);
+    run("shm", shm, roundTrips, messages, window, serverPid);
+
+    shm.channel->close();
+    close(shm.fd);
+    close(tcp.fd);
+    return 0;
+}
@@ -4,6 +4,19 @@ Class: ECE4122
 Last Date Modified: 11/1/2019
 Description: Creates a TCP client that can connect with a server and 
 send/receive packages while interacting with user, and constructing the messages.
+A single poll loop handles the keyboard, the socket's reads and its writes, so
+the client sleeps while nothing happens.
+
+Run with:
+    ./client <host> <port>
+    ./client <host> <port> --batch <file> [--repeat <n>] [--quiet] [--timeout <s>]
+    add --shm on the server's host to exchange messages through shared memory (Linux only)
+    add --compress to ask the server for compressed broadcasts (version '3' frames)
+In batch mode the commands in the file ("v <version>", "t <type> <message>") are sent
+pipelined, --repeat times over, and the client exits once every type 1 request has
+been answered, printing the throughput.
+Channels: "t 3 <channel>" subscribes, "t 4 <channel>" unsubscribes and
+"t 5 <channel> <message>" publishes to the channel's subscribers.
 */
 
 /*
@@ -15,10 +28,10 @@ send/receive packages while interacting with user, and constructing the messages
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h> 
+#include <chrono>
+#include <fstream>
 #include <iostream>
-#include <thread>
-#include <atomic>
-#include <vector>
+#include <string>
 
 #ifdef _WIN32
    /* See http://stackoverflow.com/questions/12765743/getaddrinfo-on-win32 */
@@ -30,24 +43,42 @@ send/receive packages while interacting with user, and constructing the messages
 #include <ws2tcpip.h>
 
 #pragma comment (lib, "Ws2_32.lib")
+#define poll WSAPoll /* sockets only, so interactive input needs a POSIX console */
 #else
    /* Assume that any non-Windows platform uses POSIX-style sockets instead. */
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>  /* Needed for getaddrinfo() and freeaddrinfo() */
 #include <unistd.h> /* Needed for close() */
+#include <fcntl.h>  /* Needed for O_NONBLOCK */
+#include <poll.h>   /* Needed for poll() */
+#include <errno.h>
 
 typedef int SOCKET;
 #endif
 
-// structure defining the message transmitted
-typedef struct tcpMessage
+#include "../TCP_Framing.h"
+#include "../TCP_SharedRing.h"
+
+#ifdef __linux__
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// the shared-memory transport: writes go into the ring, a thread reads the other ring
+// and hands the bytes to the poll loop through a pipe
+struct shmLink
 {
-    unsigned char nVersion;  
-    unsigned char nType;
-    unsigned short nMsgLen;  
-    char chMsg[1000];
-} tcpMessage;
+    std::shared_ptr<shmChannel> channel;
+    int wakeFds[2] = {-1, -1};      // the reader writes one byte when inBuf becomes non-empty
+    std::mutex lock;                // guards inBuf
+    std::string inBuf;              // bytes read from the ring, not yet decoded
+    std::atomic<bool> woken{false}; // a wake-up byte is in the pipe
+    std::atomic<bool> closed{false};
+    std::thread reader;
+};
+#endif
 
 int sockInit(void)
 {
@@ -93,8 +124,34 @@ int sockClose(SOCKET sock)
 
 }
 
-// atomic flag to indicate the closure of client socket
-std::atomic<bool> clientquitFlag{false};
+// everything the event loop knows about the session
+struct clientState
+{
+    int sockfd;
+    // version stamped on outgoing messages; '2' selects the compact length-prefixed
+    // frame, anything else is sent as a whole tcpMessage
+    unsigned char nVersion = 0;
+    std::string outBuf;          // encoded messages not yet accepted by the socket
+    size_t outOff = 0;           // bytes of outBuf already sent
+    frameDecoder decoder;        // reassembles whole messages from however the bytes arrive
+    std::string lineBuf;         // keyboard input not yet ended by a newline
+    bool interactive = true;     // commands come from stdin
+    bool quiet = false;          // do not print received messages
+    bool quit = false;
+#ifdef __linux__
+    std::unique_ptr<shmLink> shm; // set once the server accepted shared memory
+#endif
+
+    // batch mode
+    std::string round;           // the batch file, encoded once
+    uint64_t roundMessages = 0;  // messages in one round
+    uint64_t roundReplies = 0;   // type 1 requests in one round
+    long roundsLeft = 0;         // rounds not yet queued
+    uint64_t sent = 0, expected = 0, received = 0;
+};
+
+// batch mode tops outBuf up to this many unsent bytes
+const size_t batchWindow = 1 << 20;
 
 void error(const char *msg)
 {
@@ -104,81 +161,404 @@ void error(const char *msg)
 }
 
 /*
-The thread responsible for constructing and sending the message to the server
-@param sockfd the file descriptor for the socket that this client is sitting on
+Applies one user or batch command
+@param state the session
+@param command "v <version>", "t <type> <message>" or "q"
 */
-void sendThread(int sockfd) {
-    int n; // return value from the send() function call
-    // command from user input
-    std::string command;
-    // instance of tcpMessage to hold the data to send
-    tcpMessage *msgStruct = (tcpMessage*)calloc(1,sizeof(tcpMessage));
-
-    // do this while client is not closed (prompted to or server closed)
-    while (!clientquitFlag){
-        // initialize the message to all zeros
-        memset(msgStruct->chMsg,0,1000);
-        // get user input
-        std::cout << "Please enter command: ";
-        std::getline (std::cin,command);
-        if (command[0] == 'v') // get version #
-        {
-            msgStruct->nVersion = command[2];
-        } else if (command[0] == 't') // get type # and prepare to send
+void handleCommand(clientState &state, const std::string &command)
+{
+    if (command.size() >= 3 && command[0] == 'v') // get version #
+    {
+        state.nVersion = command[2];
+    } else if (command[0] == 't' && command.size() >= 4) // get type # and queue the message
+    {
+        // the message starts from the index 4 of the command
+        encodeFrame(state.nVersion, command[2], command.c_str() + 4, command.size() - 4, state.outBuf);
+        state.sent++;
+        if (command[2] == '1')
+            state.expected++;
+    } else if (command == "q") // quit the client, time to close the socket
+        state.quit = true;
+}
+
+/*
+Writes as much of outBuf as the socket accepts without blocking
+@param state the session
+*/
+void flushOut(clientState &state)
+{
+#ifdef __linux__
+    if (state.shm)
+    {
+        // the ring only waits while the server is behind, never on our own reader
+        if (!state.shm->channel->toServer.write(state.outBuf.data() + state.outOff, state.outBuf.size() - state.outOff))
+            state.quit = true;
+        state.outBuf.clear();
+        state.outOff = 0;
+        return;
+    }
+#endif
+    while (state.outOff < state.outBuf.size())
+    {
+        int n = send(state.sockfd, state.outBuf.data() + state.outOff, state.outBuf.size() - state.outOff, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0)
+            error("ERROR writing to socket");
+        state.outOff += n;
+    }
+    if (state.outOff == state.outBuf.size())
+    {
+        state.outBuf.clear();
+        state.outOff = 0;
+    } else if (state.outOff > batchWindow)
+    {
+        state.outBuf.erase(0, state.outOff);
+        state.outOff = 0;
+    }
+}
+
+/*
+Displays every complete message received so far
+@param state the session
+*/
+void handleFrames(clientState &state)
+{
+    tcpFrame frame;
+    while (state.decoder.next(frame))
+    {
+        if (frame.nType == '1')
+            state.received++;
+        if (!state.quiet)
+            std::cout<<"\n"<<"Received Msg Type: "<<frame.nType<<";"<<" Msg: "<<frame.payload<<std::endl; 
+    }
+    if (state.decoder.failed())
+    {
+        fprintf(stderr, "ERROR, corrupt message from server\n");
+        state.quit = true;
+    }
+}
+
+/*
+Reads everything the server sent so far and displays the messages
+@param state the session, quit is set when the server closes the connection
+*/
+void readSocket(clientState &state)
+{
+    const size_t chunk = 65536;
+    for (;;)
+    {
+        int n = recv(state.sockfd, state.decoder.prepare(chunk), chunk, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n < 0)
+            error("ERROR reading from socket");
+        if (n == 0)
         {
-            msgStruct->nType = command[2];
-            // get the message which starts from the index 4 of the command
-            memcpy(msgStruct->chMsg, command.c_str() + 4, command.size() - 4);
-            msgStruct->nMsgLen = command.length() - 4; // actual message length
-            msgStruct->chMsg[msgStruct->nMsgLen] = 0; // end with endline 
-            n = send(sockfd, msgStruct, sizeof(tcpMessage), 0); // send to server
-            if (n < 0)
-                error("ERROR writing to socket");
-        } else if (command == "q") // quit the client, time to close the socket
-            clientquitFlag = true;
+            state.quit = true;
+            return;
+        }
+        state.decoder.commit(n);
+        handleFrames(state);
     }
 }
 
+#ifdef __linux__
 /*
-The thread responsible for the messages received from the server and displaying them
-@param sockfd the file descriptor for the socket that this client is sitting on
+The thread reading the server's ring; it only wakes the poll loop when the loop
+has taken everything handed over before
+@param link the shared-memory transport
 */
-void recThread(int sockfd) {
-    // instance of tcpMessage to hold the data to receive
-    tcpMessage *msgStructCli = (tcpMessage*)calloc(1,sizeof(tcpMessage));
-    memset(msgStructCli->chMsg,0,1000);
-    int n;
-    while (!clientquitFlag){
-        n = recv(sockfd, msgStructCli, sizeof(tcpMessage), 0);
+void shmReader(shmLink *link)
+{
+    char buffer[65536];
+    for (;;)
+    {
+        long n = link->channel->toClient.read(buffer, sizeof(buffer), 1000);
         if (n < 0)
+            break;
+        if (n == 0)
+            continue;
+        {
+            std::lock_guard<std::mutex> guard(link->lock);
+            link->inBuf.append(buffer, n);
+        }
+        if (!link->woken.exchange(true))
+        {
+            char one = 1;
+            if (write(link->wakeFds[1], &one, 1) < 0)
+                break;
+        }
+    }
+    link->closed = true;
+    char one = 1;
+    if (write(link->wakeFds[1], &one, 1) < 0)
+        return; // the loop also notices the TCP connection closing
+}
+
+/*
+Takes what the ring reader handed over and displays the messages
+@param state the session, quit is set when the shared-memory session ends
+*/
+void readShm(clientState &state)
+{
+    shmLink &link = *state.shm;
+    char drain[64];
+    if (read(link.wakeFds[0], drain, sizeof(drain)) < 0 && errno != EAGAIN)
+        error("ERROR reading from pipe");
+    link.woken = false; // cleared before taking, so a later append wakes us again
+    std::string bytes;
+    {
+        std::lock_guard<std::mutex> guard(link.lock);
+        bytes.swap(link.inBuf);
+    }
+    state.decoder.feed(bytes.data(), bytes.size());
+    handleFrames(state);
+    if (link.closed)
+        state.quit = true;
+}
+
+/*
+Asks the server to move the session to a new shared-memory segment. Runs before
+the socket turns non-blocking; the request and the answer go over TCP.
+@param state the session, shm is set if the server agreed
+@return false if shared memory is unavailable, the session stays on TCP
+*/
+bool startShm(clientState &state)
+{
+    std::shared_ptr<shmChannel> channel = shmChannel::create();
+    if (!channel)
+        return false;
+    std::string out;
+    const std::string &name = channel->segmentName();
+    encodeFrame('2', shmHandshakeType, name.data(), name.size(), out);
+    if (send(state.sockfd, out.data(), out.size(), 0) != (ssize_t)out.size())
+        error("ERROR writing to socket");
+    char buffer[256];
+    tcpFrame frame;
+    while (!state.decoder.next(frame) || frame.nType != shmHandshakeType)
+    {
+        int n = recv(state.sockfd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
             error("ERROR reading from socket");
-        if (n == 0) {
-            clientquitFlag = true;
-        } else {
-            std::cout<<"\n"<<"Received Msg Type: "<<msgStructCli->nType<<";"<<" Msg: "<<msgStructCli->chMsg<<std::endl; 
+        state.decoder.feed(buffer, n);
+    }
+    channel->unlinkName(); // mapped by both sides now, or refused
+    if (frame.payload != "ok")
+        return false;
+    std::unique_ptr<shmLink> link(new shmLink);
+    link->channel = channel;
+    if (pipe(link->wakeFds) < 0)
+        error("ERROR creating pipe");
+    fcntl(link->wakeFds[0], F_SETFL, fcntl(link->wakeFds[0], F_GETFL) | O_NONBLOCK);
+    link->reader = std::thread(shmReader, link.get());
+    state.shm = std::move(link);
+    return true;
+}
+
+// ends the shared-memory session and waits for the ring reader
+void stopShm(clientState &state)
+{
+    if (!state.shm)
+        return;
+    state.shm->channel->close();
+    state.shm->reader.join();
+    close(state.shm->wakeFds[0]);
+    close(state.shm->wakeFds[1]);
+    state.shm.reset();
+}
+#endif
+
+/*
+Reads what was typed and runs every complete line
+@param state the session, stdin EOF counts as q
+*/
+void readStdin(clientState &state)
+{
+    char buffer[4096];
+    int n = read(0, buffer, sizeof(buffer));
+    if (n <= 0)
+    {
+        if (n < 0 && errno == EINTR)
+            return;
+        state.quit = true; // keyboard closed
+        return;
+    }
+    state.lineBuf.append(buffer, n);
+    size_t start = 0, end;
+    while (!state.quit && (end = state.lineBuf.find('\n', start)) != std::string::npos)
+    {
+        std::string command = state.lineBuf.substr(start, end - start);
+        if (!command.empty() && command.back() == '\r')
+            command.pop_back();
+        if (!command.empty())
+            handleCommand(state, command);
+        start = end + 1;
+        if (!state.quit)
+            std::cout << "Please enter command: " << std::flush;
+    }
+    state.lineBuf.erase(0, start);
+}
+
+/*
+Encodes a batch file once so it can be queued any number of times. What outBuf
+already holds, such as the compression handshake, stays there and is sent once.
+@param state the session, round and its counts are filled
+@param path file with one command per line
+@return false if the file could not be read
+*/
+bool loadBatch(clientState &state, const char *path)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    std::string pending, command;
+    pending.swap(state.outBuf);
+    while (std::getline(file, command) && !state.quit)
+    {
+        if (!command.empty() && command.back() == '\r')
+            command.pop_back();
+        if (!command.empty())
+            handleCommand(state, command);
+    }
+    state.quit = false; // a q ends the batch, not the session
+    state.round.swap(state.outBuf);
+    state.outBuf.swap(pending);
+    state.roundMessages = state.sent;
+    state.roundReplies = state.expected;
+    state.sent = state.expected = 0;
+    return true;
+}
+
+/*
+The event loop: sleeps in poll until the keyboard or the socket needs attention
+@param state the session
+@param timeoutMs batch mode gives up after this long without progress
+@return 0 when done, 1 if batch mode timed out
+*/
+int runLoop(clientState &state, int timeoutMs)
+{
+    if (state.interactive)
+        std::cout << "Please enter command: " << std::flush;
+    while (!state.quit)
+    {
+        // keep the socket fed with rounds without holding the whole batch in memory
+        while (state.roundsLeft > 0 && state.outBuf.size() - state.outOff < batchWindow)
+        {
+            state.outBuf += state.round;
+            state.sent += state.roundMessages;
+            state.expected += state.roundReplies;
+            state.roundsLeft--;
+        }
+        if (!state.interactive && state.roundsLeft == 0 && state.outBuf.empty() && state.received >= state.expected)
+            break; // every message is out and every reply is in
+
+        pollfd fds[3];
+        int count = 1;
+        fds[0].fd = state.sockfd;
+        fds[0].events = POLLIN | (state.outBuf.empty() ? 0 : POLLOUT);
+        fds[0].revents = 0;
+        if (state.interactive)
+        {
+            fds[1].fd = 0;
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+            count = 2;
+        }
+        int shmSlot = -1;
+#ifdef __linux__
+        if (state.shm)
+        {
+            if (!state.outBuf.empty())
+            {
+                flushOut(state); // the ring takes it all, there is no POLLOUT to wait for
+                continue;
+            }
+            fds[0].events = POLLIN; // only the server closing the connection arrives on TCP
+            shmSlot = count++;
+            fds[shmSlot].fd = state.shm->wakeFds[0];
+            fds[shmSlot].events = POLLIN;
+            fds[shmSlot].revents = 0;
+        }
+#endif
+        int n = poll(fds, count, state.interactive ? -1 : timeoutMs);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            error("ERROR on poll");
+        if (n == 0)
+        {
+            fprintf(stderr, "ERROR, no progress for %d ms, %llu of %llu replies received\n", timeoutMs,
+                    (unsigned long long)state.received, (unsigned long long)state.expected);
+            return 1;
         }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+            readSocket(state);
+        if (state.interactive && (fds[1].revents & (POLLIN | POLLHUP)))
+            readStdin(state);
+#ifdef __linux__
+        if (shmSlot >= 0 && (fds[shmSlot].revents & POLLIN))
+            readShm(state);
+#endif
+        if (!state.outBuf.empty())
+            flushOut(state); // also sends what a command just queued
     }
+    return 0;
 }
 
 /*
-Main entry for the program. Starts the sendThread and recThread .
-Main thread setting up the connection. After setup, all processing happens inside
-the other threads.
+Main entry for the program. Connects to the server and runs the event loop,
+interactively or from a batch file.
 @param ipAddress command line argument, IP address of the server to connect to
 @param portNumber command line argument specifying the server's port number
+@param --batch optional, file of commands sent pipelined instead of reading the keyboard
+@param --repeat optional, number of times the batch file is sent (default 1)
+@param --quiet optional, do not print received messages
+@param --timeout optional, seconds batch mode waits without progress (default 10)
+@param --shm optional, move the session to shared memory when the server is on this host
+@param --compress optional, ask the server to compress the broadcasts it sends
 */
 int main(int argc, char *argv[])
 {
     int sockfd, portno;
     struct sockaddr_in serv_addr;
     struct hostent *server;
-    
-    int n;
+    clientState state;
+    const char *batchFile = NULL;
+    long repeat = 1;
+    int timeoutMs = 10000;
+    bool useShm = false;
+    bool useCompression = false;
     
     if (argc < 3) {
-        fprintf(stderr, "usage %s hostname port\n", argv[0]);
+        fprintf(stderr, "usage %s hostname port [--batch file] [--repeat n] [--quiet] [--timeout s] [--shm] [--compress]\n", argv[0]);
         exit(0);
     }
+    for (int i = 3; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--batch" && i + 1 < argc)
+            batchFile = argv[++i];
+        else if (option == "--repeat" && i + 1 < argc)
+            repeat = atol(argv[++i]);
+        else if (option == "--quiet")
+            state.quiet = true;
+        else if (option == "--timeout" && i + 1 < argc)
+            timeoutMs = atoi(argv[++i]) * 1000;
+        else if (option == "--shm")
+            useShm = true;
+        else if (option == "--compress")
+            useCompression = true;
+        else
+        {
+            fprintf(stderr, "ERROR, unknown option %s\n", argv[i]);
+            exit(0);
+        }
+    }
     
     sockInit();
     // Convert string to int
@@ -208,23 +588,56 @@ int main(int argc, char *argv[])
     // connect with the server
     if (connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
         error("ERROR connecting");
-    
+    state.sockfd = sockfd;
 
-    // start the threads
-    std::thread tsend(sendThread, sockfd);
-    tsend.detach();
-    std::thread trecv(recThread, sockfd);
-    trecv.detach();
+    if (useShm)
+    {
+#ifdef __linux__
+        if (!startShm(state))
+#endif
+            fprintf(stderr, "Shared memory unavailable, staying on TCP\n");
+    }
+    if (useCompression)
+    {
+        // sent ahead of everything else; the answer, "lz1" or "none", is displayed like
+        // any message and version '3' frames are expanded by the decoder either way
+        encodeFrame('2', compressHandshakeType, compressionName, strlen(compressionName), state.outBuf);
+    }
+
+    // the loop never blocks on the socket, it waits in poll instead
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(sockfd, FIONBIO, &on);
+#else
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+#endif
 
-    while (!clientquitFlag) {
-        
+    int status = 0;
+    if (batchFile != NULL)
+    {
+        state.interactive = false;
+        if (!loadBatch(state, batchFile))
+            error("ERROR opening batch file");
+        state.roundsLeft = repeat;
+        auto begin = std::chrono::steady_clock::now();
+        status = runLoop(state, timeoutMs);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printf("Sent %llu messages, received %llu of %llu replies in %.3f s (%.0f msgs/s)\n",
+               (unsigned long long)state.sent, (unsigned long long)state.received,
+               (unsigned long long)state.expected, seconds, state.sent / seconds);
+    } else
+    {
+        status = runLoop(state, timeoutMs);
+        flushOut(state); // whatever was typed before q
     }
-    clientquitFlag = true; //necessary for graceful exit
+#ifdef __linux__
+    stopShm(state);
+#endif
     sockClose(sockfd);
     sockQuit();
 
 #ifdef _WIN32
     std::cin.get();
 #endif
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
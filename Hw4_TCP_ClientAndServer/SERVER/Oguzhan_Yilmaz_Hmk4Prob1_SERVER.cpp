@@ -5,7 +5,45 @@ Last Date Modified: 11/1/2019
 Description: Creates a TCP server that can connect with multiple clients and 
 send/receive packages while responding to user prompts such as displaying
 last message received, closing all sockets and the connection, and displaying 
-information about client connections.
+information about client connections and the server's live counters (command 3).
+
+Message types: '0' goes to every other client, '1' is answered with the payload
+reversed, '3' <channel> subscribes to a channel, '4' <channel> unsubscribes, and
+'5' <channel> <message> publishes to the channel's subscribers only. '6' <segment>
+moves a client on the same host to shared-memory rings (TCP_SharedRing.h, Linux
+only); messages that arrive on TCP together with the '6' are still handled, in order,
+but a client that sends more on TCP after that is disconnected. '8' lz1 asks for compressed broadcasts (TCP_Compression.h): the server answers
+'8' lz1 and from then on sends that client's '0' and '5' messages as version '3'
+frames whenever that makes them smaller, or answers '8' none. Anything else is only
+stored in the history.
+
+Run with:
+    ./server <port> [options]
+    --reactor [loops]              epoll event loops instead of a thread per client (Linux only)
+    --uring [loops]                io_uring loops, falls back to --reactor without io_uring
+    --queue <messages>             outbound queue capacity per client (default 1024)
+    --slow drop|disconnect|block   what to do when a client's queue is full (default drop);
+                                   block waits in the sender's thread, so not with --reactor or --uring
+    --history <messages>           messages kept for commands 0 and 2 (default 10000)
+    --history-bytes <bytes>        payload bytes kept for commands 0 and 2 (default 16 MiB)
+    --history-log <directory>      also append messages to a segment log and replay it on start
+    --metrics-port <port>          serve the counters of command 3 as text on 127.0.0.1:<port>
+    --shards <n>                   run n server processes sharing the port (Linux only)
+    --shard-dir <directory>        where the shards' Unix sockets live (default /tmp)
+    --drain <ms>                   how long quitting waits for clients to be flushed (default 5000)
+    --handoff <path>               let a new server take the listening sockets over <path> (Linux only)
+    --takeover <path>              start on the listening sockets of the server at <path> (Linux only)
+With --shards the console, shard 0, forks shards 1..n-1. Each shard has its own
+clients; broadcasts, publishes and history are relayed to every other shard, so a
+type 0 message reaches clients on all of them. Shard i serves metrics on
+<port> + i and logs history to <directory>/shard-<i>.
+
+Quitting ("q", SIGTERM or SIGINT) stops accepting, sends every client a type '7'
+close notice behind what is already queued for it, waits until the queues are
+written (at most --drain ms), half-closes the connections and waits for the client
+threads. For a restart without refused connections, start the new server with
+--takeover <path> while the old one runs with --handoff <path>; the old server then
+drains and exits on its own.
 */
 
 /* 
@@ -18,9 +56,15 @@ information about client connections.
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h> 
+#include <cstring>
 #include <iostream>
+#include <algorithm>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 
@@ -33,15 +77,42 @@ information about client connections.
     #include <Ws2tcpip.h>
 
     #pragma comment (lib, "Ws2_32.lib")
+    #define poll WSAPoll
 #else
    /* Assume that any non-Windows platform uses POSIX-style sockets instead. */
     #include <sys/socket.h>
     #include <arpa/inet.h>
+    #include <netinet/tcp.h> /* Needed for TCP_NODELAY */
     #include <netdb.h>  /* Needed for getaddrinfo() and freeaddrinfo() */
     #include <unistd.h> /* Needed for close() */
+    #include <signal.h> /* Needed to ignore SIGPIPE from writev */
+    #include <fcntl.h>  /* Needed for open() */
+    #include <sys/stat.h> /* Needed for mkdir() */
+    #include <sys/wait.h> /* Needed for waitpid() */
+    #include <poll.h>     /* Needed for poll() */
 
     typedef int SOCKET;
 #endif
+
+#include "../TCP_Framing.h"
+#include "../TCP_SharedRing.h"
+#include "TCP_Broadcast.h"
+#include "TCP_Channels.h"
+#include "TCP_Registry.h"
+#include "TCP_History.h"
+#include "TCP_Lifecycle.h"
+#include "TCP_Metrics.h"
+#include "TCP_Reverse.h"
+
+#ifdef __linux__
+    #include <sys/prctl.h> /* Needed for PR_SET_PDEATHSIG */
+    #include "TCP_Reactor.h"
+    #include "TCP_Shards.h"
+    #include "TCP_Uring.h"
+#else
+    struct reactorConnection;
+    typedef std::shared_ptr<reactorConnection> connectionPtr;
+#endif
 /////////////////////////////////////////////////
 // Cross-platform socket initialize
 int sockInit(void)
@@ -70,41 +141,105 @@ int sockClose(SOCKET sock)
 
     int status = 0;
 
+    // shutdown fails if the peer or a writer already shut the socket down, but the
+    // descriptor still has to be released
 #ifdef _WIN32
-    status = shutdown(sock, SD_BOTH);
-    if (status == 0) 
-    {
-        status = closesocket(sock); 
-    }
+    shutdown(sock, SD_BOTH);
+    status = closesocket(sock); 
 #else
-    status = shutdown(sock, SHUT_RDWR);
-    if (status == 0) 
-    { 
-        status = close(sock);
-    }
+    shutdown(sock, SHUT_RDWR);
+    status = close(sock);
 #endif
 
     return status;
 
 }
+/////////////////////////////////////////////////
+// Cross-platform switch between blocking and non-blocking mode
+void sockSetBlocking(SOCKET sock, bool blocking)
+{
+#ifdef _WIN32
+    u_long nonBlocking = blocking ? 0 : 1;
+    ioctlsocket(sock, FIONBIO, &nonBlocking);
+#else
+    int flags = fcntl(sock, F_GETFL);
+    fcntl(sock, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
 
-// structure defining the message transmitted
-typedef struct tcpMessage
+#ifdef __linux__
+// a client's shared-memory session, kept alive by the client and its two threads
+struct shmSession
 {
-    unsigned char nVersion;  
-    unsigned char nType;
-    unsigned short nMsgLen;  
-    char chMsg[1000];
-} tcpMessage;
+    std::shared_ptr<shmChannel> channel;
+    std::shared_ptr<outboundQueue> outbound;   // drained into channel->toClient
+    std::mutex lock;                           // guards tcpClosed
+    bool tcpClosed = false;                    // the TCP socket may be closed any moment
+    bool started = false;                      // ring threads running, set by the TCP reader
+
+    // ends the session because the TCP connection is going away
+    void closeFromTcp()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tcpClosed = true;
+        }
+        channel->close();
+        outbound->close();
+    }
+
+    /*
+    Ends the TCP connection because the session ended, unless it is already gone
+    @param conn the reactor connection, if a reactor serves the client
+    @param fd the client socket otherwise
+    */
+    void closeTcp(const connectionPtr &conn, int fd)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (tcpClosed)
+            return;
+        if (conn)
+        {
+            std::lock_guard<std::mutex> connGuard(conn->outLock);
+            if (!conn->closed)
+                shutdown(conn->fd, SHUT_RDWR);
+        } else
+        {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+};
+#endif
+
 
 // struct to hold info about connected sockets
 typedef struct socketInfo 
 {
+    uint64_t id = 0; // stable id assigned by the registry
     int storedSockfd;
     int portno;
-    const char* ipaddress;
+    char ipaddress[INET_ADDRSTRLEN];
+    connectionPtr conn; // set when the client is served by the reactor
+    std::shared_ptr<outboundQueue> outbound; // frames waiting to be sent to the client
+    // wire version of the last message received from the client, replies use it
+    std::atomic<unsigned char> peerVersion{'1'};
+    // channels the client subscribed to, only touched by the thread reading its messages
+    std::vector<std::string> channels;
+    // set once the client moved to shared memory (nType 6), never cleared
+    std::atomic<bool> usesShm{false};
+    // set once the client asked for compressed broadcasts (nType 8), never cleared
+    std::atomic<bool> compress{false};
+#ifdef __linux__
+    std::shared_ptr<shmSession> shm; // written before usesShm is set
+#endif
+    // thread-per-client mode: set under closeLock before storedSockfd is closed,
+    // so shutdown never reaches a descriptor number that was reused
+    mutable std::mutex closeLock;
+    bool socketClosed = false;
 } socketInfo;
 
+typedef std::shared_ptr<socketInfo> clientPtr;
+
 // flag to indicate that the server is in listening state
 std::atomic<bool> listening{false};
 
@@ -112,14 +247,39 @@ std::atomic<bool> listening{false};
 // server closes and program terminates when true
 std::atomic<bool> serverQuitFlag{false};
 
-// a vector of socketInfo for actively connected sockets
-std::vector<socketInfo> activeSockets;
+// registry of actively connected sockets, also counts the connected clients
+connectionRegistry<socketInfo> activeSockets;
+
+// subscribers of every channel, for nType 5 publishes
+channelIndex<socketInfo> channelSubscribers;
 
-// vector of messages received
-std::vector<std::string> messages;
+// limits on what one client can subscribe to
+const size_t maxChannelName = 255;
+const size_t maxSubscriptions = 1024;
 
-// counter to keep track of number of clients connected
-int connectionCounter = 0;
+// bounded history of messages received
+messageHistory messages;
+
+// capacity and slow-consumer policy of every client's outbound queue
+queueSettings outboundSettings;
+
+#ifdef __linux__
+// link to the other server processes when started with --shards
+shardLink shardRelay;
+#endif
+
+// replies to pipelined requests are coalesced into one buffer up to this size
+const size_t replyBatchBytes = 64 << 10;
+
+// most bytes one read takes from a client, enough for hundreds of small messages
+const size_t readChunk = 64 << 10;
+
+// the threads serving clients outside the reactor, waited for on quit
+workerGroup clientWorkers;
+
+// the metrics port's listening socket, -1 without --metrics-port
+int metricsListenFd = -1;
+std::atomic<bool> metricsStopping{false};
 
 /////////////////////////////////////////////////
 // Output error message and exit
@@ -131,136 +291,824 @@ void error(const char *msg)
 }
 
 /*
-The thread for handling the socket operations, parsing and processing the message 
-@param connectionSockfd the file descriptor id unique to the socket used to connect
-                        the client
-*/
-void processSocket(int connectionSockfd) {
-    int n, spaceCount;
-    std::string nVersion; //version # of message, ignore message if != 1
-    
-    /* Type number of the message. If nType == 0, send data to all clients except the 
-    one it has been received from. If nType == 1, reverse the message and send to the 
-    client that sent the message */
-    std::string nType;
-
-    // instance of tcpMessage to hold the received data
-    tcpMessage *msgStructServer = (tcpMessage*)calloc(1,sizeof(tcpMessage));
-    
-    // define the buffer to be used for reversing the message
-    char reverse[1000];
-    int dx = 0; // index used for reversing the message
-    
-    // message character length
-    unsigned short nMsgLen;
-
-    if (serverQuitFlag) {
-        sockClose(connectionSockfd); // close the connection if prompted
+Shuts a thread-per-client socket down unless its reader has already closed it
+@param client the client
+@param how SHUT_WR or SHUT_RDWR
+*/
+void shutdownClientSocket(const socketInfo &client, int how)
+{
+    std::lock_guard<std::mutex> guard(client.closeLock);
+    if (!client.socketClosed)
+        shutdown(client.storedSockfd, how);
+}
+
+/*
+Queues a shared frame for one client, through its shared-memory ring if it has one,
+or through the reactor if it owns the client.
+Never waits on the client's socket; a full queue is handled by its policy.
+@param client the destination client
+@param data the encoded frame(s)
+*/
+void sendToClient(const socketInfo &client, const sharedBuffer &data)
+{
+#ifdef __linux__
+    if (client.usesShm.load(std::memory_order_acquire))
+    {
+        if (!client.shm->outbound->push(data))
+            client.shm->channel->close(); // slow client, its ring reader cleans up
+        return;
+    }
+    if (client.conn)
+    {
+        Reactor::send(client.conn, data);
+        return;
     }
+#endif
+    if (!client.outbound->push(data))
+        shutdownClientSocket(client, SHUT_RDWR); // slow client or already closed, its reader cleans up
+}
 
-    // message receiving and processing
-    do {
-        // initalize the char buffers to 0
-        memset(msgStructServer->chMsg,0,1000);
-        memset(reverse,0,1000);
-        // receive the data from client, blocking call
-        n = recv(connectionSockfd, msgStructServer, sizeof(tcpMessage), 0);
-        if (n < 0) 
-            error("ERROR reading from socket");
-        if (n == 0) // signifies graceful closure of the client
-        { // delete the client id from the activeSockets list
-            connectionCounter--;
-            for (auto it = begin(activeSockets); it != end(activeSockets); ++it) 
+/*
+The thread writing a blocking client's outbound queue to its socket
+@param client the connected client
+*/
+void writerThread(clientPtr client)
+{
+    while (client->outbound->drainBlocking(client->storedSockfd))
+    {
+    }
+    client->outbound->close(); // stop queueing for a socket that is gone
+    shutdown(client->storedSockfd, SHUT_RDWR);
+}
+
+/*
+Sends the replies batched while handling one read, as a single buffer
+@param client the client the replies go to
+@param replies encoded replies, left empty
+*/
+void flushReplies(const socketInfo &client, std::string &replies)
+{
+    if (replies.empty())
+        return;
+    sendToClient(client, makeSharedBuffer(std::move(replies)));
+    replies.clear(); // a moved-from string is only guaranteed to be valid
+}
+
+/*
+Queues a message for every recipient except its sender. The message is encoded at
+most once per wire version, compressed at most once for the clients that asked for
+it, and every recipient shares the buffer.
+@param senderId id of the client that sent the message, 0 if it came from another shard
+@param frame the message
+@param recipients registry snapshot or channel subscribers, anything with forEach
+*/
+template <typename Recipients>
+void fanOut(uint64_t senderId, const frameView &frame, const Recipients &recipients)
+{
+    sharedBuffer encoded[3]; // version 1, version 2, compressed
+    size_t saved = 0;        // bytes one compressed copy keeps off the wire
+    recipients.forEach([&](const clientPtr &client) {
+        if (client->id != senderId)
+        {
+            unsigned char version = client->peerVersion;
+            bool compressed = version == '2' && client->compress;
+            sharedBuffer &bytes = encoded[compressed ? 2 : version == '2'];
+            if (!bytes)
             {
-                if (connectionSockfd == it->storedSockfd)
+                std::string out;
+                if (compressed)
                 {
-                    activeSockets.erase(it);
-                    break;
-                }
+                    encodeCompressedFrame(frame.nType, frame.payload, frame.len, out);
+                    saved = compactHeaderSize + frame.len - out.size();
+                } else
+                    encodeFrame(version, frame.nType, frame.payload, frame.len, out);
+                bytes = makeSharedBuffer(std::move(out));
             }
-            break;
+            if (compressed)
+                metricAdd(metricCompressionSaved, saved);
+            sendToClient(*client, bytes);
         }
+    });
+}
+
+/*
+Finds the channel a nType 5 message is published to, the payload up to the first space
+@param frame the message
+*/
+std::string channelOf(const frameView &frame)
+{
+    const char *space = (const char *)memchr(frame.payload, ' ', frame.len);
+    return std::string(frame.payload, space ? space - frame.payload : frame.len);
+}
 
-        // ignore if nVersion is not 1
-        if (msgStructServer->nVersion != '1')
+/*
+Adds a message to the history and relays it to the other shards, if any
+@param frame the message, before any change to its payload
+*/
+void recordMessage(const frameView &frame)
+{
+    messages.append(frame.nType, frame.payload, frame.len);
+#ifdef __linux__
+    shardRelay.relay(frame.nType, frame.payload, frame.len);
+#endif
+}
+
+/*
+Subscribes a client to a channel (nType 3) or unsubscribes it (nType 4)
+@param client the client, shared so the channel index can hold it
+@param channel the channel name, without spaces
+@param subscribe true to subscribe
+*/
+void changeSubscription(const clientPtr &client, const std::string &channel, bool subscribe)
+{
+    if (channel.empty() || channel.size() > maxChannelName || channel.find(' ') != std::string::npos)
+        return;
+    std::vector<std::string> &mine = client->channels;
+    if (subscribe)
+    {
+        if (mine.size() < maxSubscriptions && channelSubscribers.subscribe(channel, client))
+            mine.push_back(channel);
+    } else if (channelSubscribers.unsubscribe(channel, client.get()))
+    {
+        mine.erase(std::find(mine.begin(), mine.end(), channel));
+    }
+}
+
+#ifdef __linux__
+void startSharedMemory(const clientPtr &client, const std::string &name, std::string &replies);
+#endif
+
+/*
+Answers a client asking for compressed broadcasts (nType 8). The answer is queued
+before the flag is set, so the client sees it before the first version '3' frame.
+Clients speaking version '1' cannot read version '3' and are always refused.
+@param client the client asking
+@param codec the codec it asks for, only compressionName is known
+@param replies replies to earlier requests, sent before the answer
+*/
+void startCompression(socketInfo &client, const std::string &codec, std::string &replies)
+{
+    bool accepted = codec == compressionName && client.peerVersion == '2';
+    const char *answer = accepted ? compressionName : "none";
+    encodeFrame(client.peerVersion, compressHandshakeType, answer, strlen(answer), replies);
+    flushReplies(client, replies);
+    if (accepted)
+        client.compress = true;
+}
+
+/*
+Processes one message received from a client, shared by every server mode
+@param client the client that sent the message
+@param frame the received message, its payload is reversed in place for nType 1
+@param replies nType 1 replies are appended here and sent together by the caller
+*/
+void handleMessage(const clientPtr &client, frameView &frame, std::string &replies)
+{
+    socketInfo &sender = *client;
+    // ignore versions the server does not speak
+    if (frame.nVersion != '1' && frame.nVersion != '2')
+    {
+        metricAdd(metricVersionDropped);
+        return;
+    }
+    sender.peerVersion = frame.nVersion;
+    metricMessage(frame.nType);
+
+    if (frame.nType == '0')
+    {
+        fanOut(sender.id, frame, activeSockets.take()); // every connected client
+        recordMessage(frame); // add message to the history, other shards deliver it too
+    } else if (frame.nType == '3' || frame.nType == '4')
+    {
+        changeSubscription(client, std::string(frame.payload, frame.len), frame.nType == '3');
+    } else if (frame.nType == '5')
+    {
+        fanOut(sender.id, frame, channelSubscribers.subscribers(channelOf(frame))); // subscribers only
+        recordMessage(frame);
+    } else if (frame.nType == compressHandshakeType)
+    {
+        startCompression(sender, std::string(frame.payload, frame.len), replies);
+#ifdef __linux__
+    } else if (frame.nType == shmHandshakeType)
+    {
+        startSharedMemory(client, std::string(frame.payload, frame.len), replies);
+#endif
+    } else if (frame.nType == '1') 
+    {
+        // store the message as received, then reverse it where the decoder holds it
+        // and encode the reply straight behind the previous ones
+        recordMessage(frame);
+        reverseInPlace(frame.payload, frame.len);
+        encodeFrame(frame.nVersion, frame.nType, frame.payload, frame.len, replies);
+        if (replies.size() >= replyBatchBytes)
+            flushReplies(sender, replies);
+    } else 
+    {
+        recordMessage(frame); // just add the message
+    }
+}
+
+/*
+Processes a message another shard relayed: stores it, and delivers broadcasts and
+publishes to this shard's clients. Never relayed further.
+@param frame the relayed message
+*/
+void handleRelay(frameView &frame)
+{
+    messages.append(frame.nType, frame.payload, frame.len);
+    if (frame.nType == '0')
+        fanOut(0, frame, activeSockets.take());
+    else if (frame.nType == '5')
+        fanOut(0, frame, channelSubscribers.subscribers(channelOf(frame)));
+}
+
+/*
+Drops every channel subscription of a client
+@param client the client, called from the thread reading its messages
+*/
+void dropSubscriptions(socketInfo &client)
+{
+    for (const std::string &channel : client.channels)
+        channelSubscribers.unsubscribe(channel, &client);
+    client.channels.clear();
+}
+
+#ifdef __linux__
+/*
+The thread reading a shared-memory client's messages from its ring, the ring
+counterpart of processSocket
+@param client the client, its shm session is set
+*/
+void shmReaderThread(clientPtr client)
+{
+    std::shared_ptr<shmSession> session = client->shm;
+    frameDecoder decoder;
+    frameView frame;
+    std::string replies;
+    for (;;)
+    {
+        long n = session->channel->toServer.read(decoder.prepare(readChunk), readChunk, 1000);
+        if (n < 0)
+            break;
+        if (n == 0)
             continue;
+        metricAdd(metricBytesIn, n);
+        decoder.commit(n);
+        while (decoder.next(frame))
+            handleMessage(client, frame, replies);
+        flushReplies(*client, replies);
+        if (decoder.failed())
+            break;
+    }
+    session->channel->close();
+    session->outbound->close();
+    dropSubscriptions(*client);
+    session->closeTcp(client->conn, client->storedSockfd);
+}
 
-        if (msgStructServer->nType == '0')
-        {
-            for (auto it = begin(activeSockets); it != end(activeSockets); ++it) 
-            {
-                if (it->storedSockfd != connectionSockfd) 
-                {
-                    n = send(it->storedSockfd, msgStructServer, sizeof(tcpMessage), 0);
-                    if (n < 0)
-                        error("ERROR writing to socket");
-                }
-            }
-            messages.push_back(msgStructServer->chMsg); // add message to the list
-        } else if (msgStructServer->nType == '1') 
+/*
+The thread copying a shared-memory client's outbound queue into its ring
+@param client the client, its shm session is set
+*/
+void shmWriterThread(clientPtr client)
+{
+    std::shared_ptr<shmSession> session = client->shm;
+    std::vector<queuedBuffer> batch;
+    while (session->outbound->takeBlocking(batch, 64))
+    {
+        for (const queuedBuffer &item : batch)
         {
-            // store the message as received, but send the reversed version to the client
-            std::strcpy(reverse,msgStructServer->chMsg);
-            for (int i=msgStructServer->nMsgLen-1;i>=0;i--)
+            if (!session->channel->toClient.write(item.buf->data(), item.buf->size()))
             {
-                msgStructServer->chMsg[dx] = reverse[i];
-                dx++;
+                session->outbound->close();
+                break;
             }
-            dx = 0; // reset the dummy index back to 0 for the next iteration
-            messages.push_back(reverse); // add the message to the list, notice that reverse
-                                         // is actually the copy of original and the message is
-                                         // reversed in the struct being sent back.
-            n = send(connectionSockfd, msgStructServer, sizeof(tcpMessage), 0);        
-        } else 
-        {
-            messages.push_back(msgStructServer->chMsg); // just add the message
+            session->outbound->sentBytes(item.buf->size());
+            session->outbound->sentMessage(item, metricsNowUs());
         }
+        batch.clear();
+    }
+    session->channel->close();
+}
+
+/*
+Moves a client on this host to the shared-memory segment it created (nType 6).
+A peer that is not on this host is always answered "unavailable".
+The answer, "ok" or "unavailable", still goes over TCP; everything queued for the
+client after an "ok" goes through the ring, and its TCP socket only signals closing.
+@param client the client asking
+@param name the segment name
+@param replies replies to earlier requests, sent over TCP before the answer
+*/
+void startSharedMemory(const clientPtr &client, const std::string &name, std::string &replies)
+{
+    flushReplies(*client, replies);
+    std::shared_ptr<shmChannel> channel;
+    if (!client->usesShm && shmPeerIsLocal(client->storedSockfd)) // never for a remote peer
+        channel = shmChannel::attach(name);
+    const char *answer = channel ? "ok" : "unavailable";
+    std::string out;
+    encodeFrame(client->peerVersion, shmHandshakeType, answer, strlen(answer), out);
+    sendToClient(*client, makeSharedBuffer(std::move(out)));
+    if (!channel)
+        return;
+    std::shared_ptr<shmSession> session = std::make_shared<shmSession>();
+    session->channel = channel;
+    session->outbound = makeOutboundQueue(outboundSettings);
+    client->shm = session;
+    client->usesShm.store(true, std::memory_order_release);
+}
 
+/*
+Starts the ring threads of a client that just moved to shared memory, once the TCP
+reader has handled every message read along with the handshake; until then the
+ring reader could handle messages the client sent after those
+@param client the client
+*/
+void startShmThreads(const clientPtr &client)
+{
+    if (!client->usesShm || client->shm->started)
+        return;
+    client->shm->started = true;
+    clientWorkers.spawn(shmReaderThread, client);
+    clientWorkers.spawn(shmWriterThread, client);
+}
+#endif
+
+/*
+The queue currently carrying a client's messages
+@param client the client
+*/
+outboundQueue &activeQueue(const socketInfo &client)
+{
+#ifdef __linux__
+    if (client.usesShm)
+        return *client.shm->outbound;
+#endif
+    return *client.outbound;
+}
+
+/*
+Removes a client from the activeSockets registry once its connection is gone
+@param client the closed client
+*/
+void removeClient(socketInfo &client)
+{
+#ifdef __linux__
+    if (client.usesShm)
+        client.shm->closeFromTcp(); // its ring reader drops the subscriptions
+    else
+#endif
+        dropSubscriptions(client);
+    if (activeSockets.remove(client.id))
+        metricAdd(metricClosed);
+}
+
+/*
+The thread for handling the socket operations, parsing and processing the message 
+@param client the connected client, owned jointly with activeSockets
+*/
+void processSocket(clientPtr client) {
+    int n;
+    int connectionSockfd = client->storedSockfd;
+
+    // reassembles whole messages from however the bytes arrive
+    frameDecoder decoder;
+    frameView frame;
+    std::string replies;
+
+    // replies and broadcasts to this client are written by their own thread
+    std::thread writer(writerThread, client);
+
+    // message receiving and processing
+    do {
+        // receive whatever the client sent so far straight into the decoder, blocking call
+        n = recv(connectionSockfd, decoder.prepare(readChunk), readChunk, 0);
+        if (n < 0) // reset by the client, or shut down by its writer after a failure
+            perror("ERROR reading from socket");
+        if (n <= 0) // signifies closure of the client
+        { // delete the client id from the activeSockets registry
+            removeClient(*client);
+            break;
+        }
+        metricAdd(metricBytesIn, n);
+        decoder.commit(n);
+        // after moving to shared memory TCP only signals closing; what came with the
+        // handshake is still handled, anything later is a protocol error
+        bool movedBefore = client->usesShm;
+        bool lateTcp = false;
+        while (!lateTcp && decoder.next(frame)) // every complete message of this read, one batch
+            if (!(lateTcp = movedBefore))
+                handleMessage(client, frame, replies);
+        flushReplies(*client, replies); // one send for every request this read completed
+#ifdef __linux__
+        startShmThreads(client);
+#endif
+        if (decoder.failed() || lateTcp) // oversized frame or TCP after shared memory, drop the client
+        {
+            removeClient(*client);
+            break;
+        }
     } while (n > 0); // do until recv returns something valid to work with
-    
+    client->outbound->close();
+    writer.join();
+    std::lock_guard<std::mutex> guard(client->closeLock);
+    client->socketClosed = true;
+    sockClose(connectionSockfd);
+}
+
+#ifdef __linux__
+// per-connection state the reactor callbacks hang off reactorConnection::userData
+struct reactorClient
+{
+    clientPtr client;
+    frameDecoder decoder;
+};
+
+/*
+Reactor callback, splits the bytes received so far into whole messages.
+Partial messages stay buffered in the decoder until the rest arrives. Replies to
+pipelined requests are coalesced and queued once per readiness event.
+@param conn the connection with new data in its inBuf
+*/
+void processReactorData(const connectionPtr &conn)
+{
+    reactorClient *state = (reactorClient *)conn->userData.get();
+    frameView frame;
+    std::string replies;
+    metricAdd(metricBytesIn, conn->inBuf.size());
+    state->decoder.feed(conn->inBuf.data(), conn->inBuf.size());
+    conn->inBuf.clear();
+    // after moving to shared memory TCP only signals closing; what came with the
+    // handshake is still handled, anything later is a protocol error
+    bool movedBefore = state->client->usesShm;
+    bool lateTcp = false;
+    while (!lateTcp && state->decoder.next(frame))
+        if (!(lateTcp = movedBefore))
+            handleMessage(state->client, frame, replies);
+    flushReplies(*state->client, replies); // one writev for every request this event completed
+    startShmThreads(state->client);
+    if (state->decoder.failed() || lateTcp)
+        shutdown(conn->fd, SHUT_RDWR); // the loop sees EOF and closes the client
+}
+
+/*
+Reactor callback, stores relevant info about a newly accepted client
+@param conn the new connection
+*/
+void openReactorClient(const connectionPtr &conn)
+{
+    std::shared_ptr<reactorClient> state = std::make_shared<reactorClient>();
+    state->client = std::make_shared<socketInfo>();
+    state->client->storedSockfd = conn->fd;
+    state->client->portno = conn->portno;
+    memcpy(state->client->ipaddress, conn->ipaddress, INET_ADDRSTRLEN);
+    state->client->conn = conn;
+    state->client->outbound = conn->outbound;
+    conn->userData = state;
+    activeSockets.insert(state->client);
+    metricAdd(metricAccepted);
 }
 
+/*
+Reactor callback, forgets a client whose connection the loop is closing
+@param conn the closing connection
+*/
+void closeReactorClient(const connectionPtr &conn)
+{
+    removeClient(*((reactorClient *)conn->userData.get())->client);
+    conn->userData.reset(); // breaks the conn -> client -> conn cycle
+}
+#endif
+
 /*
 The thread for accepting connections and creating processSocket threads for each
-connection made. Stores relevant socket information for display if prompted by user
+connection made. Stores relevant socket information for display if prompted by user.
+Waits in poll instead of accept, so clearing listening stops it without shutting
+the socket down; after a handoff another process still accepts on it. The socket
+is non-blocking: when that process takes the connection poll reported, accept
+fails with EAGAIN instead of waiting for one that may never come.
 @param sockfd the file descriptor for the listening socket initialized in the main()
-@param cli_addr a pointer to sockaddr_in struct
-@param clilen a pointer to socklen_t
 */
-void acceptThread(int sockfd, sockaddr_in *cli_addr, socklen_t * clilen) {
+void acceptThread(int sockfd) {
     int newsockfd; // file descriptor for the new connection made
-    char str[INET_ADDRSTRLEN]; // needed for recollecting the ip address of client
-    socketInfo myClientInfo; // store the info to this
+    sockaddr_in cli_addr;
+    socklen_t clilen;
     while (listening)
     {
+        pollfd ready = {sockfd, POLLIN, 0};
+        if (poll(&ready, 1, 200) <= 0)
+            continue;
         // make the connection
-        newsockfd = accept(sockfd, (struct sockaddr *) cli_addr, clilen);
+        clilen = sizeof(cli_addr);
+        newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
         if (newsockfd < 0){
+            // taken by another process sharing the socket, or gone before we got it
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+                continue;
             error("ERROR on accept");
             continue;
         }
-        // increment counter
-        connectionCounter++;
-        // start the corresponding thread for the client connection
-        std::thread t2(processSocket, newsockfd);
-        t2.detach();
+        // outside Linux an accepted socket inherits O_NONBLOCK, its reader blocks
+        sockSetBlocking(newsockfd, true);
+        // replies are small and latency bound, do not let Nagle hold them
+        int on = 1;
+        setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
         // store relevant info about connection
-        myClientInfo.portno = ntohs(cli_addr->sin_port);
-        myClientInfo.storedSockfd = newsockfd;
-        myClientInfo.ipaddress = inet_ntop(AF_INET,&(cli_addr->sin_addr),str, INET_ADDRSTRLEN);
-        activeSockets.push_back(myClientInfo);
+        clientPtr myClientInfo = std::make_shared<socketInfo>();
+        myClientInfo->portno = ntohs(cli_addr.sin_port);
+        myClientInfo->storedSockfd = newsockfd;
+        myClientInfo->outbound = makeOutboundQueue(outboundSettings);
+        inet_ntop(AF_INET,&(cli_addr.sin_addr),myClientInfo->ipaddress, INET_ADDRSTRLEN);
+        activeSockets.insert(myClientInfo);
+        metricAdd(metricAccepted);
+        // start the corresponding thread for the client connection
+        clientWorkers.spawn(processSocket, myClientInfo);
+    }
+}
+
+/*
+Appends one "name value" line of the metrics text
+@param out the text being built
+@param name metric name, with labels if any
+@param value the value
+*/
+void metricLine(std::string &out, const std::string &name, uint64_t value)
+{
+    out += name;
+    out += ' ';
+    out += std::to_string((unsigned long long)value);
+    out += '\n';
+}
+
+/*
+Collects the server counters, the queue depths and the send latencies of the
+connected clients as text, one "name value" line each (Prometheus text format)
+@return the metrics text
+*/
+std::string formatMetrics()
+{
+    static const char *names[metricCount] = {
+        "tcp_connections_accepted_total", "tcp_connections_closed_total", "tcp_bytes_in_total",
+        "tcp_bytes_out_total", "tcp_messages_dropped_version_total", "tcp_queue_dropped_total",
+        "tcp_slow_disconnects_total", "tcp_relayed_out_total", "tcp_relayed_in_total",
+        "tcp_compression_saved_bytes_total"};
+    metricsTotals totals = readMetrics();
+    std::string out;
+    for (int i = 0; i < metricCount; i++)
+        metricLine(out, names[i], totals.values[i]);
+    metricLine(out, "tcp_connections_open", activeSockets.size());
+    metricLine(out, "tcp_channels", channelSubscribers.channels());
+    metricLine(out, "tcp_subscriptions", channelSubscribers.subscriptions());
+#ifdef __linux__
+    metricLine(out, "tcp_shard_peers", shardRelay.connectedPeers());
+#endif
+    for (int type = 0; type < 256; type++)
+    {
+        if (totals.messagesByType[type] == 0)
+            continue;
+        std::string label = (type > ' ' && type < 127 && type != '"' && type != '\\')
+            ? std::string(1, (char)type) : std::to_string(type);
+        metricLine(out, "tcp_messages_received_total{type=\"" + label + "\"}", totals.messagesByType[type]);
+    }
+
+    std::string clients;
+    std::vector<uint64_t> all;
+    size_t queued = 0, deepest = 0;
+    activeSockets.take().forEach([&](const clientPtr &client) {
+        std::vector<uint64_t> mine;
+        outboundQueue &queue = activeQueue(*client);
+        queue.counters.sendLatency.mergeInto(mine);
+        queue.counters.sendLatency.mergeInto(all);
+        size_t depth = queue.depth();
+        queued += depth;
+        deepest = std::max(deepest, depth);
+        std::string id = "{id=\"" + std::to_string((unsigned long long)client->id);
+        metricLine(clients, "tcp_client_queue_depth" + id + "\"}", depth);
+        metricLine(clients, "tcp_client_messages_sent_total" + id + "\"}", queue.counters.sent);
+        metricLine(clients, "tcp_client_send_latency_us" + id + "\",quantile=\"0.5\"}",
+                   latencyHistogram::percentile(mine, 0.5));
+        metricLine(clients, "tcp_client_send_latency_us" + id + "\",quantile=\"0.99\"}",
+                   latencyHistogram::percentile(mine, 0.99));
+    });
+    metricLine(out, "tcp_queue_depth_total", queued);
+    metricLine(out, "tcp_queue_depth_max", deepest);
+    metricLine(out, "tcp_send_latency_us{quantile=\"0.5\"}", latencyHistogram::percentile(all, 0.5));
+    metricLine(out, "tcp_send_latency_us{quantile=\"0.99\"}", latencyHistogram::percentile(all, 0.99));
+    metricLine(out, "tcp_send_latency_us{quantile=\"0.999\"}", latencyHistogram::percentile(all, 0.999));
+    return out + clients;
+}
+
+/*
+The thread answering metrics scrapes on a localhost-only port. A request starting
+with GET gets an HTTP/1.0 reply; anything else (or nothing within a second, e.g. nc)
+gets the bare text.
+@param listenfd listening socket bound to 127.0.0.1
+*/
+void metricsThread(int listenfd)
+{
+    while (!metricsStopping)
+    {
+        int fd = accept(listenfd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+        char request[1024];
+        int n = recv(fd, request, sizeof(request), 0);
+        std::string body = formatMetrics(), reply;
+        if (n >= 4 && memcmp(request, "GET ", 4) == 0)
+            reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                    std::to_string((unsigned long long)body.size()) + "\r\n\r\n";
+        reply += body;
+        for (size_t sent = 0; sent < reply.size(); )
+        {
+            int w = send(fd, reply.data() + sent, reply.size() - sent, 0);
+            if (w <= 0)
+                break;
+            sent += w;
+        }
+        sockClose(fd);
+    }
+    sockClose(listenfd);
+}
+
+/*
+Opens the metrics port on the loopback interface and starts metricsThread
+@param port the port to listen on
+*/
+void startMetrics(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        error("ERROR opening metrics socket");
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // scrapers on this host only
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+        error("ERROR binding metrics port");
+    printf("Serving metrics on 127.0.0.1:%d\n", port);
+    metricsListenFd = fd;
+    std::thread t(metricsThread, fd);
+    t.detach();
+}
+
+/*
+Frees the metrics port, so a server taking over can bind it
+*/
+void stopMetrics()
+{
+    if (metricsListenFd < 0 || metricsStopping.exchange(true))
+        return;
+    shutdown(metricsListenFd, SHUT_RDWR); // wakes metricsThread, which closes it
+}
+
+/*
+Ends one client's connection, from any thread
+@param client the client
+@param how SHUT_WR after its last message, SHUT_RDWR to cut it off
+*/
+void endClient(socketInfo &client, int how)
+{
+#ifdef __linux__
+    if (client.usesShm)
+    {
+        client.shm->channel->close(); // its ring reader shuts the TCP socket
+        return;
+    }
+    if (client.conn)
+    {
+        std::lock_guard<std::mutex> guard(client.conn->outLock);
+        if (!client.conn->closed)
+            shutdown(client.conn->fd, how);
+        return;
+    }
+#endif
+    shutdownClientSocket(client, how);
+}
+
+/*
+Closes every client connection without losing what was queued for it. Each client
+gets a close notice behind its queued messages; once every queue is written the
+connections are half-closed, so clients read to the end of the stream and hang up.
+Whoever is still connected at the deadline is cut off.
+@param deadline when to stop waiting for slow clients
+*/
+void drainClients(std::chrono::steady_clock::time_point deadline)
+{
+    const char notice[] = "server closing";
+    activeSockets.take().forEach([&](const clientPtr &client) {
+        std::string out;
+        encodeFrame(client->peerVersion, closeNoticeType, notice, sizeof(notice) - 1, out);
+        sendToClient(*client, makeSharedBuffer(std::move(out)));
+    });
+    for (;;)
+    {
+        size_t waiting = 0;
+        activeSockets.take().forEach([&](const clientPtr &client) {
+            if (!activeQueue(*client).flushed())
+                waiting++;
+        });
+        if (waiting == 0 || std::chrono::steady_clock::now() >= deadline)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
+    activeSockets.take().forEach([](const clientPtr &client) { endClient(*client, SHUT_WR); });
+    while (activeSockets.size() > 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (activeSockets.size() > 0)
+        printf("Cutting off %zu clients after the drain deadline\n", activeSockets.size());
+    activeSockets.take().forEach([](const clientPtr &client) { endClient(*client, SHUT_RDWR); });
+}
+
+#ifndef _WIN32
+// SIGTERM and SIGINT quit like "q", so a supervisor's restart drains the clients too
+void onTerminate(int)
+{
+    serverQuitFlag = true;
 }
+#endif
 
 /*
-Main entry point for the program. Starts the acceptThread.
+Waits for the next console command while the server runs. Reads the console
+itself instead of std::getline, so a handoff or a signal can end the wait.
+@param command the line read
+@param console cleared once stdin is closed; the server then keeps serving until
+               it is told to quit another way
+@return false once the server is quitting
+*/
+bool readCommand(std::string &command, bool &console)
+{
+#ifdef _WIN32
+    if (console && std::getline(std::cin, command))
+        return true;
+    console = false;
+    while (!serverQuitFlag)
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return false;
+#else
+    static std::string pending; // console input not yet ended by a newline
+    while (!serverQuitFlag)
+    {
+        size_t end = pending.find('\n');
+        if (end != std::string::npos)
+        {
+            command = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            if (!command.empty() && command.back() == '\r')
+                command.pop_back();
+            return true;
+        }
+        if (!console)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            continue;
+        }
+        pollfd in = {0, POLLIN, 0};
+        if (poll(&in, 1, 200) <= 0)
+            continue;
+        char buffer[4096];
+        ssize_t n = read(0, buffer, sizeof(buffer));
+        if (n > 0)
+            pending.append(buffer, n);
+        else if (n == 0 || errno != EINTR)
+        {
+            console = false; // no console, e.g. started by a benchmark script
+            if (!pending.empty())
+                pending += '\n'; // the last line had no newline
+        }
+    }
+    return false;
+#endif
+}
+
+/*
+Main entry point for the program. Starts the acceptThread, or the reactor loops
+when started with --reactor or --uring.
 Main thread responsible for handling user commands
 @param portNumber command line argument specifying the server's port number
+@param --reactor optional, serve clients from epoll event loops instead of threads
+@param loops optional after --reactor, number of event loops (default 4)
+@param --uring optional, serve clients from io_uring loops, or epoll ones if unavailable
+@param --queue optional, outbound queue capacity in messages per client
+@param --slow optional, drop, disconnect or block when a client's queue is full
+@param --history optional, messages kept in memory
+@param --history-bytes optional, payload bytes kept in memory
+@param --history-log optional, directory of the on-disk history segments
+@param --metrics-port optional, localhost port serving the metrics text
+@param --shards optional, number of server processes
+@param --shard-dir optional, directory of the shards' Unix sockets
+@param --drain optional, milliseconds quitting waits for the clients' queues
+@param --handoff optional, Unix socket a new server takes the listening sockets from
+@param --takeover optional, Unix socket of the server whose listening sockets to take
 */
 int main(int argc, char *argv[])
 {
     int sockfd, portno; // variables for connection information
-    socklen_t clilen;
     std::string command;
     /*    struct sockaddr_in {
         short            sin_family;   // e.g. AF_INET
@@ -269,78 +1117,369 @@ int main(int argc, char *argv[])
         char             sin_zero[8];  // zero this if you want to
     };*/
 
-    struct sockaddr_in serv_addr, cli_addr;
+    struct sockaddr_in serv_addr;
     if (argc < 2)
     {
         fprintf(stderr, "ERROR, no port provided\n");
         exit(1);
     }
+    bool reactorMode = false, uringMode = false;
+    int numLoops = 4;
+    size_t historyMessages = 10000, historyBytes = 16 << 20;
+    std::string historyLog;
+    int metricsPort = 0;
+    int shardCount = 1, shardIndex = 0;
+    std::string shardDir = "/tmp";
+    int drainMs = 5000;
+    std::string handoffPath, takeoverPath;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--reactor" || option == "--uring")
+        {
+            reactorMode = true;
+            uringMode = (option == "--uring");
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                numLoops = atoi(argv[++i]);
+        } else if (option == "--queue" && i + 1 < argc)
+        {
+            int capacity = atoi(argv[++i]);
+            outboundSettings.maxMessages = (capacity > 0) ? capacity : 1;
+        } else if (option == "--slow" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+            if (policy == "disconnect")
+                outboundSettings.policy = disconnectSlow;
+            else if (policy == "block")
+                outboundSettings.policy = blockSender;
+            else
+                outboundSettings.policy = dropOldest;
+        } else if (option == "--history" && i + 1 < argc)
+        {
+            historyMessages = strtoul(argv[++i], NULL, 10);
+        } else if (option == "--history-bytes" && i + 1 < argc)
+        {
+            historyBytes = strtoul(argv[++i], NULL, 10);
+        } else if (option == "--history-log" && i + 1 < argc)
+        {
+            historyLog = argv[++i];
+        } else if (option == "--metrics-port" && i + 1 < argc)
+        {
+            metricsPort = atoi(argv[++i]);
+        } else if (option == "--shards" && i + 1 < argc)
+        {
+            shardCount = std::max(atoi(argv[++i]), 1);
+        } else if (option == "--shard-dir" && i + 1 < argc)
+        {
+            shardDir = argv[++i];
+        } else if (option == "--drain" && i + 1 < argc)
+        {
+            drainMs = std::max(atoi(argv[++i]), 0);
+        } else if (option == "--handoff" && i + 1 < argc)
+        {
+            handoffPath = argv[++i];
+        } else if (option == "--takeover" && i + 1 < argc)
+        {
+            takeoverPath = argv[++i];
+        } else
+        {
+            fprintf(stderr, "ERROR, unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if (reactorMode && outboundSettings.policy == blockSender)
+    {
+        // a loop waiting for one client's room stalls every connection on it, the
+        // recipient's own loop included, so the wait would only ever time out
+        fprintf(stderr, "ERROR, --slow block needs a thread per client, use drop or disconnect with --reactor and --uring\n");
+        exit(1);
+    }
+#ifdef __linux__
+    // fork the other shards before any thread exists; the console stays in shard 0
+    std::vector<pid_t> shardChildren;
+    pid_t consolePid = getpid();
+    for (int i = 1; i < shardCount && shardIndex == 0; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            error("ERROR forking shard");
+        if (pid > 0)
+        {
+            shardChildren.push_back(pid);
+            continue;
+        }
+        shardIndex = i;
+        shardChildren.clear();
+        prctl(PR_SET_PDEATHSIG, SIGTERM); // go down with the console
+        if (getppid() != consolePid)
+            exit(0);
+        int devnull = open("/dev/null", O_RDONLY);
+        dup2(devnull, 0); // no console for this shard
+        close(devnull);
+    }
+    if (shardCount > 1)
+    {
+        if (metricsPort > 0)
+            metricsPort += shardIndex;
+        if (!historyLog.empty())
+        {
+            historyLog += "/shard-" + std::to_string(shardIndex);
+            mkdir(historyLog.c_str(), 0755);
+        }
+    }
+    if (shardCount > 1 && (!handoffPath.empty() || !takeoverPath.empty()))
+    {
+        fprintf(stderr, "ERROR, --handoff and --takeover do not work with --shards\n");
+        exit(1);
+    }
+#else
+    if (shardCount > 1 || !handoffPath.empty() || !takeoverPath.empty())
+    {
+        fprintf(stderr, "ERROR, --shards, --handoff and --takeover need Linux\n");
+        exit(1);
+    }
+#endif
+    messages.configure(historyMessages, historyBytes);
+    if (!historyLog.empty())
+    {
+        long replayed = messages.openLog(historyLog);
+        if (replayed < 0)
+            error("ERROR opening history log");
+        printf("Replayed %ld messages from %s\n", replayed, historyLog.c_str());
+    }
     sockInit();
-    // Create the socket
-    //int socket(int domain, int type, int protocol);
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    // Make sure the socket was created
-    if (sockfd < 0)
-        error("ERROR opening socket\n");
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN); // a vanished client must not kill the server
+    signal(SIGTERM, onTerminate);
+    signal(SIGINT, onTerminate);
+#endif
+    // listening sockets taken over from a running server, used instead of new ones
+    std::vector<int> inherited;
+    int handoffAck = -1;
+#ifdef __linux__
+    if (!takeoverPath.empty())
+    {
+        if (!listenerHandoff::takeOver(takeoverPath, inherited, handoffAck))
+            error("ERROR taking over the listening sockets");
+        printf("Took over %zu listening sockets from %s\n", inherited.size(), takeoverPath.c_str());
+        numLoops = (int)inherited.size(); // one loop per socket, so every backlog is served
+    }
+#endif
+    if (metricsPort > 0 && handoffAck < 0) // a server being taken over frees the port first
+        startMetrics(metricsPort);
+#ifdef __linux__
+    if (shardCount > 1)
+    {
+        shardRelay.onRelay = handleRelay;
+        if (!shardRelay.start(shardDir, atoi(argv[1]), shardIndex, shardCount))
+            error("ERROR opening shard socket");
+        printf("Shard %d of %d, relaying through %s\n", shardIndex, shardCount,
+               shardLink::socketPath(shardDir, atoi(argv[1]), shardIndex).c_str());
+    }
+#endif
+#ifdef __linux__
+    Reactor reactor;
+    UringReactor uring;
+    reactor.settings = uring.settings = outboundSettings;
+    if (uringMode)
+    {
+        uring.onOpen = openReactorClient;
+        uring.onData = processReactorData;
+        uring.onClose = closeReactorClient;
+        if (uring.start(atoi(argv[1]), numLoops, inherited))
+        {
+            printf("Listening for connections on %d io_uring loops...\n", numLoops);
+        } else
+        {
+            printf("io_uring is unavailable, using epoll event loops\n");
+            uringMode = false;
+        }
+    }
+    if (reactorMode && !uringMode)
+    {
+        reactor.onOpen = openReactorClient;
+        reactor.onData = processReactorData;
+        reactor.onClose = closeReactorClient;
+        if (!reactor.start(atoi(argv[1]), numLoops, inherited))
+            error("ERROR on binding");
+        printf("Listening for connections on %d event loops...\n", numLoops);
+    }
+    sockfd = -1;
+#else
+    if (reactorMode)
+    {
+        fprintf(stderr, "ERROR, --reactor and --uring need Linux\n");
+        exit(1);
+    }
+#endif
+    // thread-per-client mode: the listening sockets and their accept threads
+    std::vector<int> listenSockets;
+    std::vector<std::thread> acceptThreads;
+    if (!reactorMode && !inherited.empty())
+    {
+        listenSockets = inherited;
+        printf("Listening for connections...\n");
+    } else if (!reactorMode)
+    {
+        // Create the socket
+        //int socket(int domain, int type, int protocol);
+        sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        // Make sure the socket was created
+        if (sockfd < 0)
+            error("ERROR opening socket\n");
 
-    // Zero out the variable serv_addr
-    // void * memset(void * ptr, int value, size_t num);
-    memset((char *)&serv_addr, 0, sizeof(serv_addr));
+        // Zero out the variable serv_addr
+        // void * memset(void * ptr, int value, size_t num);
+        memset((char *)&serv_addr, 0, sizeof(serv_addr));
 
-    // Convert the port number string to an int
-    // int atoi (const char * str);
-    portno = atoi(argv[1]);
+        // Convert the port number string to an int
+        // int atoi (const char * str);
+        portno = atoi(argv[1]);
 
-    // Initialize the serv_addr
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    // Convert port number from host to network
-    serv_addr.sin_port = htons(portno);
+        // Initialize the serv_addr
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = INADDR_ANY;
+        // Convert port number from host to network
+        serv_addr.sin_port = htons(portno);
+        // drained connections are closed by the server and leave TIME_WAIT behind,
+        // which must not keep a restarted server off the port
+        int reuse = 1;
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+#ifdef __linux__
+        if (shardCount > 1) // every shard listens on the port, the kernel spreads the clients
+        {
+            int on = 1;
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        }
+#endif
 
-    // Bind the socket to the port number
-    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
-    {
-        error("ERROR on binding");
-    }
-    printf("Listening for connections...\n");
-    clilen = sizeof(cli_addr);
+        // Bind the socket to the port number
+        if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+        {
+            error("ERROR on binding");
+        }
+        printf("Listening for connections...\n");
 
-    // start listening for connections
-    listen(sockfd, 5);
+        // start listening for connections
+        listen(sockfd, SOMAXCONN);
+        listenSockets.push_back(sockfd);
+    }
     listening = true;
-    // start the thread for accepting and handling the communication
-    std::thread t1(acceptThread, sockfd, &cli_addr, &clilen);
+    // start the threads for accepting and handling the communication
+    for (int fd : listenSockets)
+    {
+        sockSetBlocking(fd, false); // inherited ones too, see acceptThread
+        acceptThreads.push_back(std::thread(acceptThread, fd));
+    }
+#ifdef __linux__
+    if (handoffAck >= 0)
+    {
+        // accepting on the sockets now, the old server can stop
+        if (!listenerHandoff::acknowledge(handoffAck))
+            fprintf(stderr, "ERROR, the old server did not confirm the handoff\n");
+        if (metricsPort > 0)
+            startMetrics(metricsPort);
+    }
+    listenerHandoff handoff;
+    if (!handoffPath.empty())
+    {
+        handoff.onHandedOff = [&]() {
+            printf("\nListening sockets handed over, draining\n");
+            listening = false; // leave new clients to the new server right away
+            uring.stopAccepting();
+            reactor.stopAccepting();
+            stopMetrics(); // the new server binds it next
+            serverQuitFlag = true;
+        };
+        std::vector<int> sockets = !reactorMode ? listenSockets : uringMode ? uring.listeners() : reactor.listeners();
+        if (!handoff.start(handoffPath, sockets))
+            error("ERROR opening handoff socket");
+        printf("Waiting for a new server on %s\n", handoffPath.c_str());
+    }
+#endif
     // do this while server is not prompted to close down
+    bool console = true;
     while(!serverQuitFlag) {
         // get user command
-        std::cout << "Please enter command: ";
-        std::getline (std::cin,command);
+        if (shardIndex == 0 && console) // the other shards have no console
+            std::cout << "Please enter command: " << std::flush;
+        if (!readCommand(command, console))
+            break;
         if (command == "q") // quit the server
         {
             serverQuitFlag = true;
         } else if (command == "0") // display the most recent message
         {
-            if (messages.empty())
+            historyEntry entry;
+            if (!messages.last(entry))
             {
                 printf("empty message box\n");
             } else 
             {
-                printf("Last message: %s\n",messages.back().c_str());
+                printf("Last message: %s\n",entry.payload.c_str());
             }
-        } else if (command == "1") // display the currently connected sockets
+        } else if (command.compare(0, 2, "2 ") == 0) // display the last n messages
         {
-            printf("Numer of Clients: %d\n",connectionCounter);
-            printf("IP Address      Port\n");
-            for (auto it = begin(activeSockets); it != end(activeSockets); ++it) 
+            std::vector<historyEntry> entries = messages.lastN(strtoul(command.c_str() + 2, NULL, 10));
+            printf("Showing %zu of %zu messages (%zu bytes held)\n", entries.size(), messages.size(),
+                   messages.bytes());
+            for (auto it = begin(entries); it != end(entries); ++it)
             {
-                printf("%s      %d\n",it->ipaddress,it->portno);
+                printf("Type %c: %s\n", it->nType, it->payload.c_str());
             }
+        } else if (command == "1") // display the currently connected sockets
+        {
+            printf("Numer of Clients: %zu\n",activeSockets.size());
+            printf("Id      IP Address      Port    Queued  Sent      Dropped  Blocked\n");
+            activeSockets.take().forEach([](const clientPtr &client) {
+                outboundQueue &queue = activeQueue(*client);
+                queueCounters &c = queue.counters;
+                printf("%-7llu %s      %-7d %-7zu %-9llu %-8llu %llu\n",(unsigned long long)client->id,
+                       client->ipaddress,client->portno,
+                       queue.depth(), (unsigned long long)c.sent.load(),
+                       (unsigned long long)c.dropped.load(), (unsigned long long)c.blocked.load());
+            });
+        } else if (command == "3") // display the server counters
+        {
+            printf("%s", formatMetrics().c_str());
         }
     }
-    // set flag to stop listening
+    // stop accepting; the listening sockets are closed but never shut down,
+    // after a handoff the new server is accepting on them
     listening = false;
-    // close the listening socket
-    sockClose(sockfd);
+#ifdef __linux__
+    handoff.stop();
+    for (pid_t child : shardChildren) // the other shards drain alongside this one
+        kill(child, SIGTERM);
+    uring.stopAccepting();
+    reactor.stopAccepting();
+#endif
+    for (std::thread &t : acceptThreads)
+        t.join();
+    for (int fd : listenSockets)
+    {
+#ifdef _WIN32
+        closesocket(fd);
+#else
+        close(fd);
+#endif
+    }
+    printf("Draining %zu clients...\n", activeSockets.size());
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(drainMs);
+    drainClients(deadline);
+#ifdef __linux__
+    uring.stop();
+    reactor.stop();
+#endif
+    if (!clientWorkers.waitIdle(deadline + std::chrono::seconds(1)))
+        printf("%zu client threads did not finish\n", clientWorkers.count());
+#ifdef __linux__
+    shardRelay.stop();
+    for (pid_t child : shardChildren)
+        waitpid(child, NULL, 0);
+    for (int i = 1; i <= (int)shardChildren.size(); i++) // killed shards leave their sockets
+        unlink(shardLink::socketPath(shardDir, atoi(argv[1]), i).c_str());
+#endif
     sockQuit();
 
 #ifdef _WIN32
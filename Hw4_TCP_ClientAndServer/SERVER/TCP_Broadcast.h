@@ -0,0 +1,372 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Outbound side of the TCP server. A message is encoded once into an
+immutable, reference counted buffer and the same buffer is queued on every
+recipient. Each connection has a bounded queue drained with writev, so a slow
+reader only fills its own queue instead of stalling whoever is broadcasting.
+What happens when a queue is full is decided by a slow-consumer policy.
+Every queued buffer carries the time it was queued, so each connection keeps a
+histogram of how long its messages waited before the socket took them.
+*/
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "TCP_Metrics.h"
+
+// immutable encoded frame shared by every queue it is pushed to
+typedef std::shared_ptr<const std::string> sharedBuffer;
+
+/*
+Wraps encoded bytes into a shared buffer
+@param bytes encoded frame(s), moved from
+*/
+inline sharedBuffer makeSharedBuffer(std::string &&bytes)
+{
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+// a buffer waiting in a queue and when it was queued (metricsNowUs)
+struct queuedBuffer
+{
+    sharedBuffer buf;
+    uint64_t queuedAt;
+};
+
+// what to do when a recipient's queue is full
+enum slowConsumerPolicy
+{
+    dropOldest,       // discard the oldest unsent message to make room
+    disconnectSlow,   // close the recipient
+    blockSender       // wait for room, then disconnect after blockTimeoutMs; the
+                      // sender's thread waits, so never for a queue an event loop pushes to
+};
+
+// per-connection traffic counters, readable from any thread
+struct queueCounters
+{
+    std::atomic<uint64_t> enqueued{0};      // messages accepted into the queue
+    std::atomic<uint64_t> sent{0};          // messages fully written to the socket
+    std::atomic<uint64_t> bytesSent{0};     // bytes written to the socket
+    std::atomic<uint64_t> dropped{0};       // messages discarded by dropOldest
+    std::atomic<uint64_t> blocked{0};       // pushes that had to wait for room
+    std::atomic<uint64_t> peakDepth{0};     // largest queue length seen
+    latencyHistogram sendLatency;           // queued to fully written, microseconds
+};
+
+class outboundQueue
+{
+public:
+    enum drainResult { drained, wouldBlock, failed };
+
+    queueCounters counters;
+
+    /*
+    @param maxMessages queue capacity in messages
+    @param maxBytes queue capacity in bytes
+    @param policy what push does when the queue is full
+    @param blockTimeoutMs longest a blockSender push waits before giving up
+    */
+    outboundQueue(size_t maxMessages, size_t maxBytes, slowConsumerPolicy policy, int blockTimeoutMs = 1000)
+        : maxMessages(maxMessages), maxBytes(maxBytes), policy(policy), blockTimeoutMs(blockTimeoutMs) {}
+
+    /*
+    Queues a buffer for sending, applying the slow-consumer policy if full.
+    Once it asks for a disconnect the queue closes itself, so later pushes fail fast.
+    @param buf the buffer to send
+    @return false if the recipient should be disconnected
+    */
+    bool push(const sharedBuffer &buf)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (closed)
+            return false;
+        if (full(buf->size()))
+        {
+            if (policy == disconnectSlow)
+            {
+                metricAdd(metricSlowDisconnects);
+                return closeLocked();
+            }
+            if (policy == blockSender)
+            {
+                counters.blocked++;
+                bool room = spaceFree.wait_for(guard, std::chrono::milliseconds(blockTimeoutMs),
+                    [&]() { return closed || !full(buf->size()); });
+                if (!room || closed)
+                {
+                    metricAdd(metricSlowDisconnects);
+                    return closeLocked();
+                }
+            }
+            else
+            {
+                // never drop a message that is partially written, the stream would break
+                size_t first = (headOffset > 0) ? 1 : 0;
+                while (items.size() > first && full(buf->size()))
+                {
+                    queuedBytes -= items[first].buf->size();
+                    items.erase(items.begin() + first);
+                    counters.dropped++;
+                    metricAdd(metricQueueDropped);
+                }
+            }
+        }
+        items.push_back(queuedBuffer{buf, metricsNowUs()});
+        queuedBytes += buf->size();
+        counters.enqueued++;
+        if (items.size() > counters.peakDepth)
+            counters.peakDepth = items.size();
+        dataReady.notify_one();
+        return true;
+    }
+
+    /*
+    Writes as much as a non-blocking socket accepts with writev
+    @param fd destination socket
+    @return drained when empty, wouldBlock when the socket is full, failed on error
+    */
+    drainResult drain(int fd)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        while (!items.empty())
+        {
+            iovec iov[maxIov];
+            int count = gather(iov);
+            ssize_t n = writev(fd, iov, count);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return wouldBlock;
+            if (n <= 0)
+                return failed;
+            advance(n);
+        }
+        return drained;
+    }
+
+    /*
+    Writer loop for blocking sockets: waits for data and writes it outside the lock
+    so producers never wait on the socket.
+    @param fd destination socket
+    @return false once the queue is closed or the socket failed
+    */
+    bool drainBlocking(int fd)
+    {
+        std::vector<queuedBuffer> batch;
+        if (!takeBlocking(batch, maxIov))
+            return false;
+        iovec iov[maxIov];
+        size_t first = 0, offset = 0;
+        while (first < batch.size())
+        {
+            int count = 0;
+            for (size_t i = first; i < batch.size(); i++, count++)
+            {
+                size_t skip = (i == first) ? offset : 0;
+                iov[count].iov_base = (void *)(batch[i].buf->data() + skip);
+                iov[count].iov_len = batch[i].buf->size() - skip;
+            }
+            ssize_t n = writev(fd, iov, count);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sentBytes(n);
+            uint64_t now = metricsNowUs();
+            size_t left = n;
+            while (first < batch.size() && left >= batch[first].buf->size() - offset)
+            {
+                left -= batch[first].buf->size() - offset;
+                offset = 0;
+                sentMessage(batch[first], now);
+                first++;
+            }
+            offset += left;
+        }
+        return true;
+    }
+
+    /*
+    Moves waiting buffers out of the queue for a writer that keeps them alive until
+    they are written (the io_uring backend) and reports them with sentBytes and
+    sentMessage. Never blocks.
+    @param batch the buffers are appended here
+    @param max most buffers batch may hold afterwards
+    @return false once the queue is closed
+    */
+    bool take(std::vector<queuedBuffer> &batch, size_t max)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (closed)
+            return false;
+        takeLocked(batch, max);
+        return true;
+    }
+
+    // counts bytes a writer put on the socket
+    void sentBytes(size_t n)
+    {
+        counters.bytesSent += n;
+        metricAdd(metricBytesOut, n);
+    }
+
+    /*
+    Counts a buffer that has been fully written and records how long it waited
+    @param item the buffer as it was taken from the queue
+    @param now metricsNowUs() at the time of the write
+    */
+    void sentMessage(const queuedBuffer &item, uint64_t now)
+    {
+        counters.sent++;
+        counters.sendLatency.record(now - item.queuedAt);
+    }
+
+    /*
+    Like take, but waits until there is something to take (the shared-memory writer)
+    @param batch the buffers are appended here
+    @param max most buffers batch may hold afterwards
+    @return false once the queue is closed
+    */
+    bool takeBlocking(std::vector<queuedBuffer> &batch, size_t max)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        dataReady.wait(guard, [&]() { return closed || !items.empty(); });
+        if (closed)
+            return false;
+        takeLocked(batch, max);
+        return true;
+    }
+
+    // wakes every waiter and refuses further pushes
+    void close()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closeLocked();
+    }
+
+    // number of messages waiting to be sent
+    size_t depth()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return items.size();
+    }
+
+    // true once every message queued so far is on the socket, or will never be;
+    // unlike depth() this also waits for buffers a writer has taken but not written
+    bool flushed()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return closed || counters.enqueued == counters.sent + counters.dropped;
+    }
+
+private:
+    static const size_t maxIov = 64;
+
+    size_t maxMessages, maxBytes;
+    slowConsumerPolicy policy;
+    int blockTimeoutMs;
+
+    std::mutex lock;
+    std::condition_variable spaceFree, dataReady;
+    std::deque<queuedBuffer> items;
+    size_t headOffset = 0;     // bytes of items.front() already written
+    size_t queuedBytes = 0;
+    bool closed = false;
+
+    // lock held, always returns false so push can tail-call it
+    bool closeLocked()
+    {
+        closed = true;
+        items.clear();
+        headOffset = 0;
+        queuedBytes = 0;
+        dataReady.notify_all();
+        spaceFree.notify_all();
+        return false;
+    }
+
+    // move whole buffers from the head of the queue, lock held, headOffset is 0
+    void takeLocked(std::vector<queuedBuffer> &batch, size_t max)
+    {
+        while (!items.empty() && batch.size() < max)
+        {
+            batch.push_back(items.front());
+            queuedBytes -= items.front().buf->size();
+            items.pop_front();
+        }
+        spaceFree.notify_all();
+    }
+
+    bool full(size_t incoming) const
+    {
+        return !items.empty() && (items.size() >= maxMessages || queuedBytes + incoming > maxBytes);
+    }
+
+    // fill iov from the head of the queue, lock held
+    int gather(iovec *iov) const
+    {
+        int count = 0;
+        for (size_t i = 0; i < items.size() && count < (int)maxIov; i++, count++)
+        {
+            size_t skip = (i == 0) ? headOffset : 0;
+            iov[count].iov_base = (void *)(items[i].buf->data() + skip);
+            iov[count].iov_len = items[i].buf->size() - skip;
+        }
+        return count;
+    }
+
+    // pop everything writev finished, lock held
+    void advance(size_t n)
+    {
+        sentBytes(n);
+        uint64_t now = metricsNowUs();
+        while (n > 0)
+        {
+            size_t rest = items.front().buf->size() - headOffset;
+            if (n < rest)
+            {
+                headOffset += n;
+                return;
+            }
+            n -= rest;
+            headOffset = 0;
+            queuedBytes -= items.front().buf->size();
+            sentMessage(items.front(), now);
+            items.pop_front();
+        }
+        spaceFree.notify_all();
+    }
+};
+
+// settings every new connection's queue is created with
+struct queueSettings
+{
+    size_t maxMessages = 1024;
+    size_t maxBytes = 4 << 20;
+    slowConsumerPolicy policy = dropOldest;
+    int blockTimeoutMs = 1000;
+};
+
+/*
+Creates an outbound queue from the server-wide settings
+@param settings capacity and slow-consumer policy
+*/
+inline std::shared_ptr<outboundQueue> makeOutboundQueue(const queueSettings &settings)
+{
+    return std::make_shared<outboundQueue>(settings.maxMessages, settings.maxBytes, settings.policy,
+                                           settings.blockTimeoutMs);
+}
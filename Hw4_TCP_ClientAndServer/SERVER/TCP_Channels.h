@@ -0,0 +1,155 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Channel-to-subscriber index for publish/subscribe routing. A publish
+only looks up its channel and walks that channel's subscribers, so its cost grows
+with the number of subscribers instead of the number of connected clients.
+
+Like connectionRegistry, channels are split over locked shards, and every channel
+publishes an immutable subscriber list that is replaced (copy-on-write) on
+subscribe and unsubscribe. A publisher only holds the shard lock to copy the
+list's shared_ptr and walks it without any lock, so subscription changes never
+wait for a fan-out to finish.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+template <typename T>
+class channelIndex
+{
+public:
+    typedef std::shared_ptr<T> entryPtr;
+    typedef std::shared_ptr<const std::vector<entryPtr>> subscriberList;
+
+    // the subscribers of one channel at lookup time, safe to iterate without locks
+    class view
+    {
+    public:
+        template <typename F>
+        void forEach(F fn) const
+        {
+            if (list)
+                for (const entryPtr &entry : *list)
+                    fn(entry);
+        }
+
+        size_t size() const { return list ? list->size() : 0; }
+
+    private:
+        friend class channelIndex;
+        subscriberList list;
+    };
+
+    channelIndex() : shards(shardCount) {}
+
+    /*
+    Adds a subscriber to a channel, creating the channel on first use
+    @param channel channel name
+    @param entry the subscribing client
+    @return false if it was already subscribed
+    */
+    bool subscribe(const std::string &channel, const entryPtr &entry)
+    {
+        shard &s = shardOf(channel);
+        std::lock_guard<std::mutex> guard(s.lock);
+        subscriberList &list = s.channels[channel];
+        if (list)
+        {
+            for (const entryPtr &existing : *list)
+                if (existing == entry)
+                    return false;
+        }
+        std::shared_ptr<std::vector<entryPtr>> fresh = std::make_shared<std::vector<entryPtr>>();
+        fresh->reserve((list ? list->size() : 0) + 1);
+        if (list)
+            *fresh = *list;
+        else
+            channelCount++;
+        fresh->push_back(entry);
+        list = fresh;
+        subscriptionCount++;
+        return true;
+    }
+
+    /*
+    Removes a subscriber from a channel, dropping the channel once it is empty
+    @param channel channel name
+    @param entry the client to remove
+    @return false if it was not subscribed
+    */
+    bool unsubscribe(const std::string &channel, const T *entry)
+    {
+        shard &s = shardOf(channel);
+        std::lock_guard<std::mutex> guard(s.lock);
+        auto found = s.channels.find(channel);
+        if (found == s.channels.end())
+            return false;
+        const std::vector<entryPtr> &current = *found->second;
+        std::shared_ptr<std::vector<entryPtr>> fresh = std::make_shared<std::vector<entryPtr>>();
+        fresh->reserve(current.size());
+        for (const entryPtr &existing : current)
+            if (existing.get() != entry)
+                fresh->push_back(existing);
+        if (fresh->size() == current.size())
+            return false;
+        subscriptionCount--;
+        if (fresh->empty())
+        {
+            s.channels.erase(found);
+            channelCount--;
+        } else
+        {
+            found->second = fresh;
+        }
+        return true;
+    }
+
+    /*
+    Looks up the subscribers of a channel
+    @param channel channel name
+    @return the subscribers, empty if nobody is subscribed
+    */
+    view subscribers(const std::string &channel)
+    {
+        view result;
+        shard &s = shardOf(channel);
+        std::lock_guard<std::mutex> guard(s.lock);
+        auto found = s.channels.find(channel);
+        if (found != s.channels.end())
+            result.list = found->second;
+        return result;
+    }
+
+    // number of channels with at least one subscriber
+    size_t channels() const { return channelCount.load(); }
+
+    // number of (channel, subscriber) pairs
+    size_t subscriptions() const { return subscriptionCount.load(); }
+
+private:
+    static const size_t shardCount = 16;
+
+    struct shard
+    {
+        std::mutex lock;
+        std::unordered_map<std::string, subscriberList> channels;
+    };
+
+    std::vector<shard> shards;
+    std::atomic<size_t> channelCount{0};
+    std::atomic<size_t> subscriptionCount{0};
+
+    shard &shardOf(const std::string &channel)
+    {
+        return shards[std::hash<std::string>()(channel) % shardCount];
+    }
+};
@@ -0,0 +1,322 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Bounded history of the messages the server received.
+
+Payload bytes live in one arena allocated up front and used as a ring; a second
+fixed-size ring holds where each message starts. Appending never allocates, and
+the oldest messages are evicted once either the count or the byte limit would be
+exceeded, so memory stays flat however long the server runs. The last N messages
+are found by index arithmetic, O(1) per message.
+
+Optionally every message is also appended to an on-disk log split into segments
+(history-000001.log, history-000002.log, ...). Old segments are deleted as new
+ones are started, and on restart the segments are replayed to refill the ring.
+Each record is: 4-byte length, 1-byte type, payload, 4-byte CRC32 of type+payload.
+A torn record at the end of the last segment (crash mid-write) is ignored.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// one stored message
+struct historyEntry
+{
+    unsigned char nType;
+    std::string payload;
+};
+
+/*
+CRC32 (IEEE) used to detect torn or corrupt log records
+@param crc running value, start with 0
+@param data bytes to add
+@param len number of bytes
+*/
+inline uint32_t historyCrc32(uint32_t crc, const void *data, size_t len)
+{
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        ready = true;
+    }
+    const unsigned char *p = (const unsigned char *)data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+class messageHistory
+{
+public:
+    /*
+    @param maxMessages most messages kept in memory
+    @param maxBytes size of the payload arena; longer payloads keep only their tail
+    */
+    messageHistory(size_t maxMessages = 10000, size_t maxBytes = 16 << 20)
+    {
+        configure(maxMessages, maxBytes);
+    }
+
+    ~messageHistory()
+    {
+        if (logFd >= 0)
+            close(logFd);
+    }
+
+    /*
+    Resets the limits, dropping anything stored. Call before the server starts.
+    @param maxMessages most messages kept in memory
+    @param maxBytes size of the payload arena
+    */
+    void configure(size_t maxMessages, size_t maxBytes)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slots.assign(std::max<size_t>(maxMessages, 1), slot());
+        arena.assign(std::max<size_t>(maxBytes, 1), 0);
+        first = count = 0;
+        head = tail = used = 0;
+    }
+
+    /*
+    Enables the on-disk log and replays whatever an earlier run left there
+    @param directory existing directory that holds the segments
+    @param segmentBytes size at which a new segment is started
+    @param keepSegments most segments kept on disk, older ones are deleted
+    @return number of messages replayed, or -1 if the directory is unusable
+    */
+    long openLog(const std::string &directory, size_t segmentBytes = 4 << 20, size_t keepSegments = 8)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        logDir = directory;
+        maxSegmentBytes = segmentBytes;
+        maxSegments = std::max<size_t>(keepSegments, 1);
+
+        DIR *dir = opendir(directory.c_str());
+        if (dir == NULL)
+            return -1;
+        std::vector<unsigned long> found;
+        while (dirent *entry = readdir(dir))
+        {
+            unsigned long seq;
+            char tailChar;
+            if (sscanf(entry->d_name, "history-%lu.lo%c", &seq, &tailChar) == 2 && tailChar == 'g')
+                found.push_back(seq);
+        }
+        closedir(dir);
+        std::sort(found.begin(), found.end());
+
+        long replayed = 0;
+        for (unsigned long seq : found)
+            replayed += replaySegment(segmentPath(seq));
+        segments.assign(found.begin(), found.end());
+        startSegment(found.empty() ? 1 : found.back() + 1);
+        return replayed;
+    }
+
+    /*
+    Stores a message, evicting the oldest ones if a limit is reached
+    @param nType message type
+    @param data payload bytes
+    @param len payload length
+    */
+    void append(unsigned char nType, const char *data, size_t len)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        store(nType, data, len);
+        if (logFd >= 0)
+            writeRecord(nType, data, len);
+    }
+
+    /*
+    Copies the most recent message
+    @param out filled with the message
+    @return false if the history is empty
+    */
+    bool last(historyEntry &out)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (count == 0)
+            return false;
+        read(count - 1, out);
+        return true;
+    }
+
+    /*
+    Copies up to n of the most recent messages, oldest first
+    @param n number of messages wanted
+    */
+    std::vector<historyEntry> lastN(size_t n)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        n = std::min(n, count);
+        std::vector<historyEntry> out(n);
+        for (size_t i = 0; i < n; i++)
+            read(count - n + i, out[i]);
+        return out;
+    }
+
+    // messages currently held in memory
+    size_t size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return count;
+    }
+
+    // payload bytes currently held in memory
+    size_t bytes()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return used;
+    }
+
+private:
+    struct slot
+    {
+        size_t offset;   // start of the payload in the arena
+        size_t len;      // payload length
+        size_t span;     // arena bytes released when evicted (len plus skipped wrap gap)
+        unsigned char nType;
+    };
+
+    std::mutex lock;
+    std::vector<slot> slots;    // ring of message positions
+    std::vector<char> arena;    // ring of payload bytes
+    size_t first, count;        // oldest slot and number of slots in use
+    size_t head, tail, used;    // arena: oldest byte, next free byte, bytes in use
+
+    std::string logDir;
+    size_t maxSegmentBytes = 0, maxSegments = 0, segmentSize = 0;
+    std::vector<unsigned long> segments;   // sequence numbers on disk, oldest first
+    int logFd = -1;
+
+    void evictOldest()
+    {
+        slot &old = slots[first];
+        used -= old.span;
+        head = (old.offset + old.len) % arena.size();
+        first = (first + 1) % slots.size();
+        count--;
+        if (count == 0)
+            head = tail = used = 0;
+    }
+
+    // payloads are stored contiguously; a payload that does not fit before the end
+    // of the arena starts over at 0 and the skipped gap is charged to it
+    void store(unsigned char nType, const char *data, size_t len)
+    {
+        if (len > arena.size())
+        {
+            data += len - arena.size();
+            len = arena.size();
+        }
+        while (count == slots.size())
+            evictOldest();
+        size_t gap = (tail + len > arena.size()) ? arena.size() - tail : 0;
+        while (count > 0 && used + gap + len > arena.size())
+        {
+            evictOldest();
+            gap = (tail + len > arena.size()) ? arena.size() - tail : 0;
+        }
+        size_t offset = (gap > 0) ? 0 : tail;
+        memcpy(arena.data() + offset, data, len);
+        slot &s = slots[(first + count) % slots.size()];
+        s.offset = offset;
+        s.len = len;
+        s.span = len + gap;
+        s.nType = nType;
+        count++;
+        used += s.span;
+        tail = (offset + len) % arena.size();
+    }
+
+    // copy the i-th oldest message, lock held
+    void read(size_t i, historyEntry &out)
+    {
+        const slot &s = slots[(first + i) % slots.size()];
+        out.nType = s.nType;
+        out.payload.assign(arena.data() + s.offset, s.len);
+    }
+
+    std::string segmentPath(unsigned long seq) const
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/history-%06lu.log", seq);
+        return logDir + name;
+    }
+
+    void startSegment(unsigned long seq)
+    {
+        if (logFd >= 0)
+            close(logFd);
+        logFd = open(segmentPath(seq).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        segmentSize = 0;
+        segments.push_back(seq);
+        while (segments.size() > maxSegments)
+        {
+            unlink(segmentPath(segments.front()).c_str());
+            segments.erase(segments.begin());
+        }
+    }
+
+    void writeRecord(unsigned char nType, const char *data, size_t len)
+    {
+        std::string record(4 + 1 + len + 4, '\0');
+        uint32_t len32 = (uint32_t)len;
+        memcpy(&record[0], &len32, 4);
+        record[4] = (char)nType;
+        memcpy(&record[5], data, len);
+        uint32_t crc = historyCrc32(0, &record[4], 1 + len);
+        memcpy(&record[5 + len], &crc, 4);
+        if (write(logFd, record.data(), record.size()) < 0)
+        {
+            perror("ERROR writing history log");
+            return;
+        }
+        segmentSize += record.size();
+        if (segmentSize >= maxSegmentBytes)
+            startSegment(segments.back() + 1);
+    }
+
+    long replaySegment(const std::string &path)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == NULL)
+            return 0;
+        long replayed = 0;
+        std::string payload;
+        uint32_t len32, crc;
+        unsigned char nType;
+        while (fread(&len32, 4, 1, file) == 1 && len32 <= (1u << 30) && fread(&nType, 1, 1, file) == 1)
+        {
+            payload.resize(len32);
+            if ((len32 > 0 && fread(&payload[0], 1, len32, file) != len32) || fread(&crc, 4, 1, file) != 1)
+                break; // torn record at the end
+            uint32_t expect = historyCrc32(historyCrc32(0, &nType, 1), payload.data(), payload.size());
+            if (crc != expect)
+                break;
+            store(nType, payload.data(), payload.size());
+            replayed++;
+        }
+        fclose(file);
+        return replayed;
+    }
+};
@@ -0,0 +1,290 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Shutdown and restart support for the TCP server. A workerGroup counts
+the threads serving clients so shutdown can wait for them after the connections
+are drained. A listenerHandoff passes the listening sockets to a new server process
+over a Unix domain socket (SCM_RIGHTS, Linux only): the new process starts accepting on the
+very same sockets before the old one stops, so connections waiting in the backlog
+are never refused during a restart.
+
+Handoff exchange, on <path>:
+    old server   listens on <path> (--handoff <path>)
+    new server   connects (--takeover <path>)
+    old server   sends the sockets with SCM_RIGHTS
+    new server   starts accepting on them, answers one byte
+    old server   unlinks <path>, frees its metrics port, answers one byte, then
+                 stops accepting and drains
+    new server   may listen on <path> and the metrics port itself
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <string.h>
+    #include <atomic>
+    #include <functional>
+#endif
+
+// message type of the notice every client gets before the server closes its connection
+const unsigned char closeNoticeType = '7';
+
+// counts the threads serving clients, detached threads included
+class workerGroup
+{
+public:
+    /*
+    Starts a detached thread that is counted until f returns
+    @param f the thread function
+    @param args its arguments, copied
+    */
+    template <typename F, typename... Args>
+    void spawn(F f, Args... args)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running++;
+        }
+        std::thread([this, f, args...]() {
+            f(args...);
+            leave();
+        }).detach();
+    }
+
+    /*
+    Waits until every counted thread has finished
+    @param deadline when to give up
+    @return false if some are still running at the deadline
+    */
+    bool waitIdle(std::chrono::steady_clock::time_point deadline)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        return idle.wait_until(guard, deadline, [&]() { return running == 0; });
+    }
+
+    size_t count()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return running;
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable idle;
+    size_t running = 0;
+
+    void leave()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (--running == 0)
+            idle.notify_all();
+    }
+};
+
+#ifdef __linux__
+class listenerHandoff
+{
+public:
+    // most sockets one handoff carries, one per event loop
+    static const int maxListeners = 64;
+
+    // called on the handoff thread once the new process accepts on the sockets
+    std::function<void()> onHandedOff;
+
+    ~listenerHandoff() { stop(); }
+
+    /*
+    Waits on a Unix socket for a new server process to take the listening sockets
+    @param path where to listen
+    @param sockets the listening sockets to give away
+    @return false if the Unix socket could not be set up
+    */
+    bool start(const std::string &path, const std::vector<int> &sockets)
+    {
+        sockaddr_un addr;
+        if (!makeAddress(path, addr) || sockets.empty() || (int)sockets.size() > maxListeners)
+            return false;
+        listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenfd < 0)
+            return false;
+        unlink(path.c_str()); // left behind by a server that was killed
+        if (bind(listenfd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 1) < 0)
+        {
+            close(listenfd);
+            listenfd = -1;
+            return false;
+        }
+        listenPath = path;
+        listeners = sockets;
+        running = true;
+        worker = std::thread(&listenerHandoff::serve, this);
+        return true;
+    }
+
+    /*
+    Stops waiting for a new process. Safe to call twice.
+    */
+    void stop()
+    {
+        if (!running.exchange(false))
+            return;
+        shutdown(listenfd, SHUT_RDWR); // wakes serve
+        if (worker.joinable())
+            worker.join();
+        close(listenfd);
+        if (!handedOff)
+            unlink(listenPath.c_str());
+    }
+
+    bool done() const { return handedOff; }
+
+    /*
+    Takes the listening sockets of a running server, for the new process
+    @param path the old server's handoff socket
+    @param sockets the received sockets are appended here
+    @param ackfd set to the connection to answer on with acknowledge()
+    @return false if no server handed anything over
+    */
+    static bool takeOver(const std::string &path, std::vector<int> &sockets, int &ackfd)
+    {
+        sockaddr_un addr;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || !makeAddress(path, addr) || connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        int count = 0;
+        char control[CMSG_SPACE(sizeof(int) * maxListeners)];
+        iovec iov = {&count, sizeof(count)};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n;
+        while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        {
+        }
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (n != sizeof(count) || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            close(fd);
+            return false;
+        }
+        int received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int *fds = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < received; i++)
+            sockets.push_back(fds[i]);
+        ackfd = fd;
+        return received == count && received > 0;
+    }
+
+    /*
+    Tells the old server the new one is accepting, so it can stop, and waits until
+    it released the handoff path
+    @param ackfd the connection takeOver returned
+    @return false if the old server did not answer
+    */
+    static bool acknowledge(int ackfd)
+    {
+        char ready = 1;
+        bool released = send(ackfd, &ready, 1, MSG_NOSIGNAL) == 1 && readByte(ackfd);
+        close(ackfd);
+        return released;
+    }
+
+private:
+    int listenfd = -1;
+    std::string listenPath;
+    std::vector<int> listeners;
+    std::atomic<bool> running{false};
+    std::atomic<bool> handedOff{false};
+    std::thread worker;
+
+    static bool makeAddress(const std::string &path, sockaddr_un &addr)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // one handoff at a time; a process that leaves before answering does not count
+    void serve()
+    {
+        while (running)
+        {
+            int fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return; // shut down by stop
+            }
+            if (!sendSockets(fd) || !readByte(fd))
+            {
+                close(fd); // nobody took over, keep waiting for the next try
+                continue;
+            }
+            // the path and whatever onHandedOff frees are the new process's from now on
+            unlink(listenPath.c_str());
+            handedOff = true;
+            if (onHandedOff)
+                onHandedOff();
+            char released = 1;
+            if (send(fd, &released, 1, MSG_NOSIGNAL) < 0) {}
+            close(fd);
+            return;
+        }
+    }
+
+    bool sendSockets(int fd)
+    {
+        int count = (int)listeners.size();
+        char control[CMSG_SPACE(sizeof(int) * maxListeners)];
+        memset(control, 0, sizeof(control));
+        iovec iov = {&count, sizeof(count)};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), listeners.data(), sizeof(int) * count);
+        ssize_t n;
+        while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        {
+        }
+        return n == sizeof(count);
+    }
+
+    // one byte from the other process, waiting at most as long as it needs to start up
+    static bool readByte(int fd)
+    {
+        timeval timeout = {10, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char value = 0;
+        return recv(fd, &value, 1, 0) == 1 && value == 1;
+    }
+};
+#endif
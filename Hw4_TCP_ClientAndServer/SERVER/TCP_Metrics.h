@@ -0,0 +1,253 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Live counters for the TCP server. Every thread counts into its own block
+of counters that only it writes, so counting is a plain load and store with no lock
+and no shared cache line. Reading the metrics sums the blocks of the running threads
+plus the totals left behind by threads that have exited. Reads are rare (console,
+scraper) and take a mutex; writes never do.
+
+latencyHistogram keeps a log-linear histogram of microseconds (four buckets per
+power of two, so a percentile is off by at most about 25%) and is safe to record into
+from several threads.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// counters kept by every thread
+enum metricId
+{
+    metricAccepted,          // connections accepted
+    metricClosed,            // connections closed
+    metricBytesIn,           // bytes read from clients
+    metricBytesOut,          // bytes written to clients
+    metricVersionDropped,    // messages ignored because of an unknown version
+    metricQueueDropped,      // queued messages discarded by dropOldest
+    metricSlowDisconnects,   // clients dropped because their queue stayed full
+    metricRelayedOut,        // messages relayed to other shards, counted per shard
+    metricRelayedIn,         // messages other shards relayed to this one
+    metricCompressionSaved,  // bytes compressed broadcasts kept off the wire
+    metricCount
+};
+
+// every counter summed over all threads
+struct metricsTotals
+{
+    uint64_t values[metricCount];
+    uint64_t messagesByType[256];   // messages received, by nType
+};
+
+// the counters of one thread, written only by that thread; each thread's block is
+// its own 2 KiB allocation, so at most its edges share a cache line with anything
+class threadMetrics
+{
+public:
+    threadMetrics()
+    {
+        for (auto &value : values)
+            value.store(0, std::memory_order_relaxed);
+        for (auto &count : byType)
+            count.store(0, std::memory_order_relaxed);
+    }
+
+    void add(metricId id, uint64_t n) { bump(values[id], n); }
+    void message(unsigned char nType) { bump(byType[nType], 1); }
+
+    // adds this thread's counts to totals; may run concurrently with the writer
+    void addTo(metricsTotals &totals) const
+    {
+        for (int i = 0; i < metricCount; i++)
+            totals.values[i] += values[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < 256; i++)
+            totals.messagesByType[i] += byType[i].load(std::memory_order_relaxed);
+    }
+
+private:
+    // single writer, so no locked read-modify-write is needed
+    static void bump(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> values[metricCount];
+    std::atomic<uint64_t> byType[256];
+};
+
+// list of the live threads' counters and the totals of the finished ones
+class metricsRegistry
+{
+public:
+    // never destroyed: detached client threads may still count while the process exits
+    static metricsRegistry &instance()
+    {
+        static metricsRegistry *registry = new metricsRegistry;
+        return *registry;
+    }
+
+    threadMetrics *attach()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(new threadMetrics);
+        return threads.back();
+    }
+
+    // folds a finishing thread's counts into the retired totals
+    void detach(threadMetrics *metrics)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        metrics->addTo(retired);
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            if (threads[i] == metrics)
+            {
+                threads[i] = threads.back();
+                threads.pop_back();
+                break;
+            }
+        }
+        delete metrics;
+    }
+
+    metricsTotals read()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        metricsTotals totals = retired;
+        for (const threadMetrics *metrics : threads)
+            metrics->addTo(totals);
+        return totals;
+    }
+
+private:
+    metricsRegistry() : retired() {}
+
+    std::mutex lock;
+    std::vector<threadMetrics *> threads;
+    metricsTotals retired;
+};
+
+// the calling thread's counters, registered on first use and retired at thread exit
+inline threadMetrics &localMetrics()
+{
+    struct slot
+    {
+        threadMetrics *metrics;
+        slot() : metrics(metricsRegistry::instance().attach()) {}
+        ~slot() { metricsRegistry::instance().detach(metrics); }
+    };
+    static thread_local slot mine;
+    return *mine.metrics;
+}
+
+/*
+Counts an event on the calling thread
+@param id which counter
+@param n amount to add
+*/
+inline void metricAdd(metricId id, uint64_t n = 1)
+{
+    localMetrics().add(id, n);
+}
+
+/*
+Counts a received message on the calling thread
+@param nType the message type
+*/
+inline void metricMessage(unsigned char nType)
+{
+    localMetrics().message(nType);
+}
+
+// sums every thread's counters
+inline metricsTotals readMetrics()
+{
+    return metricsRegistry::instance().read();
+}
+
+// microseconds on the steady clock, for measuring latencies
+inline uint64_t metricsNowUs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class latencyHistogram
+{
+public:
+    static const int bucketCount = 256;
+
+    latencyHistogram()
+    {
+        for (auto &bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+
+    /*
+    Records one latency
+    @param us latency in microseconds
+    */
+    void record(uint64_t us)
+    {
+        buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*
+    Adds the recorded counts to counts, so several histograms can be merged
+    @param counts resized to bucketCount if empty
+    */
+    void mergeInto(std::vector<uint64_t> &counts) const
+    {
+        counts.resize(bucketCount, 0);
+        for (int i = 0; i < bucketCount; i++)
+            counts[i] += buckets[i].load(std::memory_order_relaxed);
+    }
+
+    /*
+    Finds a percentile of merged counts
+    @param counts filled by mergeInto
+    @param q quantile between 0 and 1
+    @return upper bound of the bucket holding the quantile, in microseconds; 0 if empty
+    */
+    static uint64_t percentile(const std::vector<uint64_t> &counts, double q)
+    {
+        uint64_t total = 0;
+        for (uint64_t count : counts)
+            total += count;
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * (total - 1)) + 1, seen = 0;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+                return upperBound((int)i);
+        }
+        return upperBound((int)counts.size() - 1);
+    }
+
+private:
+    std::atomic<uint64_t> buckets[bucketCount];
+
+    // values below 4 get a bucket each, then 4 buckets per power of two
+    static int bucketOf(uint64_t us)
+    {
+        if (us < 4)
+            return (int)us;
+        int e = 63 - __builtin_clzll(us);
+        return (e - 1) * 4 + (int)((us >> (e - 2)) & 3);
+    }
+
+    static uint64_t upperBound(int bucket)
+    {
+        if (bucket < 4)
+            return bucket;
+        int e = bucket / 4 + 1;
+        uint64_t lower = (uint64_t)(4 + bucket % 4) << (e - 2);
+        return lower + ((uint64_t)1 << (e - 2)) - 1;
+    }
+};
@@ -0,0 +1,400 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Event-driven core for the TCP server (Linux only). A small fixed pool of
+event loops, each with its own SO_REUSEPORT listening socket and epoll set, services
+non-blocking client sockets so the server does not need one thread per client.
+The reactor only moves bytes; framing and message handling stay in the server.
+Outgoing bytes go through each connection's outboundQueue (TCP_Broadcast.h).
+*/
+
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "TCP_Broadcast.h"
+
+// state for one client connection owned by an event loop
+struct reactorConnection
+{
+    int fd;                            // client socket, non-blocking
+    int epfd;                          // epoll set of the owning loop
+    int portno;                        // client port
+    char ipaddress[INET_ADDRSTRLEN];   // client ip address
+    std::string inBuf;                 // received bytes not yet framed, loop thread only
+    std::shared_ptr<outboundQueue> outbound;   // frames waiting to be written
+    std::mutex outLock;                // guards writeArmed and closed
+    bool writeArmed = false;           // the loop drains: EPOLLOUT requested, or kick pending
+    bool closed = false;               // socket has been closed by the loop
+    std::shared_ptr<void> userData;    // owned by the server's callbacks
+    // set by a backend whose loop thread issues every write itself (io_uring);
+    // called from any thread after a buffer was queued
+    void (*kick)(const std::shared_ptr<reactorConnection> &) = nullptr;
+    void *owner = nullptr;             // the backend loop that owns the connection
+};
+
+typedef std::shared_ptr<reactorConnection> connectionPtr;
+
+class Reactor
+{
+public:
+    // called from the loop thread that owns the connection
+    std::function<void(const connectionPtr &)> onOpen;
+    std::function<void(const connectionPtr &)> onData;   // new bytes are in conn->inBuf
+    std::function<void(const connectionPtr &)> onClose;
+
+    // capacity and slow-consumer policy of every connection's outbound queue
+    queueSettings settings;
+
+    ~Reactor() { stop(); }
+
+    /*
+    Creates one listening socket and epoll set per loop and starts the loop threads.
+    @param portno port number every loop listens on through SO_REUSEPORT
+    @param numLoops number of event loop threads
+    @param inherited listening sockets taken over from another process, loop i
+                     uses inherited[i] instead of opening its own
+    @return false if a listening socket could not be set up
+    */
+    bool start(int portno, int numLoops, const std::vector<int> &inherited = std::vector<int>())
+    {
+        for (int i = 0; i < numLoops; i++)
+        {
+            std::unique_ptr<eventLoop> loop(new eventLoop);
+            loop->listenfd = (i < (int)inherited.size()) ? adoptListener(inherited[i]) : openListener(portno);
+            if (loop->listenfd < 0)
+            {
+                // taken-over sockets stay with the caller, it may start another backend on them
+                for (size_t k = 0; k < loops.size() && k < inherited.size(); k++)
+                    if (loops[k]->listenfd == inherited[k])
+                        loops[k]->listenfd = -1;
+                stop();
+                return false;
+            }
+            loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+            loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            watch(loop->epfd, loop->listenfd, EPOLLIN);
+            watch(loop->epfd, loop->wakefd, EPOLLIN);
+            loops.push_back(std::move(loop));
+        }
+        running = true;
+        accepting = true;
+        for (auto &loop : loops)
+        {
+            loop->worker = std::thread(&Reactor::run, this, loop.get());
+        }
+        return true;
+    }
+
+    /*
+    Wakes every loop, waits for them to exit and closes all sockets. Safe to call twice.
+    */
+    void stop()
+    {
+        running = false;
+        for (auto &loop : loops)
+        {
+            uint64_t one = 1;
+            if (write(loop->wakefd, &one, sizeof(one)) < 0) {}
+        }
+        for (auto &loop : loops)
+        {
+            if (loop->worker.joinable())
+                loop->worker.join();
+            if (loop->listenfd >= 0)
+                close(loop->listenfd);
+            close(loop->wakefd);
+            close(loop->epfd);
+        }
+        loops.clear();
+    }
+
+    /*
+    Every loop closes its listening socket and keeps serving its connections.
+    Sockets handed to another process keep accepting there.
+    */
+    void stopAccepting()
+    {
+        accepting = false;
+        for (auto &loop : loops)
+        {
+            uint64_t one = 1;
+            if (write(loop->wakefd, &one, sizeof(one)) < 0) {}
+        }
+    }
+
+    // the listening sockets, one per loop, for a handoff
+    std::vector<int> listeners() const
+    {
+        std::vector<int> fds;
+        for (auto &loop : loops)
+            fds.push_back(loop->listenfd);
+        return fds;
+    }
+
+    /*
+    Queues a shared buffer for a connection from any thread. Writes directly when the
+    loop is not already draining, otherwise the loop flushes it on EPOLLOUT.
+    A connection whose queue overflows under the disconnectSlow policy (or whose
+    socket failed) is shut down so its loop closes it.
+    @param conn destination connection
+    @param buf encoded frame(s) to send
+    @return false if the connection is closed or being dropped
+    */
+    static bool send(const connectionPtr &conn, const sharedBuffer &buf)
+    {
+        if (!conn->outbound->push(buf))
+        {
+            std::lock_guard<std::mutex> lock(conn->outLock);
+            if (!conn->closed) // once closed the descriptor number may belong to someone else
+                shutdown(conn->fd, SHUT_RDWR);
+            return false;
+        }
+        if (conn->kick)
+        {
+            conn->kick(conn);
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(conn->outLock);
+        if (conn->closed)
+            return false;
+        if (conn->writeArmed)
+            return true;
+        outboundQueue::drainResult result = conn->outbound->drain(conn->fd);
+        if (result == outboundQueue::wouldBlock)
+        {
+            conn->writeArmed = true;
+            modify(conn->epfd, conn->fd, EPOLLIN | EPOLLOUT);
+        }
+        else if (result == outboundQueue::failed)
+        {
+            conn->outbound->close(); // stop queueing for a socket that is gone
+            shutdown(conn->fd, SHUT_RDWR);
+            return false;
+        }
+        return true;
+    }
+
+    /*
+    Opens a non-blocking SO_REUSEPORT listening socket, one per event loop
+    @param portno port number to listen on
+    @return the socket, or -1
+    */
+    static int openListener(int portno)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        sockaddr_in serv_addr;
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = INADDR_ANY;
+        serv_addr.sin_port = htons(portno);
+        if (bind(fd, (sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /*
+    Prepares a listening socket taken over from another process for an event loop
+    @param fd the socket, it may have been blocking there
+    @return fd
+    */
+    static int adoptListener(int fd)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
+    }
+
+private:
+    struct eventLoop
+    {
+        int epfd = -1;
+        int listenfd = -1;
+        int wakefd = -1;
+        std::thread worker;
+        std::unordered_map<int, connectionPtr> conns;   // loop thread only
+    };
+
+    static const int readBudget = 4;
+    static const int acceptBudget = 64;
+
+    std::vector<std::unique_ptr<eventLoop>> loops;
+    std::atomic<bool> running{false};
+    std::atomic<bool> accepting{false};
+
+    static void watch(int epfd, int fd, uint32_t events)
+    {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    static void modify(int epfd, int fd, uint32_t events)
+    {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    // accept pending connections on this loop's listener, at most acceptBudget per event
+    void acceptAll(eventLoop *loop)
+    {
+        for (int accepted = 0; accepted < acceptBudget; accepted++)
+        {
+            sockaddr_in cli_addr;
+            socklen_t clilen = sizeof(cli_addr);
+            int fd = accept4(loop->listenfd, (sockaddr *)&cli_addr, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return; // EAGAIN, or out of descriptors until someone disconnects
+            }
+            connectionPtr conn = std::make_shared<reactorConnection>();
+            conn->fd = fd;
+            int on = 1; // replies are small and latency bound, do not let Nagle hold them
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            conn->epfd = loop->epfd;
+            conn->outbound = makeOutboundQueue(settings);
+            conn->portno = ntohs(cli_addr.sin_port);
+            inet_ntop(AF_INET, &cli_addr.sin_addr, conn->ipaddress, INET_ADDRSTRLEN);
+            loop->conns[fd] = conn;
+            if (onOpen)
+                onOpen(conn);
+            watch(loop->epfd, fd, EPOLLIN);
+        }
+    }
+
+    // read into inBuf, at most readBudget reads per event so one flooding client
+    // cannot starve the rest of the loop (epoll is level triggered, it comes back)
+    // returns false on EOF or error
+    bool readAll(const connectionPtr &conn)
+    {
+        char buffer[65536];
+        for (int reads = 0; reads < readBudget; )
+        {
+            ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+            if (n > 0)
+            {
+                conn->inBuf.append(buffer, n);
+                reads++;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+            return false;
+        }
+        return true;
+    }
+
+    // write queued frames; drops EPOLLOUT interest once the queue is empty
+    static bool flush(const connectionPtr &conn)
+    {
+        std::lock_guard<std::mutex> lock(conn->outLock);
+        outboundQueue::drainResult result = conn->outbound->drain(conn->fd);
+        if (result == outboundQueue::failed)
+            return false;
+        if (result == outboundQueue::drained && conn->writeArmed)
+        {
+            conn->writeArmed = false;
+            modify(conn->epfd, conn->fd, EPOLLIN);
+        }
+        return true;
+    }
+
+    void closeConnection(eventLoop *loop, const connectionPtr &conn)
+    {
+        if (onClose)
+            onClose(conn);
+        {
+            std::lock_guard<std::mutex> lock(conn->outLock);
+            conn->closed = true;
+            conn->outbound->close();
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, nullptr);
+            close(conn->fd);
+        }
+        loop->conns.erase(conn->fd);
+    }
+
+    void run(eventLoop *loop)
+    {
+        epoll_event events[64];
+        while (running)
+        {
+            int n = epoll_wait(loop->epfd, events, 64, -1);
+            for (int i = 0; i < n && running; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == loop->wakefd)
+                {
+                    uint64_t count;
+                    if (read(loop->wakefd, &count, sizeof(count)) < 0) {}
+                    if (!accepting && loop->listenfd >= 0)
+                    {
+                        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, loop->listenfd, nullptr);
+                        close(loop->listenfd);
+                        loop->listenfd = -1;
+                    }
+                    continue;
+                }
+                if (fd == loop->listenfd)
+                {
+                    acceptAll(loop);
+                    continue;
+                }
+                auto found = loop->conns.find(fd);
+                if (found == loop->conns.end())
+                    continue;
+                connectionPtr conn = found->second;
+                bool alive = true;
+                if (events[i].events & EPOLLOUT)
+                    alive = flush(conn);
+                if (alive && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                {
+                    alive = readAll(conn);
+                    if (!conn->inBuf.empty() && onData)
+                        onData(conn);
+                }
+                if (!alive)
+                    closeConnection(loop, conn);
+            }
+        }
+        // server is going down, release every client still attached to this loop
+        std::vector<connectionPtr> remaining;
+        for (auto &entry : loop->conns)
+            remaining.push_back(entry.second);
+        for (auto &conn : remaining)
+            closeConnection(loop, conn);
+    }
+};
@@ -0,0 +1,144 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Concurrent registry of connected clients. Every client gets a stable
+64-bit id. The registry is split into shards, each with its own lock and hash map,
+so insert and remove are O(1) and only contend within one shard.
+
+Broadcasts read a snapshot instead of locking the registry: each shard publishes an
+immutable vector of its clients (copy-on-write, swapped atomically the way RCU
+publishes a new version). A change only marks the shard stale, and the next reader
+rebuilds it. A reader holding a snapshot keeps those clients alive through
+shared_ptr, so accepts and disconnects never wait for a broadcast to finish.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+template <typename T>
+class connectionRegistry
+{
+public:
+    typedef std::shared_ptr<T> entryPtr;
+    typedef std::shared_ptr<const std::vector<entryPtr>> shardView;
+
+    // a consistent-per-shard view of the registry, safe to iterate without locks
+    class snapshot
+    {
+    public:
+        template <typename F>
+        void forEach(F fn) const
+        {
+            for (const shardView &view : views)
+                for (const entryPtr &entry : *view)
+                    fn(entry);
+        }
+
+    private:
+        friend class connectionRegistry;
+        std::vector<shardView> views;
+    };
+
+    connectionRegistry() : shards(shardCount) {}
+
+    /*
+    Adds an entry and assigns it a new id. T must have a uint64_t id member, which
+    is set before the entry becomes visible to snapshots.
+    @param entry the client to add
+    @return the id the entry is registered under
+    */
+    uint64_t insert(const entryPtr &entry)
+    {
+        uint64_t id = nextId.fetch_add(1) + 1;
+        entry->id = id;
+        shard &s = shards[id % shardCount];
+        {
+            std::lock_guard<std::mutex> guard(s.lock);
+            s.entries[id] = entry;
+            std::atomic_store(&s.view, shardView());
+        }
+        count++;
+        return id;
+    }
+
+    /*
+    Removes an entry; a no-op if it is already gone
+    @param id the id returned by insert
+    @return true if the entry was present
+    */
+    bool remove(uint64_t id)
+    {
+        shard &s = shards[id % shardCount];
+        {
+            std::lock_guard<std::mutex> guard(s.lock);
+            if (s.entries.erase(id) == 0)
+                return false;
+            std::atomic_store(&s.view, shardView());
+        }
+        count--;
+        return true;
+    }
+
+    /*
+    Looks up an entry by id
+    @param id the id returned by insert
+    @return the entry, or nullptr if it is gone
+    */
+    entryPtr find(uint64_t id)
+    {
+        shard &s = shards[id % shardCount];
+        std::lock_guard<std::mutex> guard(s.lock);
+        auto found = s.entries.find(id);
+        return (found == s.entries.end()) ? entryPtr() : found->second;
+    }
+
+    // takes a snapshot of every shard, rebuilding only the shards that changed
+    snapshot take()
+    {
+        snapshot snap;
+        snap.views.reserve(shardCount);
+        for (shard &s : shards)
+        {
+            shardView view = std::atomic_load(&s.view);
+            if (!view)
+            {
+                std::lock_guard<std::mutex> guard(s.lock);
+                view = std::atomic_load(&s.view); // another reader may have rebuilt it meanwhile
+                if (!view)
+                {
+                    std::shared_ptr<std::vector<entryPtr>> fresh = std::make_shared<std::vector<entryPtr>>();
+                    fresh->reserve(s.entries.size());
+                    for (auto &entry : s.entries)
+                        fresh->push_back(entry.second);
+                    view = fresh;
+                    std::atomic_store(&s.view, view);
+                }
+            }
+            snap.views.push_back(view);
+        }
+        return snap;
+    }
+
+    // number of registered entries
+    size_t size() const { return count.load(); }
+
+private:
+    static const size_t shardCount = 16;
+
+    struct shard
+    {
+        std::mutex lock;
+        std::unordered_map<uint64_t, entryPtr> entries;
+        shardView view;   // null when entries changed since the last snapshot
+    };
+
+    std::vector<shard> shards;
+    std::atomic<uint64_t> nextId{0};
+    std::atomic<size_t> count{0};
+};
@@ -0,0 +1,117 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: In-place byte reversal for the nType '1' reply. Blocks are taken from
+both ends of the buffer at once, reversed with a byte shuffle and stored swapped,
+so each byte is loaded and stored once and no temporary copy is needed. The middle
+that is too short for two blocks is finished one byte pair at a time.
+
+The widest kernel the compiler is allowed to emit is used: AVX2 (32-byte blocks)
+with -mavx2, SSSE3 pshufb with -mssse3, otherwise the SSE2 shuffles every x86-64
+has, NEON on ARM, and plain swaps elsewhere. -march=native picks the best one.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSSE3__)
+    #include <tmmintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+/*
+Reverses bytes one pair at a time, the fallback and the reference for the kernels
+@param data first byte
+@param len number of bytes
+*/
+inline void reverseInPlaceScalar(char *data, size_t len)
+{
+    char *lo = data, *hi = data + len;
+    while (hi - lo > 1)
+    {
+        --hi;
+        std::swap(*lo, *hi);
+        ++lo;
+    }
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// reverse the 16 bytes of one register
+    #if defined(__SSSE3__) || defined(__AVX2__)
+inline __m128i reverse16(__m128i v)
+{
+    const __m128i mask = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    return _mm_shuffle_epi8(v, mask);
+}
+    #elif defined(__SSE2__)
+inline __m128i reverse16(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));   // dwords
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)); // words within dwords
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); // bytes within words
+}
+    #else
+inline uint8x16_t reverse16(uint8x16_t v)
+{
+    v = vrev64q_u8(v);        // bytes within each half
+    return vextq_u8(v, v, 8); // swap the halves
+}
+    #endif
+#endif
+
+/*
+Reverses a buffer in place
+@param data first byte
+@param len number of bytes
+*/
+inline void reverseInPlace(char *data, size_t len)
+{
+    char *lo = data, *hi = data + len;
+#if defined(__AVX2__)
+    const __m256i mask = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    while (hi - lo >= 64)
+    {
+        hi -= 32;
+        __m256i a = _mm256_loadu_si256((const __m256i *)lo);
+        __m256i b = _mm256_loadu_si256((const __m256i *)hi);
+        // reverse within each 128-bit lane, then swap the lanes
+        a = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, mask), _MM_SHUFFLE(1, 0, 3, 2));
+        b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, mask), _MM_SHUFFLE(1, 0, 3, 2));
+        _mm256_storeu_si256((__m256i *)lo, b);
+        _mm256_storeu_si256((__m256i *)hi, a);
+        lo += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    while (hi - lo >= 32)
+    {
+        hi -= 16;
+        __m128i a = _mm_loadu_si128((const __m128i *)lo);
+        __m128i b = _mm_loadu_si128((const __m128i *)hi);
+        _mm_storeu_si128((__m128i *)lo, reverse16(b));
+        _mm_storeu_si128((__m128i *)hi, reverse16(a));
+        lo += 16;
+    }
+#elif defined(__ARM_NEON)
+    while (hi - lo >= 32)
+    {
+        hi -= 16;
+        uint8x16_t a = vld1q_u8((const uint8_t *)lo);
+        uint8x16_t b = vld1q_u8((const uint8_t *)hi);
+        vst1q_u8((uint8_t *)lo, reverse16(b));
+        vst1q_u8((uint8_t *)hi, reverse16(a));
+        lo += 16;
+    }
+#endif
+    reverseInPlaceScalar(lo, hi - lo);
+}
@@ -0,0 +1,269 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Link between the processes of a sharded server (Linux only). Every
+shard process accepts its own share of the clients (the kernel spreads connections
+over the SO_REUSEPORT listeners of all processes) and relays what other shards
+need to know, broadcasts, publishes and history, over Unix domain sockets.
+
+Shard i listens on <dir>/shard-<port>-<i>.sock. For every other shard it runs a
+thread that connects to that shard's socket (retrying until it is up) and writes a
+relay queue to it, so relaying from a client thread or event loop never waits on a
+peer. Relayed messages use the version '2' framing. A shard that is not connected
+yet misses what is relayed meanwhile, and so does a shard that stops reading long
+enough to fill its relay queue (65536 messages or 64 MiB): the queue is closed,
+relays to it fail at once, and the link is made again once the shard reads.
+*/
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../TCP_Framing.h"
+#include "TCP_Broadcast.h"
+#include "TCP_Metrics.h"
+
+class shardLink
+{
+public:
+    // called on a reader thread for every message another shard relayed
+    std::function<void(frameView &)> onRelay;
+
+    ~shardLink() { stop(); }
+
+    /*
+    Listens for the other shards and starts connecting to them
+    @param dir directory of the Unix sockets
+    @param port the client port, part of the socket names so servers can share dir
+    @param index this shard, 0 to count - 1
+    @param count number of shards
+    @return false if the listening socket could not be set up
+    */
+    bool start(const std::string &dir, int port, int index, int count)
+    {
+        std::string path = socketPath(dir, port, index);
+        listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr;
+        if (listenfd < 0 || !makeAddress(path, addr))
+            return false;
+        unlink(path.c_str()); // left behind by a shard that was killed
+        if (bind(listenfd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, count) < 0)
+        {
+            close(listenfd);
+            listenfd = -1;
+            return false;
+        }
+        listenPath = path;
+        running = true;
+        peers.assign(count, std::shared_ptr<outboundQueue>());
+        std::atomic_store(&active, queueList(new std::vector<std::shared_ptr<outboundQueue>>()));
+        threads.push_back(std::thread(&shardLink::acceptPeers, this));
+        for (int peer = 0; peer < count; peer++)
+            if (peer != index)
+                threads.push_back(std::thread(&shardLink::writePeer, this, socketPath(dir, port, peer), peer));
+        return true;
+    }
+
+    /*
+    Sends a message to every connected shard, encoded once
+    @param nType message type
+    @param payload message bytes
+    @param len payload length
+    */
+    void relay(unsigned char nType, const char *payload, size_t len)
+    {
+        queueList queues = std::atomic_load(&active);
+        if (!queues || queues->empty())
+            return;
+        std::string out;
+        encodeFrame('2', nType, payload, len, out);
+        sharedBuffer bytes = makeSharedBuffer(std::move(out));
+        for (const std::shared_ptr<outboundQueue> &queue : *queues)
+            if (queue->push(bytes))
+                metricAdd(metricRelayedOut);
+    }
+
+    // number of shards this one is currently sending to
+    size_t connectedPeers()
+    {
+        queueList queues = std::atomic_load(&active);
+        return queues ? queues->size() : 0;
+    }
+
+    /*
+    Closes every link and waits for the link threads. Safe to call twice.
+    */
+    void stop()
+    {
+        if (!running.exchange(false))
+            return;
+        shutdown(listenfd, SHUT_RDWR); // wakes acceptPeers
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (auto &queue : peers)
+                if (queue)
+                    queue->close();
+            for (int fd : readers)
+                shutdown(fd, SHUT_RDWR);
+        }
+        for (auto &thread : threads)
+            thread.join();
+        threads.clear();
+        close(listenfd);
+        unlink(listenPath.c_str());
+    }
+
+    /*
+    Name of a shard's Unix socket
+    @param dir directory of the sockets
+    @param port the client port
+    @param index the shard
+    */
+    static std::string socketPath(const std::string &dir, int port, int index)
+    {
+        return dir + "/shard-" + std::to_string(port) + "-" + std::to_string(index) + ".sock";
+    }
+
+private:
+    typedef std::shared_ptr<const std::vector<std::shared_ptr<outboundQueue>>> queueList;
+
+    int listenfd = -1;
+    std::string listenPath;
+    std::atomic<bool> running{false};
+    std::vector<std::thread> threads;
+
+    std::mutex lock;                                       // guards peers and readers
+    std::vector<std::shared_ptr<outboundQueue>> peers;     // queue of each connected peer
+    std::vector<int> readers;                              // sockets of incoming links
+    queueList active;                                      // connected queues, read lock-free
+
+    static bool makeAddress(const std::string &path, sockaddr_un &addr)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // publishes the connected queues for relay, lock held
+    void publishLocked()
+    {
+        std::shared_ptr<std::vector<std::shared_ptr<outboundQueue>>> fresh =
+            std::make_shared<std::vector<std::shared_ptr<outboundQueue>>>();
+        for (auto &queue : peers)
+            if (queue)
+                fresh->push_back(queue);
+        std::atomic_store(&active, queueList(fresh));
+    }
+
+    // connects to one peer and writes its relay queue, reconnecting if the link drops
+    void writePeer(std::string path, int peer)
+    {
+        sockaddr_un addr;
+        if (!makeAddress(path, addr))
+            return;
+        while (running)
+        {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+            {
+                close(fd);
+                std::this_thread::sleep_for(std::chrono::milliseconds(100)); // peer not up yet
+                continue;
+            }
+            // relays come from client threads and event loops, which must not wait on a
+            // stalled shard: a full queue drops the link, the loop below makes it again
+            std::shared_ptr<outboundQueue> queue = std::make_shared<outboundQueue>(65536, 64 << 20, disconnectSlow);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!running)
+                {
+                    close(fd);
+                    return;
+                }
+                peers[peer] = queue;
+                publishLocked();
+            }
+            while (queue->drainBlocking(fd))
+            {
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                peers[peer].reset();
+                publishLocked();
+            }
+            queue->close();
+            close(fd);
+        }
+    }
+
+    // accepts incoming links, one reader thread each
+    void acceptPeers()
+    {
+        std::vector<std::thread> incoming;
+        while (running)
+        {
+            int fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                break; // listener shut down by stop()
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            readers.push_back(fd);
+            incoming.push_back(std::thread(&shardLink::readPeer, this, fd));
+        }
+        for (auto &thread : incoming)
+            thread.join();
+    }
+
+    // decodes what one peer relays and hands it to onRelay
+    void readPeer(int fd)
+    {
+        frameDecoder decoder;
+        frameView frame;
+        char buffer[65536];
+        for (;;)
+        {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            decoder.feed(buffer, n);
+            while (decoder.next(frame))
+            {
+                metricAdd(metricRelayedIn);
+                if (onRelay)
+                    onRelay(frame);
+            }
+            if (decoder.failed())
+                break;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < readers.size(); i++)
+        {
+            if (readers[i] == fd)
+            {
+                readers.erase(readers.begin() + i);
+                break;
+            }
+        }
+        close(fd);
+    }
+};
@@ -0,0 +1,792 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: io_uring backend for the TCP server (Linux 6.0 or newer). It has the same
+callbacks and connection type as the epoll Reactor (TCP_Reactor.h), so the server's
+message handling runs unchanged on top of it, but sockets are never polled: every
+accept, receive and send is a request on a ring the kernel completes.
+
+Each loop thread owns one ring and one SO_REUSEPORT listener:
+  - one multishot accept produces a completion per new client
+  - each client has one multishot recv that picks buffers from a ring of provided
+    buffers, so no memory is reserved for idle clients
+  - queued frames are sent as a chain of linked sends, executed in order by the
+    kernel; a short or failed send cancels the rest of the chain, which is resent
+Only the loop thread may submit, so a frame queued from another thread wakes the
+loop through an eventfd read that is always pending on the ring.
+The syscalls are made directly, liburing is not needed.
+*/
+
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "TCP_Broadcast.h"
+#include "TCP_Reactor.h"
+
+#if defined(__NR_io_uring_setup) && defined(IORING_RECV_MULTISHOT)
+    #define TCP_HAVE_URING 1
+#endif
+
+class UringReactor
+{
+public:
+    // called from the loop thread that owns the connection
+    std::function<void(const connectionPtr &)> onOpen;
+    std::function<void(const connectionPtr &)> onData;   // new bytes are in conn->inBuf
+    std::function<void(const connectionPtr &)> onClose;
+
+    // capacity and slow-consumer policy of every connection's outbound queue
+    queueSettings settings;
+
+    ~UringReactor() { stop(); }
+
+#ifdef TCP_HAVE_URING
+    /*
+    Sets up one ring, buffer ring and listening socket per loop and starts the loops.
+    @param portno port number every loop listens on through SO_REUSEPORT
+    @param numLoops number of loop threads
+    @param inherited listening sockets taken over from another process, loop i
+                     uses inherited[i] instead of opening its own
+    @return false if io_uring is unavailable or a listening socket could not be set up
+    */
+    bool start(int portno, int numLoops, const std::vector<int> &inherited = std::vector<int>())
+    {
+        for (int i = 0; i < numLoops; i++)
+        {
+            std::unique_ptr<uringLoop> loop(new uringLoop);
+            bool ready = setupRing(loop.get());
+            if (!ready)
+                loop->listenfd = -1;
+            else if (i < (int)inherited.size())
+                loop->listenfd = Reactor::adoptListener(inherited[i]);
+            else
+                loop->listenfd = Reactor::openListener(portno);
+            loop->wakefd = eventfd(0, EFD_CLOEXEC);
+            loops.push_back(std::move(loop));
+            if (loops.back()->listenfd < 0)
+            {
+                // taken-over sockets stay with the caller, it may start another backend on them
+                for (size_t k = 0; k < loops.size() && k < inherited.size(); k++)
+                    if (loops[k]->listenfd == inherited[k])
+                        loops[k]->listenfd = -1;
+                stop();
+                return false;
+            }
+        }
+        running = true;
+        accepting = true;
+        for (auto &loop : loops)
+        {
+            loop->worker = std::thread(&UringReactor::run, this, loop.get());
+        }
+        return true;
+    }
+#else
+    // built against kernel headers without multishot recv
+    bool start(int, int, const std::vector<int> & = std::vector<int>()) { return false; }
+#endif
+
+    /*
+    Wakes every loop, waits for them to exit and releases the rings. Safe to call twice.
+    */
+    void stop()
+    {
+        running = false;
+        for (auto &loop : loops)
+        {
+            uint64_t one = 1;
+            if (loop->wakefd >= 0 && write(loop->wakefd, &one, sizeof(one)) < 0) {}
+        }
+        for (auto &loop : loops)
+        {
+            if (loop->worker.joinable())
+                loop->worker.join();
+            releaseRing(loop.get());
+        }
+        loops.clear();
+    }
+
+    /*
+    Every loop cancels its accept and closes its listening socket, and keeps serving
+    its connections. Sockets handed to another process keep accepting there.
+    */
+    void stopAccepting()
+    {
+        accepting = false;
+        for (auto &loop : loops)
+        {
+            uint64_t one = 1;
+            if (loop->wakefd >= 0 && write(loop->wakefd, &one, sizeof(one)) < 0) {}
+        }
+    }
+
+    // the listening sockets, one per loop, for a handoff
+    std::vector<int> listeners() const
+    {
+        std::vector<int> fds;
+        for (auto &loop : loops)
+            fds.push_back(loop->listenfd);
+        return fds;
+    }
+
+private:
+    enum opCode { opAccept = 1, opRecv, opSend, opWake, opCancel };
+
+    static const unsigned ringEntries = 4096;
+    static const unsigned bufferCount = 512;       // provided buffers per loop, power of 2
+    static const unsigned bufferSize = 8192;
+    static const size_t maxChain = 64;             // linked sends in flight per client
+
+    // loop-side state of one client
+    struct uringConn
+    {
+        connectionPtr conn;
+        bool recvArmed = false;                    // a recv request is in the kernel
+        bool closing = false;                      // shut down, waiting for requests to finish
+        std::vector<queuedBuffer> chain;           // buffers of the send chain in flight
+        size_t chainSent = 0;                      // buffers of chain fully written
+        size_t chainOffset = 0;                    // bytes of chain[chainSent] written
+        size_t inFlight = 0;                       // send requests not completed yet
+        bool chainBroken = false;                  // a send came up short, resend the rest
+        bool failed = false;                       // the socket refused a send
+    };
+
+    struct uringLoop
+    {
+        int ringfd = -1;
+        int listenfd = -1;
+        int wakefd = -1;
+        std::thread worker;
+
+        // submission queue, shared with the kernel
+        unsigned *sqHead = nullptr, *sqTail = nullptr, *sqArray = nullptr;
+        unsigned sqMask = 0, sqEntries = 0, sqLocalTail = 0;
+        io_uring_sqe *sqes = nullptr;
+        // completion queue, shared with the kernel
+        unsigned *cqHead = nullptr, *cqTail = nullptr;
+        unsigned cqMask = 0;
+        io_uring_cqe *cqes = nullptr;
+        void *ringPtr = nullptr, *cqPtr = nullptr;
+        size_t ringLen = 0, cqLen = 0, sqesLen = 0;
+
+        // provided receive buffers
+        io_uring_buf_ring *bufRing = nullptr;
+        size_t bufRingLen = 0;
+        unsigned bufTail = 0;
+        std::vector<char> buffers;
+
+        uint64_t wakeValue = 0;                    // target of the pending eventfd read
+        bool multishotAccept = true;               // cleared if the kernel refuses it
+        bool multishotRecv = true;
+
+        std::unordered_map<int, uringConn> conns;  // by fd, loop thread only
+        std::vector<connectionPtr> localPending;   // kicked from the loop thread
+        std::mutex pendingLock;
+        std::vector<connectionPtr> pending;        // kicked from other threads
+    };
+
+    // a completion copied out of the ring
+    struct completion
+    {
+        uint64_t data;
+        int res;
+        unsigned flags;
+    };
+
+    std::vector<std::unique_ptr<uringLoop>> loops;
+    std::atomic<bool> running{false};
+    std::atomic<bool> accepting{false};
+
+    // the loop the calling thread runs, so kicks from it skip the eventfd
+    static uringLoop *&currentLoop()
+    {
+        static thread_local uringLoop *loop = nullptr;
+        return loop;
+    }
+
+    static uint64_t userData(opCode op, int fd) { return ((uint64_t)op << 32) | (uint32_t)fd; }
+
+#ifdef TCP_HAVE_URING
+    static int uringSetup(unsigned entries, io_uring_params *params)
+    {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    static int uringEnter(int ringfd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return (int)syscall(__NR_io_uring_enter, ringfd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    static int uringRegister(int ringfd, unsigned opcode, void *arg, unsigned count)
+    {
+        return (int)syscall(__NR_io_uring_register, ringfd, opcode, arg, count);
+    }
+
+    // map the rings and register the provided buffers; false if io_uring is unusable
+    static bool setupRing(uringLoop *loop)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        // a deep completion queue absorbs bursts of multishot completions
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+        params.cq_entries = ringEntries * 4;
+        loop->ringfd = uringSetup(ringEntries, &params);
+        if (loop->ringfd < 0 && errno == EINVAL)
+        {
+            params.flags &= ~IORING_SETUP_COOP_TASKRUN; // older than 5.19
+            loop->ringfd = uringSetup(ringEntries, &params);
+        }
+        if (loop->ringfd < 0)
+            return false;
+
+        loop->ringLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        loop->cqLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            loop->ringLen = loop->cqLen = std::max(loop->ringLen, loop->cqLen);
+        loop->ringPtr = mmap(nullptr, loop->ringLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             loop->ringfd, IORING_OFF_SQ_RING);
+        if (loop->ringPtr == MAP_FAILED)
+            return false;
+        loop->cqPtr = single ? loop->ringPtr
+                             : mmap(nullptr, loop->cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    loop->ringfd, IORING_OFF_CQ_RING);
+        if (loop->cqPtr == MAP_FAILED)
+            return false;
+        loop->sqesLen = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, loop->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          loop->ringfd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        loop->sqes = (io_uring_sqe *)sqes;
+
+        char *sq = (char *)loop->ringPtr;
+        loop->sqHead = (unsigned *)(sq + params.sq_off.head);
+        loop->sqTail = (unsigned *)(sq + params.sq_off.tail);
+        loop->sqArray = (unsigned *)(sq + params.sq_off.array);
+        loop->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        loop->sqEntries = params.sq_entries;
+        loop->sqLocalTail = *loop->sqTail;
+        char *cq = (char *)loop->cqPtr;
+        loop->cqHead = (unsigned *)(cq + params.cq_off.head);
+        loop->cqTail = (unsigned *)(cq + params.cq_off.tail);
+        loop->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        loop->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+        // the buffer ring must be page aligned, the buffers themselves need not be
+        loop->bufRingLen = bufferCount * sizeof(io_uring_buf);
+        void *bufRing = mmap(nullptr, loop->bufRingLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufRing == MAP_FAILED)
+            return false;
+        loop->bufRing = (io_uring_buf_ring *)bufRing;
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)bufRing;
+        reg.ring_entries = bufferCount;
+        reg.bgid = 0;
+        if (uringRegister(loop->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            return false; // older than 5.19
+        loop->buffers.resize((size_t)bufferCount * bufferSize);
+        for (unsigned bid = 0; bid < bufferCount; bid++)
+            recycleBuffer(loop, bid);
+        return true;
+    }
+#endif
+
+    static void releaseRing(uringLoop *loop)
+    {
+        if (loop->listenfd >= 0)
+            close(loop->listenfd);
+        if (loop->ringfd >= 0)
+            close(loop->ringfd); // cancels whatever is still pending
+        if (loop->wakefd >= 0)
+            close(loop->wakefd);
+        if (loop->sqes != nullptr)
+            munmap(loop->sqes, loop->sqesLen);
+        if (loop->cqPtr != nullptr && loop->cqPtr != MAP_FAILED && loop->cqPtr != loop->ringPtr)
+            munmap(loop->cqPtr, loop->cqLen);
+        if (loop->ringPtr != nullptr && loop->ringPtr != MAP_FAILED)
+            munmap(loop->ringPtr, loop->ringLen);
+        if (loop->bufRing != nullptr)
+            munmap(loop->bufRing, loop->bufRingLen);
+        loop->ringfd = loop->listenfd = loop->wakefd = -1;
+        loop->sqes = nullptr;
+        loop->ringPtr = loop->cqPtr = nullptr;
+        loop->bufRing = nullptr;
+    }
+
+#ifdef TCP_HAVE_URING
+    // requests written but not yet consumed by the kernel
+    static unsigned unsubmitted(uringLoop *loop)
+    {
+        return loop->sqLocalTail - __atomic_load_n(loop->sqHead, __ATOMIC_ACQUIRE);
+    }
+
+    // hand every written request to the kernel without waiting
+    static void submit(uringLoop *loop)
+    {
+        __atomic_store_n(loop->sqTail, loop->sqLocalTail, __ATOMIC_RELEASE);
+        while (unsubmitted(loop) > 0 && uringEnter(loop->ringfd, unsubmitted(loop), 0, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+    // make room for count requests in a row, so a send chain is never split
+    static void reserve(uringLoop *loop, unsigned count)
+    {
+        if (loop->sqEntries - unsubmitted(loop) < count)
+            submit(loop);
+    }
+
+    // next free submission entry, cleared; submits first if the queue is full
+    static io_uring_sqe *nextSqe(uringLoop *loop)
+    {
+        reserve(loop, 1);
+        unsigned index = loop->sqLocalTail & loop->sqMask;
+        io_uring_sqe *sqe = &loop->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        loop->sqArray[index] = index;
+        loop->sqLocalTail++;
+        return sqe;
+    }
+
+    // give a receive buffer back to the kernel
+    static void recycleBuffer(uringLoop *loop, unsigned bid)
+    {
+        // the ring is an array of io_uring_buf; bufs[] is not used because in C++ the
+        // header's flexible array member sits 8 bytes past the start of the ring
+        io_uring_buf *buf = (io_uring_buf *)loop->bufRing + (loop->bufTail & (bufferCount - 1));
+        buf->addr = (uint64_t)(uintptr_t)(loop->buffers.data() + (size_t)bid * bufferSize);
+        buf->len = bufferSize;
+        buf->bid = (unsigned short)bid;
+        loop->bufTail++;
+        __atomic_store_n(&loop->bufRing->tail, (unsigned short)loop->bufTail, __ATOMIC_RELEASE);
+    }
+
+    static void armAccept(uringLoop *loop)
+    {
+        io_uring_sqe *sqe = nextSqe(loop);
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = loop->listenfd;
+        sqe->ioprio = loop->multishotAccept ? IORING_ACCEPT_MULTISHOT : 0;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = userData(opAccept, loop->listenfd);
+    }
+
+    static void armWake(uringLoop *loop)
+    {
+        io_uring_sqe *sqe = nextSqe(loop);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = loop->wakefd;
+        sqe->addr = (uint64_t)(uintptr_t)&loop->wakeValue;
+        sqe->len = sizeof(loop->wakeValue);
+        sqe->off = (uint64_t)-1;
+        sqe->user_data = userData(opWake, loop->wakefd);
+    }
+
+    static void armRecv(uringLoop *loop, uringConn &uc)
+    {
+        io_uring_sqe *sqe = nextSqe(loop);
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = uc.conn->fd;
+        sqe->ioprio = loop->multishotRecv ? IORING_RECV_MULTISHOT : 0;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = userData(opRecv, uc.conn->fd);
+        uc.recvArmed = true;
+    }
+
+    // submit what is left of uc.chain as linked sends
+    static void submitChain(uringLoop *loop, uringConn &uc)
+    {
+        size_t count = uc.chain.size() - uc.chainSent;
+        reserve(loop, (unsigned)count);
+        for (size_t i = uc.chainSent; i < uc.chain.size(); i++)
+        {
+            size_t skip = (i == uc.chainSent) ? uc.chainOffset : 0;
+            io_uring_sqe *sqe = nextSqe(loop);
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = uc.conn->fd;
+            sqe->addr = (uint64_t)(uintptr_t)(uc.chain[i].buf->data() + skip);
+            sqe->len = (unsigned)(uc.chain[i].buf->size() - skip);
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            if (i + 1 < uc.chain.size())
+                sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = userData(opSend, uc.conn->fd);
+        }
+        uc.inFlight = count;
+        uc.chainBroken = false;
+    }
+#endif
+
+    /*
+    Installed as reactorConnection::kick: asks the owning loop to send what was queued
+    @param conn the connection a buffer was queued on
+    */
+    static void kick(const connectionPtr &conn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(conn->outLock);
+            if (conn->closed || conn->writeArmed)
+                return; // the loop already knows
+            conn->writeArmed = true;
+        }
+        uringLoop *loop = (uringLoop *)conn->owner;
+        if (loop == currentLoop())
+        {
+            loop->localPending.push_back(conn);
+            return;
+        }
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(loop->pendingLock);
+            wake = loop->pending.empty(); // otherwise a wakeup is already on its way
+            loop->pending.push_back(conn);
+        }
+        uint64_t one = 1;
+        if (wake && write(loop->wakefd, &one, sizeof(one)) < 0) {}
+    }
+
+#ifdef TCP_HAVE_URING
+    // start a send chain with whatever is queued, unless one is in flight
+    void startSend(uringLoop *loop, const connectionPtr &conn)
+    {
+        auto found = loop->conns.find(conn->fd);
+        if (found == loop->conns.end() || found->second.conn != conn)
+            return; // closed meanwhile
+        uringConn &uc = found->second;
+        {
+            std::lock_guard<std::mutex> lock(conn->outLock);
+            conn->writeArmed = false;
+        }
+        if (uc.closing || uc.inFlight > 0)
+            return; // the chain in flight picks up the rest when it completes
+        uc.chain.clear();
+        uc.chainSent = uc.chainOffset = 0;
+        if (conn->outbound->take(uc.chain, maxChain) && !uc.chain.empty())
+            submitChain(loop, uc);
+    }
+
+    void openConnection(uringLoop *loop, int fd)
+    {
+        connectionPtr conn = std::make_shared<reactorConnection>();
+        conn->fd = fd;
+        conn->epfd = -1;
+        int on = 1; // replies are small and latency bound, do not let Nagle hold them
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        sockaddr_in cli_addr;
+        socklen_t clilen = sizeof(cli_addr);
+        memset(&cli_addr, 0, sizeof(cli_addr));
+        getpeername(fd, (sockaddr *)&cli_addr, &clilen);
+        conn->portno = ntohs(cli_addr.sin_port);
+        inet_ntop(AF_INET, &cli_addr.sin_addr, conn->ipaddress, INET_ADDRSTRLEN);
+        conn->outbound = makeOutboundQueue(settings);
+        conn->kick = &UringReactor::kick;
+        conn->owner = loop;
+        uringConn &uc = loop->conns[fd];
+        uc = uringConn();
+        uc.conn = conn;
+        if (onOpen)
+            onOpen(conn);
+        armRecv(loop, uc);
+    }
+
+    // stop using a connection; it is released once the kernel returned its requests
+    void beginClose(uringLoop *loop, uringConn &uc)
+    {
+        if (uc.closing)
+            return;
+        uc.closing = true;
+        if (onClose)
+            onClose(uc.conn);
+        {
+            std::lock_guard<std::mutex> lock(uc.conn->outLock);
+            uc.conn->closed = true;
+            uc.conn->outbound->close();
+        }
+        shutdown(uc.conn->fd, SHUT_RDWR); // completes the pending recv and sends
+        if (uc.recvArmed)
+        {
+            io_uring_sqe *sqe = nextSqe(loop);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = userData(opRecv, uc.conn->fd);
+            sqe->user_data = userData(opCancel, uc.conn->fd);
+        }
+    }
+
+    // close the socket once nothing in the kernel refers to it
+    static void finishIfIdle(uringLoop *loop, int fd)
+    {
+        auto found = loop->conns.find(fd);
+        if (found == loop->conns.end())
+            return;
+        uringConn &uc = found->second;
+        if (uc.closing && !uc.recvArmed && uc.inFlight == 0)
+        {
+            close(fd);
+            loop->conns.erase(found);
+        }
+    }
+
+    void onRecv(uringLoop *loop, int fd, int res, unsigned flags)
+    {
+        bool haveBuffer = (flags & IORING_CQE_F_BUFFER) != 0;
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        auto found = loop->conns.find(fd);
+        if (found == loop->conns.end())
+        {
+            if (haveBuffer)
+                recycleBuffer(loop, bid);
+            return;
+        }
+        uringConn &uc = found->second;
+        bool more = (flags & IORING_CQE_F_MORE) != 0;
+        if (!more)
+            uc.recvArmed = false;
+        if (res > 0)
+        {
+            if (!uc.closing)
+                uc.conn->inBuf.append(loop->buffers.data() + (size_t)bid * bufferSize, res);
+            recycleBuffer(loop, bid);
+            if (!uc.closing && onData)
+                onData(uc.conn);
+            if (!more && !uc.closing)
+                armRecv(loop, uc);
+        }
+        else
+        {
+            if (haveBuffer)
+                recycleBuffer(loop, bid);
+            if (res == -EINVAL && loop->multishotRecv)
+                loop->multishotRecv = false; // older than 6.0, arm one recv at a time
+            if ((res == -ENOBUFS || res == -EINVAL) && !uc.closing)
+            {
+                if (!more)
+                    armRecv(loop, uc); // every buffer was busy, try again
+            }
+            else
+                beginClose(loop, uc); // EOF or a socket error
+        }
+        finishIfIdle(loop, fd);
+    }
+
+    void onSend(uringLoop *loop, int fd, int res)
+    {
+        auto found = loop->conns.find(fd);
+        if (found == loop->conns.end())
+            return;
+        uringConn &uc = found->second;
+        uc.inFlight--;
+        if (!uc.chainBroken)
+        {
+            size_t expected = uc.chain[uc.chainSent].buf->size() - uc.chainOffset;
+            if (res > 0)
+                uc.conn->outbound->sentBytes(res);
+            if (res >= 0 && (size_t)res == expected)
+            {
+                uc.conn->outbound->sentMessage(uc.chain[uc.chainSent], metricsNowUs());
+                uc.chainSent++;
+                uc.chainOffset = 0;
+            }
+            else
+            {
+                // the kernel cancels the rest of the chain; resend from here
+                uc.chainBroken = true;
+                if (res > 0)
+                    uc.chainOffset += res;
+                else if (res != -ECANCELED)
+                    uc.failed = true;
+            }
+        }
+        if (uc.inFlight > 0)
+            return;
+        if (uc.failed)
+            beginClose(loop, uc);
+        else if (!uc.closing && uc.chainSent < uc.chain.size())
+            submitChain(loop, uc);
+        else
+            startSend(loop, uc.conn);
+        finishIfIdle(loop, fd);
+    }
+
+    void onWake(uringLoop *loop)
+    {
+        std::vector<connectionPtr> kicked;
+        {
+            std::lock_guard<std::mutex> lock(loop->pendingLock);
+            kicked.swap(loop->pending);
+        }
+        for (auto &conn : kicked)
+            startSend(loop, conn);
+        if (!accepting && loop->listenfd >= 0)
+        {
+            // the pending accept holds its own reference, the cancel finds it by user_data
+            io_uring_sqe *sqe = nextSqe(loop);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = userData(opAccept, loop->listenfd);
+            sqe->user_data = userData(opCancel, loop->listenfd);
+            close(loop->listenfd);
+            loop->listenfd = -1;
+        }
+        if (running)
+            armWake(loop);
+    }
+
+    // start the sends the server queued from this thread
+    void startLocal(uringLoop *loop)
+    {
+        std::vector<connectionPtr> kicked;
+        kicked.swap(loop->localPending);
+        for (auto &conn : kicked)
+            startSend(loop, conn);
+    }
+
+    // copy every completion the kernel has posted so far into out
+    static void collect(uringLoop *loop, std::vector<completion> &out)
+    {
+        unsigned head = *loop->cqHead;
+        while (head != __atomic_load_n(loop->cqTail, __ATOMIC_ACQUIRE))
+        {
+            io_uring_cqe *cqe = &loop->cqes[head & loop->cqMask];
+            completion c;
+            c.data = cqe->user_data;
+            c.res = cqe->res;
+            c.flags = cqe->flags;
+            out.push_back(c);
+            head++;
+        }
+        __atomic_store_n(loop->cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    void dispatch(uringLoop *loop, const completion &c)
+    {
+        int fd = (int)(uint32_t)c.data;
+        switch ((opCode)(c.data >> 32))
+        {
+        case opAccept:
+            if (c.res >= 0)
+                openConnection(loop, c.res);
+            else if (c.res == -EINVAL && loop->multishotAccept)
+                loop->multishotAccept = false; // older than 5.19, accept one at a time
+            if (!(c.flags & IORING_CQE_F_MORE) && running && loop->listenfd >= 0)
+                armAccept(loop);
+            break;
+        case opRecv:
+            onRecv(loop, fd, c.res, c.flags);
+            break;
+        case opSend:
+            onSend(loop, fd, c.res);
+            break;
+        case opWake:
+            onWake(loop);
+            break;
+        case opCancel:
+            break;
+        }
+    }
+
+    /*
+    Processes every completion the kernel has posted. A multishot recv can post
+    hundreds of completions ahead of the sends they cause, so after each one the new
+    sends are submitted at once (sends to a socket with room finish inline) and their
+    completions are handled before the receives still waiting; otherwise the outbound
+    queues would fill up while a flood is being read.
+    */
+    void reap(uringLoop *loop)
+    {
+        std::vector<completion> batch;
+        collect(loop, batch);
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            dispatch(loop, batch[i]);
+            bool progress = true;
+            while (progress)
+            {
+                startLocal(loop);
+                if (unsubmitted(loop) == 0)
+                    break;
+                submit(loop);
+                size_t seen = batch.size();
+                collect(loop, batch);
+                progress = false;
+                for (size_t k = seen; k < batch.size(); )
+                {
+                    if ((opCode)(batch[k].data >> 32) != opSend)
+                    {
+                        k++;
+                        continue;
+                    }
+                    completion c = batch[k];
+                    batch.erase(batch.begin() + k);
+                    dispatch(loop, c);
+                    progress = true;
+                }
+            }
+        }
+    }
+
+    void run(uringLoop *loop)
+    {
+        currentLoop() = loop;
+        armAccept(loop);
+        armWake(loop);
+        while (running)
+        {
+            // submit everything and sleep until at least one request completes
+            __atomic_store_n(loop->sqTail, loop->sqLocalTail, __ATOMIC_RELEASE);
+            int n = uringEnter(loop->ringfd, unsubmitted(loop), 1, IORING_ENTER_GETEVENTS);
+            if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                perror("ERROR on io_uring_enter");
+                break;
+            }
+            reap(loop);
+        }
+
+        // server is going down, shut every client and wait briefly for the kernel to
+        // hand back their requests before the ring is torn down
+        for (auto &entry : loop->conns)
+            beginClose(loop, entry.second);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (!loop->conns.empty() && std::chrono::steady_clock::now() < deadline)
+        {
+            std::vector<int> fds;
+            for (auto &entry : loop->conns)
+                fds.push_back(entry.first);
+            for (int fd : fds)
+                finishIfIdle(loop, fd);
+            __atomic_store_n(loop->sqTail, loop->sqLocalTail, __ATOMIC_RELEASE);
+            if (!loop->conns.empty())
+            {
+                uringEnter(loop->ringfd, unsubmitted(loop), 1, IORING_ENTER_GETEVENTS);
+                reap(loop);
+            }
+        }
+        for (auto &entry : loop->conns)
+            close(entry.first);
+        loop->conns.clear();
+        currentLoop() = nullptr;
+    }
+#endif
+};
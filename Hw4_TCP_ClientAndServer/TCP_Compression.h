@@ -0,0 +1,225 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Small LZ77 codec for the payloads of broadcast frames, shared by the
+TCP client and server. Chat messages are short, so on their own they hardly repeat
+anything; both sides therefore start from the same preset dictionary of common
+chat text, and matches may reach back into it as if it preceded the payload.
+
+Block format, a sequence of:
+    token            high 4 bits literal count, low 4 bits match length - 4
+    [literal count]  only if the high bits are 15: bytes added until one is < 255
+    literals
+    offset           2 bytes, little endian, distance back into dictionary + output
+    [match length]   only if the low bits are 15, extended like the literal count
+The last sequence has literals only and ends the block.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// name a client asks for in the nType 8 handshake; changes with the dictionary
+const char compressionName[] = "lz1";
+
+// payloads shorter than this are always sent uncompressed
+const size_t minCompressPayload = 24;
+
+const size_t lzMinMatch = 4;
+const size_t lzMaxOffset = 65535;
+const int lzHashBits = 12;
+
+/*
+Text both sides pretend precedes every payload. Never change it without changing
+compressionName, peers with another dictionary would decode garbage.
+*/
+inline const std::string &presetDictionary()
+{
+    static const std::string dictionary =
+        "http://https://www..com/.org/ the of and to in is it you that was for on are with as I "
+        "his they be at one have this from or had by not word but what some we can out other "
+        "were all there when up use your how said an each she which do their time if will way "
+        "about many then them write would like so these her long make thing see him two has "
+        "look more day could go come did number sound no most people my over know water than "
+        "call first who may down side been now find any new work part take get place made live "
+        "where after back little only round man year came show every good me give our under "
+        "name very through just form sentence great think say help low line differ turn cause "
+        "much mean before move right boy old too same tell does set three want air well also "
+        "play small end put home read hand port large spell add even land here must big high "
+        "such follow act why ask men change went light kind off need house picture try us again "
+        "Hello, hello everyone! Hi all, hey there. Good morning, good night. Thanks! thank you. "
+        "Yes, no, ok, okay, sure. What's up? How are you? I'm fine. I don't know. Let me know. "
+        "See you later. Sounds good. Anyone here? Can you hear me? lol :) :( :D "
+        "message from client server channel broadcast connected disconnected "
+        "Received Msg Type: ; Msg: The quick brown fox jumps over the lazy dog. ";
+    return dictionary;
+}
+
+// hash of the lzMinMatch bytes at p
+inline uint32_t lzHash(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return (value * 2654435761u) >> (32 - lzHashBits);
+}
+
+// the match table already filled with the dictionary, built once and copied per call
+inline const std::vector<uint32_t> &dictionaryTable()
+{
+    static const std::vector<uint32_t> table = []() {
+        const std::string &dictionary = presetDictionary();
+        std::vector<uint32_t> filled(1 << lzHashBits, 0);
+        for (size_t pos = 0; pos + lzMinMatch <= dictionary.size(); pos++)
+            filled[lzHash((const unsigned char *)dictionary.data() + pos)] = (uint32_t)pos + 1;
+        return filled;
+    }();
+    return table;
+}
+
+// appends a literal count or match length that did not fit in its 4 token bits
+inline void lzPutLength(size_t extra, std::string &out)
+{
+    while (extra >= 255)
+    {
+        out.push_back((char)255);
+        extra -= 255;
+    }
+    out.push_back((char)extra);
+}
+
+/*
+Appends one sequence
+@param literals bytes copied as they are
+@param count number of literals
+@param offset distance of the match, unused when matchLen is 0
+@param matchLen match length, 0 for the last sequence
+@param out the block
+*/
+inline void lzPutSequence(const unsigned char *literals, size_t count, size_t offset, size_t matchLen, std::string &out)
+{
+    size_t matchCode = matchLen ? matchLen - lzMinMatch : 0;
+    out.push_back((char)(((count < 15 ? count : 15) << 4) | (matchCode < 15 ? matchCode : 15)));
+    if (count >= 15)
+        lzPutLength(count - 15, out);
+    out.append((const char *)literals, count);
+    if (matchLen == 0)
+        return;
+    out.push_back((char)(offset & 0xff));
+    out.push_back((char)(offset >> 8));
+    if (matchCode >= 15)
+        lzPutLength(matchCode - 15, out);
+}
+
+/*
+Compresses a payload against the preset dictionary
+@param data payload bytes
+@param len payload length
+@param out replaced with the block
+@return false if the block is not smaller than the payload, out is then unspecified
+*/
+inline bool lzCompress(const char *data, size_t len, std::string &out)
+{
+    const std::string &dictionary = presetDictionary();
+    std::string window;
+    window.reserve(dictionary.size() + len);
+    window.append(dictionary);
+    window.append(data, len);
+    std::vector<uint32_t> table = dictionaryTable(); // positions + 1, 0 for none
+    const unsigned char *base = (const unsigned char *)window.data();
+    size_t total = window.size(), pos = dictionary.size(), anchor = pos;
+    out.clear();
+    out.reserve(len);
+    while (pos + lzMinMatch <= total)
+    {
+        uint32_t &slot = table[lzHash(base + pos)];
+        size_t candidate = slot;
+        slot = (uint32_t)pos + 1;
+        if (candidate == 0 || pos - (candidate - 1) > lzMaxOffset ||
+            memcmp(base + candidate - 1, base + pos, lzMinMatch) != 0)
+        {
+            pos++;
+            continue;
+        }
+        candidate--;
+        size_t matchLen = lzMinMatch;
+        while (pos + matchLen < total && base[candidate + matchLen] == base[pos + matchLen])
+            matchLen++;
+        lzPutSequence(base + anchor, pos - anchor, pos - candidate, matchLen, out);
+        if (out.size() >= len)
+            return false;
+        pos += matchLen;
+        anchor = pos;
+    }
+    lzPutSequence(base + anchor, total - anchor, 0, 0, out);
+    return out.size() < len;
+}
+
+// reads the rest of a literal count or match length, false if the block ends first
+inline bool lzGetLength(const unsigned char *&in, const unsigned char *inEnd, size_t &value)
+{
+    unsigned char byte;
+    do
+    {
+        if (in == inEnd)
+            return false;
+        byte = *in++;
+        value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/*
+Expands a block made by lzCompress. Every length and offset is checked, so a
+corrupt block fails instead of reading or writing out of bounds.
+@param block the compressed bytes
+@param len block length
+@param rawLen payload length the sender announced
+@param out replaced with the payload
+@return false if the block is corrupt or does not expand to exactly rawLen bytes
+*/
+inline bool lzDecompress(const char *block, size_t len, size_t rawLen, std::string &out)
+{
+    const std::string &dictionary = presetDictionary();
+    const unsigned char *in = (const unsigned char *)block, *inEnd = in + len;
+    out.resize(rawLen);
+    char *dst = &out[0]; // valid even when rawLen is 0
+    size_t done = 0;
+    while (in < inEnd)
+    {
+        unsigned char token = *in++;
+        size_t count = token >> 4;
+        if (count == 15 && !lzGetLength(in, inEnd, count))
+            return false;
+        if ((size_t)(inEnd - in) < count || rawLen - done < count)
+            return false;
+        memcpy(dst + done, in, count);
+        in += count;
+        done += count;
+        if (in == inEnd)
+            break; // the last sequence has no match
+        if (inEnd - in < 2)
+            return false;
+        size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !lzGetLength(in, inEnd, matchLen))
+            return false;
+        matchLen += lzMinMatch;
+        if (offset == 0 || offset > done + dictionary.size() || rawLen - done < matchLen)
+            return false;
+        // the part of the match that lies in the dictionary
+        for (; matchLen > 0 && offset > done; matchLen--, done++)
+            dst[done] = dictionary[dictionary.size() - (offset - done)];
+        // the rest; byte by byte when it overlaps what it is copying
+        if (offset >= matchLen)
+            memcpy(dst + done, dst + done - offset, matchLen);
+        else
+            for (size_t i = 0; i < matchLen; i++)
+                dst[done + i] = dst[done + i - offset];
+        done += matchLen;
+    }
+    return done == rawLen;
+}
@@ -0,0 +1,285 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Wire format shared by the TCP client and server.
+
+Version '1' is the original fixed-size tcpMessage: every send moves the whole
+1004-byte struct no matter how short the message is.
+Version '2' is length prefixed: a 6-byte header (nVersion, nType, 32-bit payload
+length in network byte order) followed by exactly nMsgLen payload bytes, so short
+messages stay short and messages longer than 1000 bytes are allowed.
+Version '3' is a version '2' frame whose payload is compressed (TCP_Compression.h):
+the 4-byte length counts what follows, a 32-bit uncompressed length and the block.
+Only peers that asked for it with the nType 8 handshake are sent version '3'.
+
+frameDecoder turns an arbitrary stream of received bytes back into frames, so
+neither side depends on one recv returning exactly one message. It owns the
+receive buffer: a reader asks it for room with prepare(), receives straight into
+it and commit()s what arrived, then pulls out every complete frame of that read.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "TCP_Compression.h"
+
+// structure defining the message transmitted (version '1')
+typedef struct tcpMessage
+{
+    unsigned char nVersion;
+    unsigned char nType;
+    unsigned short nMsgLen;
+    char chMsg[1000];
+} tcpMessage;
+
+// largest payload accepted in a version '2' frame
+const uint32_t maxFramePayload = 1 << 20;
+
+// size of the version '2' header: nVersion, nType, 4-byte length
+const size_t compactHeaderSize = 6;
+
+// wire version of compressed frames, and the handshake type that enables them
+const unsigned char compressedVersion = '3';
+const unsigned char compressHandshakeType = '8';
+
+// one decoded message, independent of the version it arrived in
+struct tcpFrame
+{
+    unsigned char nVersion;
+    unsigned char nType;
+    std::string payload;
+};
+
+// one decoded message pointing into the decoder's buffer instead of owning a copy.
+// The payload may be modified in place and stays valid until the next feed() or prepare().
+// Decompressed messages keep nVersion '3'.
+struct frameView
+{
+    unsigned char nVersion;
+    unsigned char nType;
+    char *payload;
+    size_t len;
+};
+
+// writes a 32-bit value in network byte order
+inline void putLength32(uint32_t value, char *out)
+{
+    out[0] = (char)(value >> 24);
+    out[1] = (char)(value >> 16);
+    out[2] = (char)(value >> 8);
+    out[3] = (char)value;
+}
+
+// reads a 32-bit value in network byte order
+inline uint32_t getLength32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+Appends the wire encoding of a message to out
+@param nVersion '1' for the fixed tcpMessage layout, '2' for the compact layout
+@param nType message type
+@param data payload bytes
+@param len payload length, truncated to 999 bytes for version '1'
+@param out buffer the frame is appended to
+*/
+inline void encodeFrame(unsigned char nVersion, unsigned char nType, const char *data, size_t len, std::string &out)
+{
+    if (nVersion == '2')
+    {
+        char header[compactHeaderSize];
+        header[0] = (char)nVersion;
+        header[1] = (char)nType;
+        putLength32((uint32_t)len, header + 2);
+        out.append(header, compactHeaderSize);
+        out.append(data, len);
+        return;
+    }
+    tcpMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    if (len > sizeof(msg.chMsg) - 1)
+        len = sizeof(msg.chMsg) - 1; // keep the terminating 0 version '1' readers expect
+    msg.nVersion = nVersion;
+    msg.nType = nType;
+    msg.nMsgLen = (unsigned short)len;
+    memcpy(msg.chMsg, data, len);
+    out.append((const char *)&msg, sizeof(msg));
+}
+
+/*
+Appends a version '3' frame, or a version '2' frame when compressing does not make
+the message smaller
+@param nType message type
+@param data payload bytes
+@param len payload length
+@param out buffer the frame is appended to
+@return true if the frame is compressed
+*/
+inline bool encodeCompressedFrame(unsigned char nType, const char *data, size_t len, std::string &out)
+{
+    std::string block;
+    if (len < minCompressPayload || len > maxFramePayload || !lzCompress(data, len, block) ||
+        block.size() + 4 >= len)
+    {
+        encodeFrame('2', nType, data, len, out);
+        return false;
+    }
+    char header[compactHeaderSize + 4];
+    header[0] = (char)compressedVersion;
+    header[1] = (char)nType;
+    putLength32((uint32_t)(block.size() + 4), header + 2);
+    putLength32((uint32_t)len, header + compactHeaderSize);
+    out.append(header, sizeof(header));
+    out.append(block);
+    return true;
+}
+
+/*
+Incremental decoder for a stream that may mix version '1', '2' and '3' frames.
+A leading '2' or '3' byte starts a compact frame, anything else is a whole tcpMessage.
+*/
+class frameDecoder
+{
+public:
+    /*
+    Makes room at the end of the buffer for the next read. Frees the consumed prefix
+    first, so frame views handed out before are invalid afterwards.
+    @param want bytes the read may return
+    @return where to receive up to want bytes, then call commit
+    */
+    char *prepare(size_t want)
+    {
+        expandedUsed = 0;
+        if (start == end)
+        {
+            start = end = 0; // everything consumed, reuse the buffer from its start
+        }
+        else if (start > 0 && (end + want > buffer.size() || start * 2 > end))
+        {
+            // move the partial frame to the front instead of growing
+            memmove(&buffer[0], &buffer[start], end - start);
+            end -= start;
+            start = 0;
+        }
+        if (end + want > buffer.size())
+            buffer.resize(end + want);
+        return &buffer[end];
+    }
+
+    /*
+    Adds the bytes a read placed at prepare()'s pointer
+    @param len number of bytes received, at most what was prepared
+    */
+    void commit(size_t len) { end += len; }
+
+    /*
+    Adds received bytes to the decoder, for readers that cannot receive into it
+    @param data bytes read from the socket
+    @param len number of bytes
+    */
+    void feed(const char *data, size_t len)
+    {
+        memcpy(prepare(len), data, len);
+        commit(len);
+    }
+
+    /*
+    Extracts the next complete frame
+    @param frame filled with a copy of the decoded message
+    @return true if a frame was produced, false if more bytes are needed
+    */
+    bool next(tcpFrame &frame)
+    {
+        frameView view;
+        if (!next(view))
+            return false;
+        frame.nVersion = view.nVersion;
+        frame.nType = view.nType;
+        frame.payload.assign(view.payload, view.len);
+        return true;
+    }
+
+    /*
+    Extracts the next complete frame without copying its payload
+    @param frame pointed at the decoded message inside the decoder's buffer
+    @return true if a frame was produced, false if more bytes are needed
+    */
+    bool next(frameView &frame)
+    {
+        size_t avail = end - start;
+        if (avail == 0 || bad)
+            return false;
+        unsigned char *p = (unsigned char *)&buffer[start];
+        if (p[0] == '2' || p[0] == compressedVersion)
+        {
+            if (avail < compactHeaderSize)
+                return false;
+            uint32_t len = getLength32(p + 2);
+            if (len > maxFramePayload)
+            {
+                bad = true;
+                return false;
+            }
+            if (avail < compactHeaderSize + len)
+                return false;
+            frame.nVersion = p[0];
+            frame.nType = p[1];
+            frame.payload = (char *)p + compactHeaderSize;
+            frame.len = len;
+            start += compactHeaderSize + len;
+            if (p[0] == compressedVersion && !expand(frame))
+            {
+                bad = true;
+                return false;
+            }
+            return true;
+        }
+        if (avail < sizeof(tcpMessage))
+            return false;
+        tcpMessage *msg = (tcpMessage *)p;
+        size_t len = msg->nMsgLen < sizeof(msg->chMsg) ? msg->nMsgLen : sizeof(msg->chMsg);
+        frame.nVersion = msg->nVersion;
+        frame.nType = msg->nType;
+        frame.payload = msg->chMsg;
+        frame.len = strnlen(msg->chMsg, len);
+        start += sizeof(tcpMessage);
+        return true;
+    }
+
+    // true once the peer sent a frame larger than maxFramePayload or a corrupt compressed one
+    bool failed() const { return bad; }
+
+private:
+    std::vector<char> buffer;   // only grows, so steady reads never allocate
+    size_t start = 0;           // first byte not decoded yet
+    size_t end = 0;             // one past the last byte received
+    bool bad = false;
+    // payloads of the compressed frames decoded since the last prepare(); a deque,
+    // so adding one never moves the others, and the strings are reused
+    std::deque<std::string> expanded;
+    size_t expandedUsed = 0;
+
+    // points a version '3' frame at its decompressed payload
+    bool expand(frameView &frame)
+    {
+        if (frame.len < 4)
+            return false;
+        uint32_t rawLen = getLength32((const unsigned char *)frame.payload);
+        if (rawLen > maxFramePayload)
+            return false;
+        if (expandedUsed == expanded.size())
+            expanded.emplace_back();
+        std::string &payload = expanded[expandedUsed++];
+        if (!lzDecompress(frame.payload + 4, frame.len - 4, rawLen, payload))
+            return false;
+        frame.payload = rawLen ? &payload[0] : frame.payload;
+        frame.len = rawLen;
+        return true;
+    }
+};
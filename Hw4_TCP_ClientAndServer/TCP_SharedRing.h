@@ -0,0 +1,393 @@
+/*
+Author: Oguzhan Yilmaz
+Class: ECE4122
+Description: Shared-memory transport for a client running on the same host as the
+server (Linux only). The client creates a POSIX shared-memory segment holding two
+single-producer single-consumer byte rings, one per direction, and names it to the
+server in a type '6' message over the TCP connection. The server answers '6' "ok"
+on TCP and from then on both sides move the same frames (TCP_Framing.h) through the
+rings instead of the loopback stack. The TCP connection stays open; closing it
+ends the session as before.
+
+Each ring is a byte stream like a socket, so a frameDecoder reads it unchanged.
+The producer only writes head and the consumer only writes tail. A side that finds
+nothing to do spins briefly, then sleeps on a futex in the shared mapping; the other
+side only makes the wake-up system call when it sees the sleeper flag set, so a
+busy pair exchanges messages without entering the kernel at all.
+
+The server only attaches a segment for a peer connected from the loopback or one
+of the host's own addresses, so a remote connection cannot name a local client's
+segment; names also end in 64 random bits, so they cannot be guessed. Beyond that
+the server trusts the client as far as the segment's mode allows: it is created
+0600, so only a client running as the server's own user can make one. The server checks the ring size once when it attaches and never
+reads it from the segment again, and every index is checked against that size,
+so a client scribbling over the header cannot make the server copy outside its
+mapping. A client that shrinks the segment with ftruncate while it is mapped
+still makes the server's next access fault with SIGBUS and kill the server; a
+POSIX name cannot be sealed against that (a sealed memfd could, but needs the fd
+passed over a Unix socket, not named over TCP), so run the server only for
+clients of the same, trusted user.
+*/
+
+#pragma once
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <ifaddrs.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <stdio.h>
+
+// message type of the handshake, client: segment name, server: "ok" or a reason
+const unsigned char shmHandshakeType = '6';
+
+// segment names the server agrees to open start with this
+const char shmNamePrefix[] = "/tcpshm-";
+
+const uint32_t shmMagic = 0x54435253;            // "TCRS"
+const uint32_t shmDefaultRingBytes = 1 << 20;
+const uint32_t shmMaxRingBytes = 64 << 20;
+
+// one direction of the pair, inside the shared mapping. The producer's and the
+// consumer's fields sit on separate cache lines so they do not bounce.
+struct shmRingState
+{
+    alignas(64) std::atomic<uint64_t> head;          // bytes ever written, producer only
+    std::atomic<uint32_t> spaceSeq;                  // bumped by the consumer to wake the producer
+    std::atomic<uint32_t> producerWaiting;           // the producer sleeps on spaceSeq
+    alignas(64) std::atomic<uint64_t> tail;          // bytes ever read, consumer only
+    std::atomic<uint32_t> dataSeq;                   // bumped by the producer to wake the consumer
+    std::atomic<uint32_t> consumerWaiting;           // the consumer sleeps on dataSeq
+};
+
+// start of the segment, followed by the toServer data and then the toClient data
+struct shmSegmentHeader
+{
+    alignas(64) uint32_t magic;
+    uint32_t ringBytes;                 // capacity of each ring, a power of two
+    std::atomic<uint32_t> closed;       // set by either side on the way out
+    shmRingState toServer;
+    shmRingState toClient;
+};
+
+class shmRing
+{
+public:
+    shmRing() {}
+    shmRing(shmRingState *state, char *data, uint32_t capacity, std::atomic<uint32_t> *closed)
+        : state(state), data(data), capacity(capacity), closed(closed) {}
+
+    /*
+    Copies bytes into the ring, waiting for room when it is full
+    @param bytes what to send
+    @param len number of bytes
+    @return false once the channel is closed
+    */
+    bool write(const char *bytes, size_t len)
+    {
+        while (len > 0)
+        {
+            uint64_t head = state->head.load(std::memory_order_relaxed);
+            uint64_t used = head - state->tail.load(std::memory_order_acquire);
+            if (used > capacity)
+                return fail(); // the peer scribbled over the indices
+            if (used == capacity)
+            {
+                if (!waitUntil(state->spaceSeq, state->producerWaiting, [&]() {
+                        return head - state->tail.load(std::memory_order_acquire) < capacity; }, 100)
+                    && closed->load())
+                    return false;
+                continue;
+            }
+            size_t n = (size_t)std::min<uint64_t>(len, capacity - used);
+            size_t offset = (size_t)(head & (capacity - 1));
+            size_t first = std::min(n, (size_t)capacity - offset);
+            memcpy(data + offset, bytes, first);
+            memcpy(data, bytes + first, n - first);
+            state->head.store(head + n, std::memory_order_release);
+            notify(state->dataSeq, state->consumerWaiting);
+            bytes += n;
+            len -= n;
+        }
+        return !closed->load(std::memory_order_relaxed);
+    }
+
+    /*
+    Copies out whatever has arrived, waiting for at least one byte
+    @param out destination
+    @param max size of out
+    @param timeoutMs longest wait when the ring is empty
+    @return bytes read, 0 on timeout, -1 once the channel is closed and drained
+    */
+    long read(char *out, size_t max, int timeoutMs)
+    {
+        uint64_t tail = state->tail.load(std::memory_order_relaxed);
+        uint64_t avail = state->head.load(std::memory_order_acquire) - tail;
+        if (avail == 0)
+        {
+            waitUntil(state->dataSeq, state->consumerWaiting, [&]() {
+                return state->head.load(std::memory_order_acquire) != tail; }, timeoutMs);
+            avail = state->head.load(std::memory_order_acquire) - tail;
+            if (avail == 0)
+                return closed->load() ? -1 : 0;
+        }
+        if (avail > capacity)
+        {
+            fail(); // the peer scribbled over the indices
+            return -1;
+        }
+        size_t n = (size_t)std::min<uint64_t>(avail, max);
+        size_t offset = (size_t)(tail & (capacity - 1));
+        size_t first = std::min(n, (size_t)capacity - offset);
+        memcpy(out, data + offset, first);
+        memcpy(out + first, data, n - first);
+        state->tail.store(tail + n, std::memory_order_release);
+        notify(state->spaceSeq, state->producerWaiting);
+        return (long)n;
+    }
+
+    // wakes whoever sleeps on this ring, used when the channel closes
+    void wakeAll()
+    {
+        state->dataSeq.fetch_add(1);
+        state->spaceSeq.fetch_add(1);
+        futex(state->dataSeq, FUTEX_WAKE, INT32_MAX, NULL);
+        futex(state->spaceSeq, FUTEX_WAKE, INT32_MAX, NULL);
+    }
+
+private:
+    // checks made before going to sleep; long enough to catch a reply that is
+    // already on its way, short enough not to matter on a busy single core
+    static const int spinChecks = 200;
+
+    shmRingState *state = nullptr;
+    char *data = nullptr;
+    uint32_t capacity = 0;
+    std::atomic<uint32_t> *closed = nullptr;
+
+    static long futex(std::atomic<uint32_t> &word, int op, uint32_t value, const timespec *timeout)
+    {
+        // shared mapping, so no FUTEX_PRIVATE_FLAG
+        return syscall(SYS_futex, (uint32_t *)&word, op, value, timeout, NULL, 0);
+    }
+
+    bool fail()
+    {
+        closed->store(1);
+        return false;
+    }
+
+    /*
+    Sleeps on seq until ready() holds, the channel closes or the timeout passes.
+    Raises the sleeper flag before the final check; the other side publishes its
+    index before reading the flag, so one of the two always sees the other.
+    */
+    template <typename F>
+    bool waitUntil(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting, F ready, int timeoutMs)
+    {
+        for (int i = 0; i < spinChecks; i++)
+            if (ready() || closed->load(std::memory_order_relaxed))
+                return ready();
+        uint32_t snapshot = seq.load();
+        waiting.store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready() && !closed->load())
+        {
+            timespec timeout = {timeoutMs / 1000, (long)(timeoutMs % 1000) * 1000000};
+            futex(seq, FUTEX_WAIT, snapshot, &timeout);
+        }
+        waiting.store(0, std::memory_order_relaxed);
+        return ready();
+    }
+
+    // after publishing an index: wake the other side if it went to sleep
+    static void notify(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed))
+        {
+            seq.fetch_add(1);
+            futex(seq, FUTEX_WAKE, 1, NULL);
+        }
+    }
+};
+
+/*
+Tells whether a TCP peer runs on this host: connected from the loopback or from an
+address of one of this host's interfaces (the server listens on IPv4 only)
+@param fd the connected socket
+*/
+inline bool shmPeerIsLocal(int fd)
+{
+    sockaddr_storage peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(fd, (sockaddr *)&peer, &len) != 0)
+        return false;
+    if (peer.ss_family != AF_INET)
+        return false;
+    in_addr_t address = ((sockaddr_in *)&peer)->sin_addr.s_addr;
+    if ((ntohl(address) >> 24) == 127)
+        return true;
+    ifaddrs *interfaces;
+    if (getifaddrs(&interfaces) != 0)
+        return false;
+    bool local = false;
+    for (ifaddrs *i = interfaces; i != NULL && !local; i = i->ifa_next)
+        local = i->ifa_addr != NULL && i->ifa_addr->sa_family == AF_INET &&
+                ((sockaddr_in *)i->ifa_addr)->sin_addr.s_addr == address;
+    freeifaddrs(interfaces);
+    return local;
+}
+
+// a mapped segment: the ring pair and the shared closed flag
+class shmChannel
+{
+public:
+    shmRing toServer;   // client writes, server reads
+    shmRing toClient;   // server writes, client reads
+
+    ~shmChannel()
+    {
+        if (header != nullptr)
+            munmap(header, mappedBytes);
+    }
+
+    /*
+    Creates a new segment for the client side
+    @param ringBytes capacity of each ring, rounded up to a power of two
+    @return the channel, or nullptr if shared memory is unavailable
+    */
+    static std::shared_ptr<shmChannel> create(uint32_t ringBytes = shmDefaultRingBytes)
+    {
+        uint32_t capacity = 4096;
+        while (capacity < ringBytes && capacity < shmMaxRingBytes)
+            capacity <<= 1;
+        static std::atomic<unsigned> counter{0};
+        uint64_t secret;
+        if (getrandom(&secret, sizeof(secret), 0) != (ssize_t)sizeof(secret))
+            return nullptr;
+        char suffix[17];
+        snprintf(suffix, sizeof(suffix), "%016llx", (unsigned long long)secret);
+        std::string name = std::string(shmNamePrefix) + std::to_string((long)getpid()) + "-" +
+                           std::to_string(counter++) + "-" + suffix;
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+            return nullptr;
+        size_t bytes = segmentBytes(capacity);
+        std::shared_ptr<shmChannel> channel;
+        if (ftruncate(fd, bytes) == 0)
+            channel = map(fd, bytes);
+        ::close(fd);
+        if (!channel)
+        {
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+        // a fresh segment is zero filled, so the indices and flags start at 0
+        channel->header->ringBytes = capacity;
+        channel->header->magic = shmMagic;
+        channel->name = name;
+        channel->wire(capacity);
+        return channel;
+    }
+
+    /*
+    Maps a segment created by a client, for the server side
+    @param name the name the client sent
+    @return the channel, or nullptr if it is not a valid segment
+    */
+    static std::shared_ptr<shmChannel> attach(const std::string &name)
+    {
+        if (name.compare(0, sizeof(shmNamePrefix) - 1, shmNamePrefix) != 0 ||
+            name.find('/', 1) != std::string::npos)
+            return nullptr;
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            return nullptr;
+        struct stat info;
+        std::shared_ptr<shmChannel> channel;
+        if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(shmSegmentHeader))
+            channel = map(fd, info.st_size);
+        ::close(fd);
+        if (!channel)
+            return nullptr;
+        // read exactly once, the compiler must not load it again after the checks
+        uint32_t capacity = *(volatile uint32_t *)&channel->header->ringBytes;
+        if (channel->header->magic != shmMagic || capacity < 4096 || capacity > shmMaxRingBytes ||
+            (capacity & (capacity - 1)) != 0 || segmentBytes(capacity) != (size_t)info.st_size)
+            return nullptr;
+        // the checked size; the client can still write the header's copy
+        channel->wire(capacity);
+        return channel;
+    }
+
+    // removes the name once the server has mapped the segment (or refused it)
+    void unlinkName()
+    {
+        if (!name.empty())
+            shm_unlink(name.c_str());
+        name.clear();
+    }
+
+    // segment name to send in the handshake
+    const std::string &segmentName() const { return name; }
+
+    // tells the other side the session is over and wakes every sleeper
+    void close()
+    {
+        header->closed.store(1);
+        toServer.wakeAll();
+        toClient.wakeAll();
+    }
+
+    bool isClosed() const { return header->closed.load() != 0; }
+
+private:
+    shmSegmentHeader *header = nullptr;
+    size_t mappedBytes = 0;
+    std::string name;   // only set on the side that created it
+
+    static size_t segmentBytes(uint32_t capacity)
+    {
+        return sizeof(shmSegmentHeader) + 2 * (size_t)capacity;
+    }
+
+    static std::shared_ptr<shmChannel> map(int fd, size_t bytes)
+    {
+        void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+            return nullptr;
+        std::shared_ptr<shmChannel> channel = std::make_shared<shmChannel>();
+        channel->header = (shmSegmentHeader *)base;
+        channel->mappedBytes = bytes;
+        return channel;
+    }
+
+    /*
+    Builds the two rings over the mapping
+    @param capacity size of each ring, already checked against the mapping
+    */
+    void wire(uint32_t capacity)
+    {
+        char *data = (char *)header + sizeof(shmSegmentHeader);
+        toServer = shmRing(&header->toServer, data, capacity, &header->closed);
+        toClient = shmRing(&header->toClient, data + capacity, capacity, &header->closed);
+    }
+};
+
+#endif